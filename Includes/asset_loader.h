@@ -0,0 +1,260 @@
+#ifndef ASSET_LOADER_H
+#define ASSET_LOADER_H
+
+// stb_image.h (v2.14) doesn't guard its implementation, don't include it twice in Source.cpp
+#ifndef STBI_INCLUDE_STB_IMAGE_H
+#include <stb_image.h>
+#endif
+
+#include <shader_m.h>
+#include <benchmark.h>
+#include <thread_pool.h>
+
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <fstream>
+#include <future>
+#include <iomanip>
+#include <iostream>
+#include <iterator>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Startup asset pipeline. Files are read and decoded on a thread pool while the main
+// thread creates the window and compiles shaders; GL uploads stay on the main thread
+// and are issued in the order the assets finish decoding. Every asset records where
+// its time went, printed as the time-to-first-frame breakdown.
+class AssetLoader
+{
+public:
+    // decoded image, the pixels are freed after the upload callback returned; mips holds
+    // levels 1..n down to 1x1 when the image was loaded with mipmaps
+    struct Image
+    {
+        int id;
+        std::string path;
+        int width;
+        int height;
+        int nrComponents;
+        unsigned char* data;
+        std::vector<std::vector<unsigned char> > mips;
+
+        int levels() const
+        {
+            return 1 + (int)mips.size();
+        }
+
+        const unsigned char* level(int index) const
+        {
+            return index == 0 ? data : mips[index - 1].data();
+        }
+    };
+
+    // times are measured relative to 'startup'
+    AssetLoader(ThreadPool& pool, const Timer& startup) : pool(pool), startup(startup), imagesPending(0)
+    {
+    }
+
+    // waits for work still queued on the pool, it references this loader
+    ~AssetLoader()
+    {
+        waitForShaderSources();
+        uploadImages([](const Image&) {});
+    }
+
+    // queues reading and decoding of an image, returns the id passed to the upload callback;
+    // with 'mipmaps' the worker also box filters the mip chain (counted as decode time)
+    int loadImage(const std::string& path, bool mipmaps = false)
+    {
+        int id = addAsset(path, "upload");
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            imagesPending++;
+        }
+        pool.submit([this, id, path, mipmaps]()
+        {
+            Timer timer;
+            std::vector<unsigned char> bytes = readBytes(path);
+            double readMs = timer.elapsedMs();
+
+            timer.reset();
+            Image image = { id, path, 0, 0, 0, NULL };
+            if (!bytes.empty())
+                image.data = stbi_load_from_memory(bytes.data(), (int)bytes.size(), &image.width, &image.height, &image.nrComponents, 0);
+            if (image.data && mipmaps)
+                buildMips(image);
+            double decodeMs = timer.elapsedMs();
+
+            std::lock_guard<std::mutex> lock(mutex);
+            timings[id].readMs = readMs;
+            timings[id].decodeMs = decodeMs;
+            timings[id].readyAtMs = startup.elapsedMs();
+            decoded.push_back(std::move(image));
+            imageReady.notify_one();
+        });
+        return id;
+    }
+
+    // queues reading of a shader pair (and its includes) into the Shader preload cache
+    int loadShaderSources(const std::string& vertexPath, const std::string& fragmentPath)
+    {
+        int id = addAsset(vertexPath.substr(0, vertexPath.find_last_of('.')), "compile");
+        shaderSources.push_back(pool.submit([this, id, vertexPath, fragmentPath]()
+        {
+            Timer timer;
+            Shader::preloadSource(vertexPath);
+            Shader::preloadSource(fragmentPath);
+            double readMs = timer.elapsedMs();
+
+            std::lock_guard<std::mutex> lock(mutex);
+            timings[id].readMs = readMs;
+            timings[id].readyAtMs = startup.elapsedMs();
+        }));
+        return id;
+    }
+
+    void waitForShaderSources()
+    {
+        for (std::future<void>& sources : shaderSources)
+            sources.wait();
+        shaderSources.clear();
+    }
+
+    // calls upload(const Image&) on this thread for every queued image as soon as it is
+    // decoded, returns when all images were uploaded
+    template<typename Upload>
+    void uploadImages(Upload upload)
+    {
+        for (;;)
+        {
+            Image image;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                if (imagesPending == 0)
+                    return;
+                imageReady.wait(lock, [this]() { return !decoded.empty(); });
+                image = std::move(decoded.front());
+                decoded.pop_front();
+                imagesPending--;
+            }
+            Timer timer;
+            upload(image);
+            stbi_image_free(image.data);
+            addMainThreadTime(image.id, timer.elapsedMs());
+        }
+    }
+
+    // adds time the main thread spent on an asset (GL upload, shader compile)
+    void addMainThreadTime(int id, double ms)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        timings[id].mainMs += ms;
+    }
+
+    // size of a file in bytes, -1 if it can't be opened; caches derived from an asset
+    // store it to notice when the asset changed
+    static long long fileSize(const std::string& path)
+    {
+        std::ifstream file(path, std::ios::binary | std::ios::ate);
+        return file ? (long long)file.tellg() : -1;
+    }
+
+    // "resources/textures/right.jpg", ".sh" -> "resources/textures/right.sh", where caches
+    // derived from an asset live
+    static std::string siblingPath(const std::string& path, const std::string& extension)
+    {
+        size_t dot = path.find_last_of('.');
+        size_t slash = path.find_last_of("/\\");
+        return (dot != std::string::npos && (slash == std::string::npos || dot > slash) ? path.substr(0, dot) : path) + extension;
+    }
+
+    void printBreakdown()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::cout << "startup breakdown (" << pool.size() << " loader threads, ms):" << std::endl;
+        std::cout << std::fixed << std::setprecision(1);
+        double read = 0.0, decode = 0.0, main = 0.0;
+        for (const Timing& timing : timings)
+        {
+            std::cout << "  " << std::left << std::setw(40) << timing.name << std::right
+                << " read " << std::setw(6) << timing.readMs
+                << "  decode " << std::setw(6) << timing.decodeMs
+                << "  ready at " << std::setw(7) << timing.readyAtMs
+                << "  " << timing.mainLabel << " " << std::setw(6) << timing.mainMs << std::endl;
+            read += timing.readMs;
+            decode += timing.decodeMs;
+            main += timing.mainMs;
+        }
+        std::cout << "  total: read " << read << ", decode " << decode << " (on workers), main thread " << main << std::endl;
+        std::cout.unsetf(std::ios::floatfield);
+        std::cout << std::setprecision(6);
+    }
+
+private:
+    struct Timing
+    {
+        std::string name;
+        const char* mainLabel;
+        double readMs;
+        double decodeMs;
+        double readyAtMs;
+        double mainMs;
+    };
+
+    ThreadPool& pool;
+    const Timer& startup;
+    std::mutex mutex;
+    std::condition_variable imageReady;
+    std::deque<Image> decoded;
+    size_t imagesPending;
+    std::vector<Timing> timings;
+    std::vector<std::future<void> > shaderSources;
+
+    int addAsset(const std::string& name, const char* mainLabel)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        Timing timing = { name, mainLabel, 0.0, 0.0, 0.0, 0.0 };
+        timings.push_back(timing);
+        return (int)timings.size() - 1;
+    }
+
+    static std::vector<unsigned char> readBytes(const std::string& path)
+    {
+        std::ifstream file(path, std::ios::binary);
+        if (!file)
+            return std::vector<unsigned char>();
+        return std::vector<unsigned char>(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    }
+
+    // 2x2 box filter per level as glGenerateMipmap would, an odd edge repeats its last texel
+    static void buildMips(Image& image)
+    {
+        int components = image.nrComponents;
+        const unsigned char* source = image.data;
+        int width = image.width, height = image.height;
+        while (width > 1 || height > 1)
+        {
+            int mipWidth = std::max(width / 2, 1), mipHeight = std::max(height / 2, 1);
+            std::vector<unsigned char> mip((size_t)mipWidth * mipHeight * components);
+            for (int y = 0; y < mipHeight; y++)
+            {
+                const unsigned char* row0 = source + (size_t)std::min(2 * y, height - 1) * width * components;
+                const unsigned char* row1 = source + (size_t)std::min(2 * y + 1, height - 1) * width * components;
+                unsigned char* out = mip.data() + (size_t)y * mipWidth * components;
+                for (int x = 0; x < mipWidth; x++)
+                {
+                    int x0 = std::min(2 * x, width - 1) * components, x1 = std::min(2 * x + 1, width - 1) * components;
+                    for (int c = 0; c < components; c++)
+                        out[x * components + c] = (unsigned char)((row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c] + 2) / 4);
+                }
+            }
+            image.mips.push_back(std::move(mip));
+            source = image.mips.back().data();
+            width = mipWidth;
+            height = mipHeight;
+        }
+    }
+};
+#endif
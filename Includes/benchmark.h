@@ -0,0 +1,254 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <glad/glad.h>
+
+#include <shader_m.h>
+
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+// Simple wall clock timer used by the benchmark modes (started with e.g. --bench-uniforms)
+class Timer
+{
+public:
+    Timer() : start(std::chrono::steady_clock::now()) {}
+
+    void reset()
+    {
+        start = std::chrono::steady_clock::now();
+    }
+
+    double elapsedMs() const
+    {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+private:
+    std::chrono::steady_clock::time_point start;
+};
+
+// returns true if the given flag was passed on the command line
+inline bool hasArg(int argc, char* argv[], const char* name)
+{
+    for (int i = 1; i < argc; i++)
+        if (std::strcmp(argv[i], name) == 0)
+            return true;
+    return false;
+}
+
+// value following a flag ("--flag value"), NULL if the flag wasn't passed
+inline const char* argValue(int argc, char* argv[], const char* name)
+{
+    for (int i = 1; i + 1 < argc; i++)
+        if (std::strcmp(argv[i], name) == 0)
+            return argv[i + 1];
+    return NULL;
+}
+
+// uploads one zero value of the right type to a uniform location
+inline void uploadZeroUniform(GLenum type, GLint location)
+{
+    static const float zeros[16] = {};
+    switch (type)
+    {
+    case GL_FLOAT:      glUniform1fv(location, 1, zeros); break;
+    case GL_FLOAT_VEC2: glUniform2fv(location, 1, zeros); break;
+    case GL_FLOAT_VEC3: glUniform3fv(location, 1, zeros); break;
+    case GL_FLOAT_VEC4: glUniform4fv(location, 1, zeros); break;
+    case GL_FLOAT_MAT3: glUniformMatrix3fv(location, 1, GL_FALSE, zeros); break;
+    case GL_FLOAT_MAT4: glUniformMatrix4fv(location, 1, GL_FALSE, zeros); break;
+    default:            glUniform1i(location, 0); break;
+    }
+}
+
+// sets one zero value of the right type through the shader's shadowed setters
+inline void setZeroUniform(const Shader& shader, GLenum type, Shader::Uniform u)
+{
+    switch (type)
+    {
+    case GL_FLOAT:      shader.setFloat(u, 0.0f); break;
+    case GL_FLOAT_VEC2: shader.setVec2(u, glm::vec2(0.0f)); break;
+    case GL_FLOAT_VEC3: shader.setVec3(u, glm::vec3(0.0f)); break;
+    case GL_FLOAT_VEC4: shader.setVec4(u, glm::vec4(0.0f)); break;
+    case GL_FLOAT_MAT3: shader.setMat3(u, glm::mat3(0.0f)); break;
+    case GL_FLOAT_MAT4: shader.setMat4(u, glm::mat4(0.0f)); break;
+    default:            shader.setInt(u, 0); break;
+    }
+}
+
+// Measures the CPU cost of uploading every active uniform of a shader once per "frame",
+// first the old way (glGetUniformLocation string lookup per call) and then through the
+// handles cached by the Shader after linking, and finally through the Shader setters,
+// which skip the (unchanged) values after the first frame.
+inline void benchmarkUniformUploads(const Shader& shader, const char* label, int frames = 2000)
+{
+    const std::vector<Shader::UniformInfo>& uniforms = shader.getActiveUniforms();
+    shader.use();
+
+    glFinish();
+    Timer timer;
+    for (int frame = 0; frame < frames; frame++)
+        for (const Shader::UniformInfo& info : uniforms)
+            uploadZeroUniform(info.type, glGetUniformLocation(shader.ID, info.name.c_str()));
+    glFinish();
+    double byName = timer.elapsedMs();
+
+    timer.reset();
+    for (int frame = 0; frame < frames; frame++)
+        for (const Shader::UniformInfo& info : uniforms)
+            uploadZeroUniform(info.type, info.location);
+    glFinish();
+    double byHandle = timer.elapsedMs();
+
+    // the shadow is still empty (the passes above bypassed it), so only the first frame uploads
+    std::vector<Shader::Uniform> handles;
+    for (const Shader::UniformInfo& info : uniforms)
+        handles.push_back(shader.uniform(info.name));
+    Shader::uploadStats() = Shader::UploadStats();
+
+    timer.reset();
+    for (int frame = 0; frame < frames; frame++)
+        for (size_t i = 0; i < uniforms.size(); i++)
+            setZeroUniform(shader, uniforms[i].type, handles[i]);
+    glFinish();
+    double shadowed = timer.elapsedMs();
+    Shader::UploadStats stats = Shader::uploadStats();
+
+    std::cout << label << ": " << uniforms.size() << " uniforms/frame, "
+        << "by name " << byName * 1000.0 / frames << " us/frame, "
+        << "by handle " << byHandle * 1000.0 / frames << " us/frame, "
+        << "shadowed " << shadowed * 1000.0 / frames << " us/frame ("
+        << stats.uploaded << " uploaded, " << stats.skipped << " skipped)" << std::endl;
+}
+
+// Steps the render loop through a list of configurations for benchmark modes that need the
+// whole scene (e.g. --bench-lights). Every step renders 'warmup' untimed frames, then
+// 'frames' timed ones; the caller applies the configuration of step() before each frame.
+class FrameSweep
+{
+public:
+    FrameSweep(size_t steps, int warmup, int frames) : steps(steps), warmup(warmup), frames(frames), current(0), frame(0), totalMs(0.0), lastAverageMs(0.0)
+    {
+    }
+
+    size_t step() const
+    {
+        return current;
+    }
+
+    bool done() const
+    {
+        return current >= steps;
+    }
+
+    // records the time of a finished frame (after glFinish), returns true when the step
+    // is complete; averageMs() then holds its result and step() is the next one
+    bool endFrame(double ms)
+    {
+        frame++;
+        if (frame <= warmup)
+            return false;
+        totalMs += ms;
+        if (frame < warmup + frames)
+            return false;
+        lastAverageMs = totalMs / frames;
+        skip();
+        return true;
+    }
+
+    // moves on to the next step without finishing this one
+    void skip()
+    {
+        current++;
+        frame = 0;
+        totalMs = 0.0;
+    }
+
+    // ms per timed frame of the last completed step
+    double averageMs() const
+    {
+        return lastAverageMs;
+    }
+
+private:
+    size_t steps;
+    int warmup;
+    int frames;
+    size_t current;
+    int frame;
+    double totalMs;
+    double lastAverageMs;
+};
+
+
+// GPU time of a block of GL commands (GL_TIME_ELAPSED). Two query objects are used in turn
+// and results are picked up once available, so reading them never waits for the GPU.
+class GpuTimer
+{
+public:
+    GpuTimer() : current(0), lastMs(0.0)
+    {
+        glGenQueries(2, queries);
+        pending[0] = pending[1] = false;
+    }
+
+    void begin()
+    {
+        poll();
+        // the query is still in flight after two begin() calls, wait for it
+        if (pending[current])
+            read(current);
+        glBeginQuery(GL_TIME_ELAPSED, queries[current]);
+    }
+
+    void end()
+    {
+        glEndQuery(GL_TIME_ELAPSED);
+        pending[current] = true;
+        current ^= 1;
+    }
+
+    // ms of the latest measurement that has finished
+    double elapsedMs()
+    {
+        poll();
+        return lastMs;
+    }
+
+    void destroy()
+    {
+        glDeleteQueries(2, queries);
+    }
+
+private:
+    GLuint queries[2];
+    bool pending[2];
+    int current;
+    double lastMs;
+
+    void poll()
+    {
+        // the older query (the next one to be reused) first, so lastMs ends up with the newest result
+        for (int i = 0; i < 2; i++)
+        {
+            int query = current ^ i;
+            GLint available = 0;
+            if (pending[query])
+                glGetQueryObjectiv(queries[query], GL_QUERY_RESULT_AVAILABLE, &available);
+            if (available)
+                read(query);
+        }
+    }
+
+    void read(int query)
+    {
+        GLuint64 ns = 0;
+        glGetQueryObjectui64v(queries[query], GL_QUERY_RESULT, &ns);
+        lastMs = ns / 1e6;
+        pending[query] = false;
+    }
+};
+#endif
@@ -0,0 +1,255 @@
+#ifndef CLUSTERS_H
+#define CLUSTERS_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include <lights.h>
+#include <uniform_buffer.h>
+#include <gl_state.h>
+#include <benchmark.h>
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <vector>
+
+// Clustered forward lighting. The view frustum is split into a grid of froxels (screen
+// tiles x exponential depth slices); every frame each point light is assigned to the
+// froxels its attenuation radius reaches and the lit shaders (CLUSTERED variants, see
+// clusters.glsl) only evaluate the lights listed for the froxel of the fragment.
+// GL 3.3 has no SSBOs, the lists are passed in buffer textures:
+//   lights  RGBA32F, 4 texels per light (PointLight in view space, same layout as in the Lights UBO)
+//   grid    RG32UI, (first index, light count) per froxel
+//   indices R32UI, light indices of all froxels back to back
+
+// binding point of the "Clusters" uniform block and texture units of the buffer textures
+const unsigned int CLUSTERS_BINDING = 2;
+const unsigned int CLUSTER_LIGHTS_UNIT = 1;
+const unsigned int CLUSTER_GRID_UNIT = 2;
+const unsigned int CLUSTER_INDICES_UNIT = 3;
+
+// C++ mirror of the "Clusters" uniform block in clusters.glsl (std140 layout)
+struct ClusterUniforms
+{
+    glm::uvec4 dims;   // froxels in x, y, z; number of lights
+    glm::vec4 screen;  // framebuffer width, height; zNear, zFar
+    glm::vec4 depth;   // slice = log(viewDepth) * depth.x + depth.y
+};
+
+static_assert(sizeof(ClusterUniforms) == 48, "ClusterUniforms must match std140 layout");
+
+class ClusterGrid
+{
+public:
+    // counters of the last build()
+    struct Stats
+    {
+        double buildMs;
+        size_t indices;
+        unsigned int maxLights;      // most lights in one froxel
+        unsigned int occupied;       // froxels with at least one light
+    };
+
+    UniformBuffer<ClusterUniforms> uniforms;
+
+    ClusterGrid(unsigned int x, unsigned int y, unsigned int z) : uniforms(CLUSTERS_BINDING), stats()
+    {
+        setDims(x, y, z);
+        GLint maxTexels = 0;
+        glGetIntegerv(GL_MAX_TEXTURE_BUFFER_SIZE, &maxTexels);
+        maxIndices = (size_t)maxTexels;
+        createBufferTexture(lightTexture, CLUSTER_LIGHTS_UNIT, GL_RGBA32F);
+        createBufferTexture(gridTexture, CLUSTER_GRID_UNIT, GL_RG32UI);
+        createBufferTexture(indexTexture, CLUSTER_INDICES_UNIT, GL_R32UI);
+    }
+
+    void setDims(unsigned int x, unsigned int y, unsigned int z)
+    {
+        uniforms.data.dims = glm::uvec4(x, y, z, 0);
+    }
+
+    glm::uvec3 dims() const
+    {
+        return glm::uvec3(uniforms.data.dims);
+    }
+
+    // assigns the lights (world space) to the froxels of the given camera and uploads the lists
+    void build(const std::vector<PointLight>& lights, const glm::mat4& view, float fovY, float aspect, float zNear, float zFar, float width, float height)
+    {
+        Timer timer;
+        const unsigned int nx = uniforms.data.dims.x, ny = uniforms.data.dims.y, nz = uniforms.data.dims.z;
+        const float sliceScale = nz / std::log(zFar / zNear);
+        const float sliceBias = -std::log(zNear) * sliceScale;
+        const float tanY = std::tan(fovY * 0.5f);
+        const float tanX = tanY * aspect;
+
+        // froxel ranges of every light, computed once and walked twice (count, then fill)
+        ranges.clear();
+        viewLights.resize(lights.size());
+        for (size_t i = 0; i < lights.size(); i++)
+        {
+            viewLights[i] = toViewSpace(lights[i], view);
+            glm::vec3 center = viewLights[i].position;
+            float radius = lightRadius(lights[i]);
+            float depth = -center.z; // the camera looks down -z
+            if (depth + radius < zNear || depth - radius > zFar)
+                continue;
+            float nearDepth = std::max(depth - radius, zNear);
+            float farDepth = std::min(depth + radius, zFar);
+            LightRange range;
+            range.light = (GLuint)i;
+            range.z0 = slice(nearDepth, sliceScale, sliceBias, nz);
+            range.z1 = slice(farDepth, sliceScale, sliceBias, nz);
+            // conservative tile range: the sphere's x/y extent projected at the nearest and farthest depth
+            range.x0 = tile(std::min((center.x - radius) / (nearDepth * tanX), (center.x - radius) / (farDepth * tanX)), nx);
+            range.x1 = tile(std::max((center.x + radius) / (nearDepth * tanX), (center.x + radius) / (farDepth * tanX)), nx);
+            range.y0 = tile(std::min((center.y - radius) / (nearDepth * tanY), (center.y - radius) / (farDepth * tanY)), ny);
+            range.y1 = tile(std::max((center.y + radius) / (nearDepth * tanY), (center.y + radius) / (farDepth * tanY)), ny);
+            ranges.push_back(range);
+        }
+
+        // counting sort of (froxel, light) pairs into one index list
+        grid.assign((size_t)nx * ny * nz, glm::uvec2(0));
+        for (const LightRange& range : ranges)
+            forEachFroxel(range, nx, ny, [this](size_t froxel) { grid[froxel].y++; });
+        size_t total = 0;
+        stats.maxLights = 0;
+        stats.occupied = 0;
+        for (glm::uvec2& cell : grid)
+        {
+            cell.x = (GLuint)total;
+            total += cell.y;
+            stats.maxLights = std::max(stats.maxLights, cell.y);
+            stats.occupied += cell.y > 0 ? 1 : 0;
+            cell.y = 0;
+        }
+        indices.resize(total);
+        for (const LightRange& range : ranges)
+        {
+            GLuint light = range.light;
+            forEachFroxel(range, nx, ny, [this, light](size_t froxel)
+            {
+                glm::uvec2& cell = grid[froxel];
+                indices[cell.x + cell.y++] = light;
+            });
+        }
+        if (indices.size() > maxIndices)
+        {
+            std::cout << "CLUSTERS::TOO_MANY_INDICES: " << indices.size() << ", the driver allows " << maxIndices << std::endl;
+            indices.resize(maxIndices);
+            for (glm::uvec2& cell : grid)
+                cell.y = cell.x >= maxIndices ? 0 : std::min<GLuint>(cell.y, (GLuint)(maxIndices - cell.x));
+        }
+
+        uploadBuffer(lightTexture, viewLights.data(), viewLights.size() * sizeof(PointLight));
+        uploadBuffer(gridTexture, grid.data(), grid.size() * sizeof(glm::uvec2));
+        uploadBuffer(indexTexture, indices.data(), indices.size() * sizeof(GLuint));
+
+        uniforms.data.dims.w = (GLuint)lights.size();
+        uniforms.data.screen = glm::vec4(width, height, zNear, zFar);
+        uniforms.data.depth = glm::vec4(sliceScale, sliceBias, 0.0f, 0.0f);
+        uniforms.upload();
+
+        stats.indices = indices.size();
+        stats.buildMs = timer.elapsedMs();
+    }
+
+    // binds the buffer textures to their texture units
+    void bind() const
+    {
+        glState().bindTexture(lightTexture.unit, GL_TEXTURE_BUFFER, lightTexture.texture);
+        glState().bindTexture(gridTexture.unit, GL_TEXTURE_BUFFER, gridTexture.texture);
+        glState().bindTexture(indexTexture.unit, GL_TEXTURE_BUFFER, indexTexture.texture);
+    }
+
+    const Stats& lastStats() const
+    {
+        return stats;
+    }
+
+    void destroy()
+    {
+        GLuint buffers[3] = { lightTexture.buffer, gridTexture.buffer, indexTexture.buffer };
+        GLuint textures[3] = { lightTexture.texture, gridTexture.texture, indexTexture.texture };
+        glDeleteBuffers(3, buffers);
+        glDeleteTextures(3, textures);
+        glDeleteBuffers(1, &uniforms.ID);
+    }
+
+private:
+    struct LightRange
+    {
+        GLuint light;
+        unsigned int x0, x1, y0, y1, z0, z1;
+    };
+
+    // buffer object viewed through a buffer texture on a fixed unit
+    struct BufferTexture
+    {
+        GLuint buffer;
+        GLuint texture;
+        GLuint unit;
+    };
+
+    BufferTexture lightTexture;
+    BufferTexture gridTexture;
+    BufferTexture indexTexture;
+    size_t maxIndices;
+    std::vector<PointLight> viewLights;
+    std::vector<LightRange> ranges;
+    std::vector<glm::uvec2> grid;
+    std::vector<GLuint> indices;
+    Stats stats;
+
+    static unsigned int slice(float depth, float scale, float bias, unsigned int count)
+    {
+        float s = std::log(depth) * scale + bias;
+        return (unsigned int)std::min(std::max(s, 0.0f), (float)(count - 1));
+    }
+
+    // tile index of a normalized device coordinate
+    static unsigned int tile(float ndc, unsigned int count)
+    {
+        float t = std::floor((ndc * 0.5f + 0.5f) * count);
+        return (unsigned int)std::min(std::max(t, 0.0f), (float)(count - 1));
+    }
+
+    template<typename Visit>
+    static void forEachFroxel(const LightRange& range, unsigned int nx, unsigned int ny, Visit visit)
+    {
+        for (unsigned int z = range.z0; z <= range.z1; z++)
+            for (unsigned int y = range.y0; y <= range.y1; y++)
+                for (unsigned int x = range.x0; x <= range.x1; x++)
+                    visit(x + (size_t)nx * (y + (size_t)ny * z));
+    }
+
+    // the texture keeps viewing the buffer object when uploads replace its data store
+    static void createBufferTexture(BufferTexture& bufferTexture, GLuint unit, GLenum format)
+    {
+        glGenBuffers(1, &bufferTexture.buffer);
+        glGenTextures(1, &bufferTexture.texture);
+        bufferTexture.unit = unit;
+        uploadBuffer(bufferTexture, NULL, 0);
+        glState().bindTexture(unit, GL_TEXTURE_BUFFER, bufferTexture.texture);
+        glTexBuffer(GL_TEXTURE_BUFFER, format, bufferTexture.buffer);
+    }
+
+    static void uploadBuffer(const BufferTexture& bufferTexture, const void* data, size_t size)
+    {
+        // a buffer texture must not be empty
+        static const GLuint zero[4] = {};
+        if (size == 0)
+        {
+            data = zero;
+            size = sizeof(zero);
+        }
+        // the lists change every frame; a new data store lets the driver keep the old one
+        // for draws still in flight instead of waiting for them
+        glBindBuffer(GL_TEXTURE_BUFFER, bufferTexture.buffer);
+        glBufferData(GL_TEXTURE_BUFFER, size, data, GL_STREAM_DRAW);
+        glBindBuffer(GL_TEXTURE_BUFFER, 0);
+    }
+};
+#endif
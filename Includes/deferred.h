@@ -0,0 +1,275 @@
+#ifndef DEFERRED_H
+#define DEFERRED_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include <shader_m.h>
+#include <lights.h>
+#include <frame_uniforms.h>
+#include <gl_state.h>
+#include <shadows.h>
+
+#include <cmath>
+#include <cstddef>
+#include <iostream>
+#include <vector>
+
+// Deferred shading path (G key). The geometry pass writes the surface attributes into a
+// G-buffer (gbuffer.fs), a fullscreen pass adds the directional light, the spot lights and
+// fog (deferred_light.fs), and every point light is drawn as a volume enclosing its
+// attenuation radius that only shades the pixels it covers (light_volume.fs).
+// G-buffer layout, read through deferred.glsl:
+//   normal    RGBA16F  view space normal, shininess
+//   diffuse   RGBA8    diffuse color, 1 if the surface is fogged
+//   specular  RGBA8    specular color, 1 for Blinn-Phong
+//   depth     DEPTH24  view space position is reconstructed from it
+
+// texture units of the G-buffer (units 1..3 belong to the cluster lists)
+const unsigned int GBUFFER_NORMAL_UNIT = 4;
+const unsigned int GBUFFER_DIFFUSE_UNIT = 5;
+const unsigned int GBUFFER_SPECULAR_UNIT = 6;
+const unsigned int GBUFFER_DEPTH_UNIT = 7;
+
+// binds the uniform blocks and G-buffer samplers of a deferred lighting program
+inline void setupDeferredShader(const Shader& shader)
+{
+    shader.bindUniformBlock("Lights", LIGHTS_BINDING);
+    shader.bindUniformBlock("Frame", FRAME_BINDING);
+    shader.bindUniformBlock("Shadows", SHADOWS_BINDING);
+    shader.bindUniformBlock("SpotShadows", SPOT_SHADOWS_BINDING);
+    shader.use();
+    shader.setInt("gNormal", GBUFFER_NORMAL_UNIT);
+    shader.setInt("gDiffuse", GBUFFER_DIFFUSE_UNIT);
+    shader.setInt("gSpecular", GBUFFER_SPECULAR_UNIT);
+    shader.setInt("gDepth", GBUFFER_DEPTH_UNIT);
+    shader.setInt("shadowMap", SHADOW_MAP_UNIT);
+    shader.setInt("spotShadowAtlas", SPOT_SHADOW_ATLAS_UNIT);
+}
+
+// Framebuffer with the G-buffer attachments, sized like the default framebuffer
+class GBuffer
+{
+public:
+    unsigned int FBO;
+    unsigned int normalTexture, diffuseTexture, specularTexture, depthTexture;
+    int width, height;
+
+    GBuffer() : FBO(0), normalTexture(0), diffuseTexture(0), specularTexture(0), depthTexture(0), width(0), height(0)
+    {
+        glGenFramebuffers(1, &FBO);
+        glGenTextures(1, &normalTexture);
+        glGenTextures(1, &diffuseTexture);
+        glGenTextures(1, &specularTexture);
+        glGenTextures(1, &depthTexture);
+    }
+
+    // (re)allocates the attachments when the size changed
+    void resize(int newWidth, int newHeight)
+    {
+        if (newWidth == width && newHeight == height)
+            return;
+        width = newWidth;
+        height = newHeight;
+        allocate(normalTexture, GL_RGBA16F, GL_RGBA, GL_HALF_FLOAT);
+        allocate(diffuseTexture, GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE);
+        allocate(specularTexture, GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE);
+        allocate(depthTexture, GL_DEPTH_COMPONENT24, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT);
+
+        glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, normalTexture, 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, diffuseTexture, 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT2, GL_TEXTURE_2D, specularTexture, 0);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthTexture, 0);
+        const GLenum attachments[3] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1, GL_COLOR_ATTACHMENT2 };
+        glDrawBuffers(3, attachments);
+        if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            std::cout << "ERROR::GBUFFER:: Framebuffer is not complete!" << std::endl;
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    }
+
+    // binds and clears the G-buffer for the geometry pass
+    void bindForGeometry() const
+    {
+        glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+        glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    }
+
+    // binds the attachments to their texture units for the lighting passes
+    void bindTextures() const
+    {
+        glState().bindTexture(GBUFFER_NORMAL_UNIT, GL_TEXTURE_2D, normalTexture);
+        glState().bindTexture(GBUFFER_DIFFUSE_UNIT, GL_TEXTURE_2D, diffuseTexture);
+        glState().bindTexture(GBUFFER_SPECULAR_UNIT, GL_TEXTURE_2D, specularTexture);
+        glState().bindTexture(GBUFFER_DEPTH_UNIT, GL_TEXTURE_2D, depthTexture);
+    }
+
+    // bytes written per pixel by the geometry pass
+    static size_t bytesPerPixel()
+    {
+        return 8 + 4 + 4 + 4;
+    }
+
+    void destroy()
+    {
+        GLuint textures[4] = { normalTexture, diffuseTexture, specularTexture, depthTexture };
+        glDeleteTextures(4, textures);
+        glDeleteFramebuffers(1, &FBO);
+    }
+
+private:
+    void allocate(unsigned int texture, GLint internalFormat, GLenum format, GLenum type)
+    {
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, width, height, 0, format, type, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glState().invalidate();
+    }
+};
+
+// vertex attribute locations of the light volume instances, must match light_volume.vs
+const GLuint LIGHT_VOLUME_SPHERE_LOCATION = 1; // center, radius
+const GLuint LIGHT_VOLUME_LIGHT_LOCATION = 2;  // 2..5, PointLight as 4 vec4
+
+// per-instance data of a light volume
+struct LightVolume
+{
+    glm::vec4 sphere;
+    PointLight light;
+};
+
+// Point lights drawn as instanced icosahedra scaled to enclose their attenuation radius
+class LightVolumes
+{
+public:
+    LightVolumes() : VAO(0), VBO(0), EBO(0), instanceBuffer(0), indexCount(0)
+    {
+        std::vector<glm::vec3> vertices;
+        std::vector<GLushort> indices;
+        makeIcosahedron(vertices, indices);
+        indexCount = (GLsizei)indices.size();
+
+        glGenVertexArrays(1, &VAO);
+        glGenBuffers(1, &VBO);
+        glGenBuffers(1, &EBO);
+        glGenBuffers(1, &instanceBuffer);
+        glBindVertexArray(VAO);
+        glBindBuffer(GL_ARRAY_BUFFER, VBO);
+        glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(glm::vec3), vertices.data(), GL_STATIC_DRAW);
+        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (void*)0);
+        glEnableVertexAttribArray(0);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLushort), indices.data(), GL_STATIC_DRAW);
+
+        glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+        glVertexAttribPointer(LIGHT_VOLUME_SPHERE_LOCATION, 4, GL_FLOAT, GL_FALSE, sizeof(LightVolume), (void*)offsetof(LightVolume, sphere));
+        glEnableVertexAttribArray(LIGHT_VOLUME_SPHERE_LOCATION);
+        glVertexAttribDivisor(LIGHT_VOLUME_SPHERE_LOCATION, 1);
+        for (GLuint column = 0; column < 4; column++)
+        {
+            GLuint location = LIGHT_VOLUME_LIGHT_LOCATION + column;
+            glVertexAttribPointer(location, 4, GL_FLOAT, GL_FALSE, sizeof(LightVolume), (void*)(offsetof(LightVolume, light) + column * sizeof(glm::vec4)));
+            glEnableVertexAttribArray(location);
+            glVertexAttribDivisor(location, 1);
+        }
+        glBindVertexArray(0);
+        glState().invalidate();
+    }
+
+    // one volume per light that can reach anything, in view space like the G-buffer
+    void update(const std::vector<PointLight>& lights, const glm::mat4& view)
+    {
+        volumes.clear();
+        for (const PointLight& light : lights)
+        {
+            float radius = lightRadius(light);
+            if (radius <= 0.0f)
+                continue;
+            LightVolume volume;
+            volume.light = toViewSpace(light, view);
+            volume.sphere = glm::vec4(volume.light.position, radius);
+            volumes.push_back(volume);
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+        glBufferData(GL_ARRAY_BUFFER, volumes.size() * sizeof(LightVolume), volumes.data(), GL_STREAM_DRAW);
+    }
+
+    // draws the back faces of all volumes, adding the lighting of every pixel whose surface
+    // lies in front of them; the depth buffer must hold the scene depth
+    void draw() const
+    {
+        if (volumes.empty())
+            return;
+        glEnable(GL_BLEND);
+        glBlendFunc(GL_ONE, GL_ONE);
+        glEnable(GL_CULL_FACE);
+        glCullFace(GL_FRONT);
+        glDepthMask(GL_FALSE);
+        // volumes crossing the near or far plane must not be clipped
+        glEnable(GL_DEPTH_CLAMP);
+        glState().depthFunc(GL_GEQUAL);
+        glState().bindVertexArray(VAO);
+        glState().drawElementsInstanced(GL_TRIANGLES, indexCount, GL_UNSIGNED_SHORT, 0, (GLsizei)volumes.size());
+        glState().depthFunc(GL_LESS);
+        glDisable(GL_DEPTH_CLAMP);
+        glDepthMask(GL_TRUE);
+        glCullFace(GL_BACK);
+        glDisable(GL_CULL_FACE);
+        glDisable(GL_BLEND);
+    }
+
+    size_t count() const
+    {
+        return volumes.size();
+    }
+
+    void destroy()
+    {
+        glDeleteVertexArrays(1, &VAO);
+        glDeleteBuffers(1, &VBO);
+        glDeleteBuffers(1, &EBO);
+        glDeleteBuffers(1, &instanceBuffer);
+    }
+
+private:
+    unsigned int VAO, VBO, EBO, instanceBuffer;
+    GLsizei indexCount;
+    std::vector<LightVolume> volumes;
+
+    // icosahedron around the unit sphere (its faces touch the sphere), counter-clockwise outside
+    static void makeIcosahedron(std::vector<glm::vec3>& vertices, std::vector<GLushort>& indices)
+    {
+        const float t = (1.0f + std::sqrt(5.0f)) / 2.0f;
+        const float corners[12][3] = {
+            { -1,  t,  0 }, {  1,  t,  0 }, { -1, -t,  0 }, {  1, -t,  0 },
+            {  0, -1,  t }, {  0,  1,  t }, {  0, -1, -t }, {  0,  1, -t },
+            {  t,  0, -1 }, {  t,  0,  1 }, { -t,  0, -1 }, { -t,  0,  1 }
+        };
+        const GLushort faces[20][3] = {
+            { 0, 11, 5 }, { 0, 5, 1 }, { 0, 1, 7 }, { 0, 7, 10 }, { 0, 10, 11 },
+            { 1, 5, 9 }, { 5, 11, 4 }, { 11, 10, 2 }, { 10, 7, 6 }, { 7, 1, 8 },
+            { 3, 9, 4 }, { 3, 4, 2 }, { 3, 2, 6 }, { 3, 6, 8 }, { 3, 8, 9 },
+            { 4, 9, 5 }, { 2, 4, 11 }, { 6, 2, 10 }, { 8, 6, 7 }, { 9, 8, 1 }
+        };
+        for (int i = 0; i < 12; i++)
+            vertices.push_back(glm::normalize(glm::vec3(corners[i][0], corners[i][1], corners[i][2])));
+        // scale so the face centers (closest points to the center) lie on the unit sphere
+        float inradius = glm::length((vertices[faces[0][0]] + vertices[faces[0][1]] + vertices[faces[0][2]]) / 3.0f);
+        for (glm::vec3& vertex : vertices)
+            vertex /= inradius;
+        for (int i = 0; i < 20; i++)
+        {
+            glm::vec3 a = vertices[faces[i][0]], b = vertices[faces[i][1]], c = vertices[faces[i][2]];
+            bool outward = glm::dot(glm::cross(b - a, c - a), a + b + c) > 0.0f;
+            indices.push_back(faces[i][0]);
+            indices.push_back(outward ? faces[i][1] : faces[i][2]);
+            indices.push_back(outward ? faces[i][2] : faces[i][1]);
+        }
+    }
+};
+#endif
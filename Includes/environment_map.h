@@ -0,0 +1,586 @@
+#ifndef ENVIRONMENT_MAP_H
+#define ENVIRONMENT_MAP_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include <asset_loader.h>
+#include <spherical_harmonics.h>
+#include <gl_state.h>
+#include <benchmark.h>
+#include <thread_pool.h>
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Image based lighting inputs of a skybox cubemap for reflective materials, built on the CPU:
+//   prefiltered  RGB16F cube, PREFILTER_LEVELS mips from PREFILTER_SIZE; mip i is the source
+//                convolved with the GGX lobe of roughness i / (PREFILTER_LEVELS - 1)
+//   irradiance   RGB16F cube of IRRADIANCE_SIZE, cosine convolution / pi (diffuse, albedo 1)
+// Each face is box filtered down to a float mip chain on the thread pool as soon as the
+// loader has decoded it; prefilter() then queues one task per (mip, face) and per irradiance
+// face. The GGX pass uses filtered importance sampling (each sample reads the source mip
+// matching its solid angle), so 64 samples per texel don't alias. The results are written
+// to a binary cache next to the face images that later runs upload directly.
+
+const int PREFILTER_SIZE = 128;
+const int PREFILTER_LEVELS = 5;
+const int PREFILTER_SAMPLES = 64;
+const int IRRADIANCE_SIZE = 32;
+// source mip the irradiance integrates over, the result is smooth enough for 16x16 faces
+const int IRRADIANCE_SOURCE_SIZE = 16;
+
+// RGB float cubemap level, the six faces (GL order) back to back
+struct FloatCubeLevel
+{
+    int size;
+    std::vector<float> texels;
+
+    explicit FloatCubeLevel(int size = 0) : size(size), texels((size_t)6 * size * size * 3, 0.0f)
+    {
+    }
+
+    float* face(int index)
+    {
+        return texels.data() + (size_t)index * size * size * 3;
+    }
+
+    const float* face(int index) const
+    {
+        return texels.data() + (size_t)index * size * size * 3;
+    }
+
+    // bilinear lookup of a face, (u, v) in [-1, 1] as in cubemapDirection; the filter
+    // clamps at the face edge instead of reaching into the neighbouring face
+    glm::vec3 sample(int index, float u, float v) const
+    {
+        float s = std::min(std::max((u * 0.5f + 0.5f) * size - 0.5f, 0.0f), size - 1.0f);
+        float t = std::min(std::max((v * 0.5f + 0.5f) * size - 0.5f, 0.0f), size - 1.0f);
+        int x0 = (int)s, y0 = (int)t;
+        int x1 = std::min(x0 + 1, size - 1), y1 = std::min(y0 + 1, size - 1);
+        float fx = s - x0, fy = t - y0;
+        const float* texels = face(index);
+        glm::vec3 a = texel(texels, x0, y0), b = texel(texels, x1, y0);
+        glm::vec3 c = texel(texels, x0, y1), d = texel(texels, x1, y1);
+        return glm::mix(glm::mix(a, b, fx), glm::mix(c, d, fx), fy);
+    }
+
+private:
+    glm::vec3 texel(const float* texels, int x, int y) const
+    {
+        const float* p = texels + ((size_t)y * size + x) * 3;
+        return glm::vec3(p[0], p[1], p[2]);
+    }
+};
+
+// face and (u, v) in [-1, 1] of a direction, the inverse of cubemapDirection
+inline int cubemapFace(const glm::vec3& direction, float& u, float& v)
+{
+    glm::vec3 a = glm::abs(direction);
+    if (a.x >= a.y && a.x >= a.z)
+    {
+        u = (direction.x > 0.0f ? -direction.z : direction.z) / a.x;
+        v = -direction.y / a.x;
+        return direction.x > 0.0f ? 0 : 1;
+    }
+    if (a.y >= a.z)
+    {
+        u = direction.x / a.y;
+        v = (direction.y > 0.0f ? direction.z : -direction.z) / a.y;
+        return direction.y > 0.0f ? 2 : 3;
+    }
+    u = (direction.z > 0.0f ? direction.x : -direction.x) / a.z;
+    v = -direction.y / a.z;
+    return direction.z > 0.0f ? 4 : 5;
+}
+
+// trilinear lookup in a mip chain
+inline glm::vec3 sampleCubeChain(const std::vector<FloatCubeLevel>& chain, const glm::vec3& direction, float lod)
+{
+    float u, v;
+    int face = cubemapFace(direction, u, v);
+    lod = std::min(std::max(lod, 0.0f), (float)(chain.size() - 1));
+    int level = (int)lod;
+    float f = lod - level;
+    glm::vec3 result = chain[level].sample(face, u, v);
+    if (f > 0.0f && level + 1 < (int)chain.size())
+        result = glm::mix(result, chain[level + 1].sample(face, u, v), f);
+    return result;
+}
+
+// Estimated bytes a skybox pass reads from a cubemap with 4 byte texels: the 4x4 texel blocks
+// (64 bytes) the pixel centers of a width x height view fall into, at mip 0 only or at the
+// one or two mips trilinear filtering picks from the texel footprint of a pixel. llvmpipe has
+// no bandwidth counters, --bench-skybox reports this next to the timings instead.
+inline size_t cubemapFootprintBytes(int faceSize, int width, int height, const glm::mat4& inverseViewProjection,
+    const glm::vec3& eye, bool isMipmapped)
+{
+    // view directions are affine in screen space on the far plane, as in skybox.vs
+    auto farDirection = [&](float x, float y)
+    {
+        glm::vec4 p = inverseViewProjection * glm::vec4(x, y, 1.0f, 1.0f);
+        return glm::vec3(p) / p.w - eye;
+    };
+    glm::vec3 origin = farDirection(-1.0f, -1.0f);
+    glm::vec3 stepX = (farDirection(1.0f, -1.0f) - origin) / (float)width;
+    glm::vec3 stepY = (farDirection(-1.0f, 1.0f) - origin) / (float)height;
+
+    int levels = 1;
+    while ((faceSize >> levels) > 0)
+        levels++;
+    std::vector<std::vector<unsigned char>> blocks(levels);
+    for (int level = 0; level < levels; level++)
+    {
+        int side = std::max((faceSize >> level) / 4, 1);
+        blocks[level].assign((size_t)6 * side * side, 0);
+    }
+    auto mark = [&](int level, int face, float u, float v)
+    {
+        int size = faceSize >> level;
+        int side = std::max(size / 4, 1);
+        int x = std::min((int)((u * 0.5f + 0.5f) * size), size - 1) / 4;
+        int y = std::min((int)((v * 0.5f + 0.5f) * size), size - 1) / 4;
+        blocks[level][((size_t)face * side + std::min(y, side - 1)) * side + std::min(x, side - 1)] = 1;
+    };
+
+    float lod = 0.0f;
+    for (int y = 0; y < height; y++)
+    {
+        for (int x = 0; x < width; x++)
+        {
+            glm::vec3 direction = origin + stepX * (x + 0.5f) + stepY * (y + 0.5f);
+            float u, v;
+            int face = cubemapFace(direction, u, v);
+            if (!isMipmapped)
+            {
+                mark(0, face, u, v);
+                continue;
+            }
+            // texels between neighbouring pixels, kept from the last pixel across face edges
+            float ux, vx, uy, vy;
+            if (cubemapFace(direction + stepX, ux, vx) == face && cubemapFace(direction + stepY, uy, vy) == face)
+            {
+                float texels = 0.5f * faceSize * std::max(std::hypot(ux - u, vx - v), std::hypot(uy - u, vy - v));
+                lod = std::log2(std::max(texels, 1e-6f));
+            }
+            float clamped = std::min(std::max(lod, 0.0f), (float)(levels - 1));
+            int level = (int)clamped;
+            mark(level, face, u, v);
+            if (clamped > level)
+                mark(level + 1, face, u, v);
+        }
+    }
+
+    size_t bytes = 0;
+    for (int level = 0; level < levels; level++)
+    {
+        int size = faceSize >> level;
+        size_t blockBytes = (size_t)std::min(size, 4) * std::min(size, 4) * 4;
+        bytes += blockBytes * (size_t)std::count(blocks[level].begin(), blocks[level].end(), 1);
+    }
+    return bytes;
+}
+
+class EnvironmentMap
+{
+public:
+    // isCacheRead false builds the maps even if the cache is valid (and rewrites it)
+    EnvironmentMap(ThreadPool& pool, const std::vector<std::string>& faces, bool isCacheRead) : pool(pool), faces(faces),
+        isLoaded(false), workerMs(0.0), prefilteredTexture(0), irradianceTexture(0)
+    {
+        for (size_t i = 0; i < faces.size(); i++)
+            faceBytes.push_back(AssetLoader::fileSize(faces[i]));
+        isLoaded = isCacheRead && readCache();
+        downsampled.resize(faces.size());
+    }
+
+    bool isCached() const
+    {
+        return isLoaded;
+    }
+
+    // queues the reduction of a decoded face to the source mip chain; the pixels are copied,
+    // the loader frees them
+    void addFace(unsigned int face, const AssetLoader::Image& image)
+    {
+        if (isLoaded || !image.data || image.width != image.height || image.width < PREFILTER_SIZE || face >= downsampled.size())
+            return;
+        std::shared_ptr<std::vector<unsigned char> > pixels = std::make_shared<std::vector<unsigned char> >(
+            image.data, image.data + (size_t)image.width * image.height * image.nrComponents);
+        int size = image.width, components = image.nrComponents;
+        downsampled[face] = pool.submit([pixels, size, components]()
+        {
+            Timer timer;
+            FaceChain chain;
+            chain.levels = downsampleFace(pixels->data(), size, components);
+            chain.ms = timer.elapsedMs();
+            return chain;
+        });
+    }
+
+    // queues the GGX and irradiance convolutions once all faces were reduced
+    void prefilter()
+    {
+        if (isLoaded || !prefiltered.empty())
+            return;
+        // gather the faces into cube levels
+        source.clear();
+        for (int size = PREFILTER_SIZE; size >= 1; size /= 2)
+            source.push_back(FloatCubeLevel(size));
+        for (size_t face = 0; face < downsampled.size(); face++)
+        {
+            if (!downsampled[face].valid())
+            {
+                std::cout << "ENVIRONMENT::FACE_MISSING: " << faces[face] << ", the maps stay black" << std::endl;
+                isLoaded = true;
+                prefilteredLevels.clear();
+                return;
+            }
+            FaceChain chain = downsampled[face].get();
+            workerMs += chain.ms;
+            for (size_t level = 0; level < source.size(); level++)
+                std::copy(chain.levels[level].begin(), chain.levels[level].end(), source[level].face((int)face));
+        }
+
+        prefilteredLevels.clear();
+        for (int level = 0; level < PREFILTER_LEVELS; level++)
+            prefilteredLevels.push_back(FloatCubeLevel(PREFILTER_SIZE >> level));
+        irradianceLevel = FloatCubeLevel(IRRADIANCE_SIZE);
+        // roughness 0 is the source itself
+        prefilteredLevels[0].texels = source[0].texels;
+        std::shared_ptr<const std::vector<FloatCubeLevel> > chain = std::make_shared<const std::vector<FloatCubeLevel> >(source);
+        for (int level = 1; level < PREFILTER_LEVELS; level++)
+        {
+            for (int face = 0; face < 6; face++)
+            {
+                FloatCubeLevel* target = &prefilteredLevels[level];
+                prefiltered.push_back(pool.submit([chain, target, level, face]()
+                {
+                    Timer timer;
+                    prefilterFace(*chain, level / (float)(PREFILTER_LEVELS - 1), face, *target);
+                    return timer.elapsedMs();
+                }));
+            }
+        }
+        std::shared_ptr<const std::vector<SourceTexel> > texels = std::make_shared<const std::vector<SourceTexel> >(irradianceSource(source));
+        for (int face = 0; face < 6; face++)
+        {
+            FloatCubeLevel* target = &irradianceLevel;
+            prefiltered.push_back(pool.submit([texels, target, face]()
+            {
+                Timer timer;
+                irradianceFace(*texels, face, *target);
+                return timer.elapsedMs();
+            }));
+        }
+    }
+
+    // waits for the convolutions (after a cache miss), writes the cache and creates the textures
+    void upload()
+    {
+        if (!isLoaded)
+        {
+            prefilter();
+            for (std::future<double>& task : prefiltered)
+                workerMs += task.get();
+            prefiltered.clear();
+            source.clear();
+            if (!prefilteredLevels.empty())
+            {
+                writeCache();
+                std::cout << "environment: prefiltered " << faces[0] << " and " << faces.size() - 1 << " more faces in "
+                    << workerMs << " ms on workers, cached in " << cachePath() << std::endl;
+            }
+            isLoaded = true;
+        }
+        if (prefilteredLevels.empty())
+        {
+            for (int level = 0; level < PREFILTER_LEVELS; level++)
+                prefilteredLevels.push_back(FloatCubeLevel(PREFILTER_SIZE >> level));
+            irradianceLevel = FloatCubeLevel(IRRADIANCE_SIZE);
+        }
+        prefilteredTexture = createTexture(prefilteredLevels);
+        irradianceTexture = createTexture(std::vector<FloatCubeLevel>(1, irradianceLevel));
+        // the CPU copies are not needed anymore
+        prefilteredLevels.clear();
+        irradianceLevel = FloatCubeLevel();
+    }
+
+    // cube with PREFILTER_LEVELS mips, sample with textureLod(map, R, roughness * (PREFILTER_LEVELS - 1))
+    unsigned int prefilteredMap() const
+    {
+        return prefilteredTexture;
+    }
+
+    unsigned int irradianceMap() const
+    {
+        return irradianceTexture;
+    }
+
+    void destroy()
+    {
+        GLuint textures[2] = { prefilteredTexture, irradianceTexture };
+        glDeleteTextures(2, textures);
+    }
+
+private:
+    static const int CACHE_VERSION = 1;
+
+    struct FaceChain
+    {
+        std::vector<std::vector<float> > levels;
+        double ms;
+    };
+
+    // texel of the irradiance source: direction, solid angle and color
+    struct SourceTexel
+    {
+        glm::vec3 direction;
+        glm::vec3 radiance;  // color * solid angle
+    };
+
+    ThreadPool& pool;
+    std::vector<std::string> faces;
+    std::vector<long long> faceBytes;
+    std::vector<std::future<FaceChain> > downsampled;
+    std::vector<std::future<double> > prefiltered;
+    std::vector<FloatCubeLevel> source;
+    std::vector<FloatCubeLevel> prefilteredLevels;
+    FloatCubeLevel irradianceLevel;
+    bool isLoaded;
+    double workerMs;
+    unsigned int prefilteredTexture, irradianceTexture;
+
+    // box filters an 8 bit face to PREFILTER_SIZE, then halves it down to 1x1
+    static std::vector<std::vector<float> > downsampleFace(const unsigned char* pixels, int size, int components)
+    {
+        std::vector<std::vector<float> > levels;
+        const int block = size / PREFILTER_SIZE;
+        const int channels = components < 3 ? 1 : 3;
+        const float scale = 1.0f / (255.0f * block * block);
+        std::vector<float> base((size_t)PREFILTER_SIZE * PREFILTER_SIZE * 3, 0.0f);
+        for (int y = 0; y < PREFILTER_SIZE * block; y++)
+        {
+            const unsigned char* row = pixels + (size_t)y * size * components;
+            float* target = base.data() + (size_t)(y / block) * PREFILTER_SIZE * 3;
+            for (int x = 0; x < PREFILTER_SIZE * block; x++)
+                for (int c = 0; c < 3; c++)
+                    target[(x / block) * 3 + c] += row[x * components + (c < channels ? c : 0)] * scale;
+        }
+        levels.push_back(base);
+        for (int half = PREFILTER_SIZE / 2; half >= 1; half /= 2)
+        {
+            const std::vector<float>& previous = levels.back();
+            std::vector<float> level((size_t)half * half * 3);
+            for (int y = 0; y < half; y++)
+                for (int x = 0; x < half; x++)
+                    for (int c = 0; c < 3; c++)
+                    {
+                        size_t p = ((size_t)(2 * y) * (2 * half) + 2 * x) * 3 + c;
+                        size_t rowStride = (size_t)(2 * half) * 3;
+                        level[((size_t)y * half + x) * 3 + c] = 0.25f * (previous[p] + previous[p + 3] + previous[p + rowStride] + previous[p + rowStride + 3]);
+                    }
+            levels.push_back(level);
+        }
+        return levels;
+    }
+
+    // one face of a GGX prefiltered level (split sum approximation, N = V = R)
+    static void prefilterFace(const std::vector<FloatCubeLevel>& chain, float roughness, int face, FloatCubeLevel& target)
+    {
+        // with N = V the sample directions in tangent space are the same for every texel
+        struct Sample
+        {
+            glm::vec3 direction;
+            float weight;   // N.L
+            float lod;
+        };
+        std::vector<Sample> samples;
+        const float a = roughness * roughness;
+        const float texelSolidAngle = 4.0f * 3.14159265f / (6.0f * chain[0].size * chain[0].size);
+        for (int i = 0; i < PREFILTER_SAMPLES; i++)
+        {
+            // Hammersley point, GGX distributed half vector
+            glm::vec2 xi(i / (float)PREFILTER_SAMPLES, radicalInverse((unsigned int)i));
+            float phi = 2.0f * 3.14159265f * xi.x;
+            float cosTheta = std::sqrt((1.0f - xi.y) / (1.0f + (a * a - 1.0f) * xi.y));
+            float sinTheta = std::sqrt(1.0f - cosTheta * cosTheta);
+            glm::vec3 h(sinTheta * std::cos(phi), sinTheta * std::sin(phi), cosTheta);
+            glm::vec3 l = 2.0f * h.z * h - glm::vec3(0.0f, 0.0f, 1.0f);
+            if (l.z <= 0.0f)
+                continue;
+            // pdf of l is D * N.H / (4 V.H) = D / 4 with N = V
+            float d = a * a / (3.14159265f * std::pow(h.z * h.z * (a * a - 1.0f) + 1.0f, 2.0f));
+            float sampleSolidAngle = 1.0f / (PREFILTER_SAMPLES * d * 0.25f + 0.0001f);
+            Sample sample = { l, l.z, std::max(0.5f * std::log2(sampleSolidAngle / texelSolidAngle) + 1.0f, 0.0f) };
+            samples.push_back(sample);
+        }
+
+        float* texels = target.face(face);
+        for (int y = 0; y < target.size; y++)
+        {
+            float v = (y + 0.5f) * 2.0f / target.size - 1.0f;
+            for (int x = 0; x < target.size; x++)
+            {
+                float u = (x + 0.5f) * 2.0f / target.size - 1.0f;
+                glm::vec3 n = glm::normalize(cubemapDirection(face, u, v));
+                glm::vec3 up = std::abs(n.z) < 0.999f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(1.0f, 0.0f, 0.0f);
+                glm::vec3 tangent = glm::normalize(glm::cross(up, n));
+                glm::vec3 bitangent = glm::cross(n, tangent);
+                glm::vec3 color(0.0f);
+                float weight = 0.0f;
+                for (const Sample& sample : samples)
+                {
+                    glm::vec3 l = tangent * sample.direction.x + bitangent * sample.direction.y + n * sample.direction.z;
+                    color += sampleCubeChain(chain, l, sample.lod) * sample.weight;
+                    weight += sample.weight;
+                }
+                color /= std::max(weight, 0.0001f);
+                float* p = texels + ((size_t)y * target.size + x) * 3;
+                p[0] = color.r;
+                p[1] = color.g;
+                p[2] = color.b;
+            }
+        }
+    }
+
+    static float radicalInverse(unsigned int bits)
+    {
+        bits = (bits << 16u) | (bits >> 16u);
+        bits = ((bits & 0x55555555u) << 1u) | ((bits & 0xAAAAAAAAu) >> 1u);
+        bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xCCCCCCCCu) >> 2u);
+        bits = ((bits & 0x0F0F0F0Fu) << 4u) | ((bits & 0xF0F0F0F0u) >> 4u);
+        bits = ((bits & 0x00FF00FFu) << 8u) | ((bits & 0xFF00FF00u) >> 8u);
+        return bits * 2.3283064365386963e-10f;
+    }
+
+    static std::vector<SourceTexel> irradianceSource(const std::vector<FloatCubeLevel>& chain)
+    {
+        const FloatCubeLevel* level = &chain.back();
+        for (const FloatCubeLevel& candidate : chain)
+            if (candidate.size == IRRADIANCE_SOURCE_SIZE)
+                level = &candidate;
+        std::vector<SourceTexel> texels;
+        const float texelArea = (2.0f / level->size) * (2.0f / level->size);
+        for (int face = 0; face < 6; face++)
+        {
+            const float* colors = level->face(face);
+            for (int y = 0; y < level->size; y++)
+            {
+                float v = (y + 0.5f) * 2.0f / level->size - 1.0f;
+                for (int x = 0; x < level->size; x++)
+                {
+                    float u = (x + 0.5f) * 2.0f / level->size - 1.0f;
+                    glm::vec3 d = cubemapDirection(face, u, v);
+                    float lengthSq = glm::dot(d, d);
+                    float solidAngle = texelArea / (lengthSq * std::sqrt(lengthSq));
+                    const float* c = colors + ((size_t)y * level->size + x) * 3;
+                    SourceTexel texel = { d / std::sqrt(lengthSq), glm::vec3(c[0], c[1], c[2]) * solidAngle };
+                    texels.push_back(texel);
+                }
+            }
+        }
+        return texels;
+    }
+
+    // one face of the irradiance cube: sum of radiance * cos over the source texels, / pi
+    static void irradianceFace(const std::vector<SourceTexel>& source, int face, FloatCubeLevel& target)
+    {
+        float* texels = target.face(face);
+        for (int y = 0; y < target.size; y++)
+        {
+            float v = (y + 0.5f) * 2.0f / target.size - 1.0f;
+            for (int x = 0; x < target.size; x++)
+            {
+                float u = (x + 0.5f) * 2.0f / target.size - 1.0f;
+                glm::vec3 n = glm::normalize(cubemapDirection(face, u, v));
+                glm::vec3 irradiance(0.0f);
+                for (const SourceTexel& texel : source)
+                    irradiance += texel.radiance * std::max(glm::dot(n, texel.direction), 0.0f);
+                irradiance /= 3.14159265f;
+                float* p = texels + ((size_t)y * target.size + x) * 3;
+                p[0] = irradiance.r;
+                p[1] = irradiance.g;
+                p[2] = irradiance.b;
+            }
+        }
+    }
+
+    static unsigned int createTexture(const std::vector<FloatCubeLevel>& levels)
+    {
+        unsigned int texture;
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_CUBE_MAP, texture);
+        for (size_t level = 0; level < levels.size(); level++)
+            for (int face = 0; face < 6; face++)
+                glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face, (GLint)level, GL_RGB16F, levels[level].size, levels[level].size, 0,
+                    GL_RGB, GL_FLOAT, levels[level].face(face));
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, levels.size() > 1 ? GL_LINEAR_MIPMAP_LINEAR : GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_BASE_LEVEL, 0);
+        glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAX_LEVEL, (GLint)levels.size() - 1);
+        glState().invalidate();
+        return texture;
+    }
+
+    // "resources/textures/right.jpg" -> "resources/textures/right.env"
+    std::string cachePath() const
+    {
+        return AssetLoader::siblingPath(faces[0], ".env");
+    }
+
+    // binary: version, face count, face file sizes, sizes of the maps, then the float texels
+    // of every prefiltered level and of the irradiance cube; valid for the same face files
+    bool readCache()
+    {
+        std::ifstream file(cachePath(), std::ios::binary);
+        if (!file)
+            return false;
+        int header[5] = {};
+        file.read((char*)header, sizeof(header));
+        if (!file || header[0] != CACHE_VERSION || header[1] != (int)faces.size() || header[2] != PREFILTER_SIZE
+            || header[3] != PREFILTER_LEVELS || header[4] != IRRADIANCE_SIZE)
+            return false;
+        std::vector<long long> bytes(faces.size());
+        file.read((char*)bytes.data(), bytes.size() * sizeof(long long));
+        if (!file || bytes != faceBytes)
+            return false;
+        for (int level = 0; level < PREFILTER_LEVELS; level++)
+        {
+            prefilteredLevels.push_back(FloatCubeLevel(PREFILTER_SIZE >> level));
+            file.read((char*)prefilteredLevels.back().texels.data(), prefilteredLevels.back().texels.size() * sizeof(float));
+        }
+        irradianceLevel = FloatCubeLevel(IRRADIANCE_SIZE);
+        file.read((char*)irradianceLevel.texels.data(), irradianceLevel.texels.size() * sizeof(float));
+        if (!file)
+        {
+            prefilteredLevels.clear();
+            return false;
+        }
+        return true;
+    }
+
+    void writeCache() const
+    {
+        std::ofstream file(cachePath(), std::ios::binary);
+        if (!file)
+            return;
+        const int header[5] = { CACHE_VERSION, (int)faces.size(), PREFILTER_SIZE, PREFILTER_LEVELS, IRRADIANCE_SIZE };
+        file.write((const char*)header, sizeof(header));
+        file.write((const char*)faceBytes.data(), faceBytes.size() * sizeof(long long));
+        for (const FloatCubeLevel& level : prefilteredLevels)
+            file.write((const char*)level.texels.data(), level.texels.size() * sizeof(float));
+        file.write((const char*)irradianceLevel.texels.data(), irradianceLevel.texels.size() * sizeof(float));
+    }
+};
+#endif
@@ -0,0 +1,39 @@
+#ifndef FRAME_UNIFORMS_H
+#define FRAME_UNIFORMS_H
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <camera.h>
+
+// C++ mirror of the "Frame" uniform block declared in frame.glsl (std140 layout).
+// Filled once per frame from the active camera and shared by every program.
+
+// binding point of the "Frame" uniform block
+const unsigned int FRAME_BINDING = 1;
+
+struct FrameUniforms
+{
+    glm::mat4 view;
+    glm::mat4 projection;
+    glm::mat4 viewProjection;
+    glm::mat4 inverseView;
+    glm::mat4 inverseProjection;
+    glm::mat4 inverseViewProjection;
+    glm::vec4 viewPos;
+};
+
+static_assert(sizeof(FrameUniforms) == 6 * 64 + 16, "FrameUniforms must match std140 layout");
+
+// computes all camera dependent matrices of the frame
+inline void updateFrameUniforms(FrameUniforms& frame, const Camera& camera, float aspect, float zNear, float zFar)
+{
+    frame.view = camera.GetViewMatrix();
+    frame.projection = glm::perspective(glm::radians(camera.Zoom), aspect, zNear, zFar);
+    frame.viewProjection = frame.projection * frame.view;
+    frame.inverseView = glm::inverse(frame.view);
+    frame.inverseProjection = glm::inverse(frame.projection);
+    frame.inverseViewProjection = glm::inverse(frame.viewProjection);
+    frame.viewPos = glm::vec4(camera.Position, 1.0f);
+}
+#endif
@@ -0,0 +1,346 @@
+#ifndef FRUSTUM_CULLING_H
+#define FRUSTUM_CULLING_H
+
+#include <glm/glm.hpp>
+
+#include <light_culling.h>
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define FRUSTUM_SIMD 1
+#endif
+#if defined(__AVX__)
+#include <immintrin.h>
+#define FRUSTUM_AVX 1
+#endif
+
+// View frustum culling. The 6 planes are extracted from the view-projection matrix (the rows
+// of clip space, Gribb/Hartmann) and normalized, so a plane's value at a point is its distance.
+// A sphere is outside when it lies further than its radius behind any plane; a box (center and
+// half extent) when its corner furthest along the plane normal is behind it. Both tests are
+// conservative near the frustum's edges: an object that only crosses two planes outside the
+// frustum is kept.
+// The bounds of many objects are kept as structure of arrays, so one register holds the same
+// coordinate of 4 (SSE2) or 8 (AVX, when the compiler targets it) objects and every plane is
+// tested against all of them with a few multiply-adds and a compare; the lanes that passed
+// every plane are appended to a list of visible indices without branches.
+
+struct Frustum
+{
+    // xyz the normal pointing inside, w the offset: inside when dot(xyz, p) + w >= 0
+    glm::vec4 planes[6];
+
+    static Frustum fromMatrix(const glm::mat4& viewProjection)
+    {
+        glm::vec4 rows[4];
+        for (int i = 0; i < 4; i++)
+            rows[i] = glm::vec4(viewProjection[0][i], viewProjection[1][i], viewProjection[2][i], viewProjection[3][i]);
+        Frustum frustum;
+        // left, right, bottom, top, near, far
+        for (int i = 0; i < 3; i++)
+        {
+            frustum.planes[2 * i] = rows[3] + rows[i];
+            frustum.planes[2 * i + 1] = rows[3] - rows[i];
+        }
+        for (glm::vec4& plane : frustum.planes)
+            plane /= glm::length(glm::vec3(plane));
+        return frustum;
+    }
+
+    bool intersects(const BoundingSphere& sphere) const
+    {
+        for (const glm::vec4& plane : planes)
+            if (plane.x * sphere.center.x + plane.y * sphere.center.y + plane.z * sphere.center.z + plane.w < -sphere.radius)
+                return false;
+        return true;
+    }
+
+    bool intersects(const glm::vec3& center, const glm::vec3& extent) const
+    {
+        for (const glm::vec4& plane : planes)
+        {
+            float distance = plane.x * center.x + plane.y * center.y + plane.z * center.z + plane.w;
+            float reach = std::fabs(plane.x) * extent.x + std::fabs(plane.y) * extent.y + std::fabs(plane.z) * extent.z;
+            if (distance + reach < 0.0f)
+                return false;
+        }
+        return true;
+    }
+};
+
+// bounding spheres as structure of arrays
+struct SphereSet
+{
+    std::vector<float> x, y, z, radius;
+
+    void add(const BoundingSphere& sphere)
+    {
+        x.push_back(sphere.center.x);
+        y.push_back(sphere.center.y);
+        z.push_back(sphere.center.z);
+        radius.push_back(sphere.radius);
+    }
+
+    void set(size_t index, const BoundingSphere& sphere)
+    {
+        x[index] = sphere.center.x;
+        y[index] = sphere.center.y;
+        z[index] = sphere.center.z;
+        radius[index] = sphere.radius;
+    }
+
+    size_t size() const
+    {
+        return x.size();
+    }
+};
+
+// axis aligned boxes as center and half extent, structure of arrays
+struct BoxSet
+{
+    std::vector<float> centerX, centerY, centerZ, extentX, extentY, extentZ;
+
+    void add(const glm::vec3& center, const glm::vec3& extent)
+    {
+        centerX.push_back(center.x);
+        centerY.push_back(center.y);
+        centerZ.push_back(center.z);
+        extentX.push_back(extent.x);
+        extentY.push_back(extent.y);
+        extentZ.push_back(extent.z);
+    }
+
+    size_t size() const
+    {
+        return centerX.size();
+    }
+};
+
+// how the sets are tested, the benchmark (--bench-culling) compares them
+enum CullingPath
+{
+    CULL_SCALAR,
+    CULL_SSE,
+    CULL_AVX
+};
+
+#if defined(FRUSTUM_AVX)
+const CullingPath CULL_BEST = CULL_AVX;
+#elif defined(FRUSTUM_SIMD)
+const CullingPath CULL_BEST = CULL_SSE;
+#else
+const CullingPath CULL_BEST = CULL_SCALAR;
+#endif
+
+inline bool cullingPathAvailable(CullingPath path)
+{
+    return path <= CULL_BEST;
+}
+
+inline const char* cullingPathName(CullingPath path)
+{
+    return path == CULL_AVX ? "avx" : path == CULL_SSE ? "sse2" : "scalar";
+}
+
+// appends 'first + lane' for every lane set in the mask; the index is always written and the
+// count only advances for visible lanes (never past the lanes tested, so 'out' needs one slot per object)
+inline size_t appendVisible(uint32_t* out, size_t count, uint32_t first, int mask, int lanes)
+{
+    for (int lane = 0; lane < lanes; lane++)
+    {
+        out[count] = first + lane;
+        count += (mask >> lane) & 1;
+    }
+    return count;
+}
+
+// objects [begin, end) of a set one at a time, the tail of the SIMD paths
+inline size_t cullSpheresScalar(const Frustum& frustum, const SphereSet& set, size_t begin, size_t end, uint32_t* out, size_t count)
+{
+    for (size_t i = begin; i < end; i++)
+    {
+        int inside = 1;
+        for (const glm::vec4& plane : frustum.planes)
+            inside &= plane.x * set.x[i] + plane.y * set.y[i] + plane.z * set.z[i] + plane.w >= -set.radius[i];
+        count = appendVisible(out, count, (uint32_t)i, inside, 1);
+    }
+    return count;
+}
+
+inline size_t cullBoxesScalar(const Frustum& frustum, const BoxSet& set, size_t begin, size_t end, uint32_t* out, size_t count)
+{
+    for (size_t i = begin; i < end; i++)
+    {
+        int inside = 1;
+        for (const glm::vec4& plane : frustum.planes)
+        {
+            // summed in the order of the SIMD paths, all of them cull the same objects
+            float distance = plane.x * set.centerX[i] + plane.y * set.centerY[i] + plane.z * set.centerZ[i] + plane.w;
+            float reach = std::fabs(plane.x) * set.extentX[i] + std::fabs(plane.y) * set.extentY[i] + std::fabs(plane.z) * set.extentZ[i];
+            inside &= distance + reach >= 0.0f;
+        }
+        count = appendVisible(out, count, (uint32_t)i, inside, 1);
+    }
+    return count;
+}
+
+// indices of the spheres inside the frustum, in order, into the first entries of 'visible'
+// (only ever grown, so a list reused every frame isn't cleared); returns how many there are
+inline size_t cullSpheres(const Frustum& frustum, const SphereSet& set, std::vector<uint32_t>& visible, CullingPath path = CULL_BEST)
+{
+    size_t n = set.size();
+    if (visible.size() < n)
+        visible.resize(n);
+    if (n == 0)
+        return 0;
+    uint32_t* out = visible.data();
+    size_t count = 0;
+    size_t i = 0;
+#if defined(FRUSTUM_AVX)
+    if (path == CULL_AVX)
+    {
+        __m256 px[6], py[6], pz[6], pw[6];
+        for (int p = 0; p < 6; p++)
+        {
+            px[p] = _mm256_set1_ps(frustum.planes[p].x);
+            py[p] = _mm256_set1_ps(frustum.planes[p].y);
+            pz[p] = _mm256_set1_ps(frustum.planes[p].z);
+            pw[p] = _mm256_set1_ps(frustum.planes[p].w);
+        }
+        for (; i + 8 <= n; i += 8)
+        {
+            __m256 x = _mm256_loadu_ps(&set.x[i]);
+            __m256 y = _mm256_loadu_ps(&set.y[i]);
+            __m256 z = _mm256_loadu_ps(&set.z[i]);
+            __m256 negRadius = _mm256_sub_ps(_mm256_setzero_ps(), _mm256_loadu_ps(&set.radius[i]));
+            __m256 inside = _mm256_cmp_ps(_mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(px[0], x), _mm256_mul_ps(py[0], y)),
+                _mm256_mul_ps(pz[0], z)), pw[0]), negRadius, _CMP_GE_OQ);
+            for (int p = 1; p < 6; p++)
+            {
+                __m256 distance = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(px[p], x), _mm256_mul_ps(py[p], y)),
+                    _mm256_mul_ps(pz[p], z)), pw[p]);
+                inside = _mm256_and_ps(inside, _mm256_cmp_ps(distance, negRadius, _CMP_GE_OQ));
+            }
+            count = appendVisible(out, count, (uint32_t)i, _mm256_movemask_ps(inside), 8);
+        }
+    }
+#endif
+#if defined(FRUSTUM_SIMD)
+    if (path != CULL_SCALAR)
+    {
+        __m128 px[6], py[6], pz[6], pw[6];
+        for (int p = 0; p < 6; p++)
+        {
+            px[p] = _mm_set1_ps(frustum.planes[p].x);
+            py[p] = _mm_set1_ps(frustum.planes[p].y);
+            pz[p] = _mm_set1_ps(frustum.planes[p].z);
+            pw[p] = _mm_set1_ps(frustum.planes[p].w);
+        }
+        // all of them without AVX, the last 4 to 7 with it
+        for (; i + 4 <= n; i += 4)
+        {
+            __m128 x = _mm_loadu_ps(&set.x[i]);
+            __m128 y = _mm_loadu_ps(&set.y[i]);
+            __m128 z = _mm_loadu_ps(&set.z[i]);
+            __m128 negRadius = _mm_sub_ps(_mm_setzero_ps(), _mm_loadu_ps(&set.radius[i]));
+            __m128 inside = _mm_cmpge_ps(_mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(px[0], x), _mm_mul_ps(py[0], y)),
+                _mm_mul_ps(pz[0], z)), pw[0]), negRadius);
+            for (int p = 1; p < 6; p++)
+            {
+                __m128 distance = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(px[p], x), _mm_mul_ps(py[p], y)), _mm_mul_ps(pz[p], z)), pw[p]);
+                inside = _mm_and_ps(inside, _mm_cmpge_ps(distance, negRadius));
+            }
+            count = appendVisible(out, count, (uint32_t)i, _mm_movemask_ps(inside), 4);
+        }
+    }
+#endif
+    return cullSpheresScalar(frustum, set, i, n, out, count);
+}
+
+// the same for boxes
+inline size_t cullBoxes(const Frustum& frustum, const BoxSet& set, std::vector<uint32_t>& visible, CullingPath path = CULL_BEST)
+{
+    size_t n = set.size();
+    if (visible.size() < n)
+        visible.resize(n);
+    if (n == 0)
+        return 0;
+    uint32_t* out = visible.data();
+    size_t count = 0;
+    size_t i = 0;
+#if defined(FRUSTUM_AVX)
+    if (path == CULL_AVX)
+    {
+        const __m256 signMask = _mm256_set1_ps(-0.0f);
+        __m256 px[6], py[6], pz[6], pw[6], ax[6], ay[6], az[6];
+        for (int p = 0; p < 6; p++)
+        {
+            px[p] = _mm256_set1_ps(frustum.planes[p].x);
+            py[p] = _mm256_set1_ps(frustum.planes[p].y);
+            pz[p] = _mm256_set1_ps(frustum.planes[p].z);
+            pw[p] = _mm256_set1_ps(frustum.planes[p].w);
+            ax[p] = _mm256_andnot_ps(signMask, px[p]);
+            ay[p] = _mm256_andnot_ps(signMask, py[p]);
+            az[p] = _mm256_andnot_ps(signMask, pz[p]);
+        }
+        for (; i + 8 <= n; i += 8)
+        {
+            __m256 cx = _mm256_loadu_ps(&set.centerX[i]);
+            __m256 cy = _mm256_loadu_ps(&set.centerY[i]);
+            __m256 cz = _mm256_loadu_ps(&set.centerZ[i]);
+            __m256 ex = _mm256_loadu_ps(&set.extentX[i]);
+            __m256 ey = _mm256_loadu_ps(&set.extentY[i]);
+            __m256 ez = _mm256_loadu_ps(&set.extentZ[i]);
+            __m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+            for (int p = 0; p < 6; p++)
+            {
+                __m256 distance = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(px[p], cx), _mm256_mul_ps(py[p], cy)),
+                    _mm256_mul_ps(pz[p], cz)), pw[p]);
+                __m256 reach = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ax[p], ex), _mm256_mul_ps(ay[p], ey)), _mm256_mul_ps(az[p], ez));
+                inside = _mm256_and_ps(inside, _mm256_cmp_ps(_mm256_add_ps(distance, reach), _mm256_setzero_ps(), _CMP_GE_OQ));
+            }
+            count = appendVisible(out, count, (uint32_t)i, _mm256_movemask_ps(inside), 8);
+        }
+    }
+#endif
+#if defined(FRUSTUM_SIMD)
+    if (path != CULL_SCALAR)
+    {
+        const __m128 signMask = _mm_set1_ps(-0.0f);
+        __m128 px[6], py[6], pz[6], pw[6], ax[6], ay[6], az[6];
+        for (int p = 0; p < 6; p++)
+        {
+            px[p] = _mm_set1_ps(frustum.planes[p].x);
+            py[p] = _mm_set1_ps(frustum.planes[p].y);
+            pz[p] = _mm_set1_ps(frustum.planes[p].z);
+            pw[p] = _mm_set1_ps(frustum.planes[p].w);
+            ax[p] = _mm_andnot_ps(signMask, px[p]);
+            ay[p] = _mm_andnot_ps(signMask, py[p]);
+            az[p] = _mm_andnot_ps(signMask, pz[p]);
+        }
+        for (; i + 4 <= n; i += 4)
+        {
+            __m128 cx = _mm_loadu_ps(&set.centerX[i]);
+            __m128 cy = _mm_loadu_ps(&set.centerY[i]);
+            __m128 cz = _mm_loadu_ps(&set.centerZ[i]);
+            __m128 ex = _mm_loadu_ps(&set.extentX[i]);
+            __m128 ey = _mm_loadu_ps(&set.extentY[i]);
+            __m128 ez = _mm_loadu_ps(&set.extentZ[i]);
+            __m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+            for (int p = 0; p < 6; p++)
+            {
+                __m128 distance = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(px[p], cx), _mm_mul_ps(py[p], cy)), _mm_mul_ps(pz[p], cz)), pw[p]);
+                __m128 reach = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ax[p], ex), _mm_mul_ps(ay[p], ey)), _mm_mul_ps(az[p], ez));
+                inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(distance, reach), _mm_setzero_ps()));
+            }
+            count = appendVisible(out, count, (uint32_t)i, _mm_movemask_ps(inside), 4);
+        }
+    }
+#endif
+    return cullBoxesScalar(frustum, set, i, n, out, count);
+}
+#endif
@@ -0,0 +1,210 @@
+#ifndef GL_STATE_H
+#define GL_STATE_H
+
+#include <glad/glad.h>
+
+#include <iostream>
+
+// Thin cache of the GL binding state. Every bind goes through it and calls that would
+// not change anything are dropped before they reach the driver. Counters of issued and
+// elided calls are kept per frame.
+// Code that binds state directly with gl* calls must call invalidate() afterwards.
+class GLStateCache
+{
+public:
+    enum Call
+    {
+        PROGRAM,
+        VERTEX_ARRAY,
+        ACTIVE_TEXTURE,
+        TEXTURE,
+        DEPTH_FUNC,
+        CALL_COUNT
+    };
+
+    struct Counters
+    {
+        unsigned int issued[CALL_COUNT];
+        unsigned int elided[CALL_COUNT];
+        unsigned int draws;
+        unsigned int instances;
+        unsigned int triangles; // of GL_TRIANGLES draws, all instances
+
+        unsigned int totalIssued() const
+        {
+            unsigned int total = 0;
+            for (int i = 0; i < CALL_COUNT; i++)
+                total += issued[i];
+            return total;
+        }
+        unsigned int totalElided() const
+        {
+            unsigned int total = 0;
+            for (int i = 0; i < CALL_COUNT; i++)
+                total += elided[i];
+            return total;
+        }
+    };
+
+    static const int MAX_TEXTURE_UNITS = 16;
+
+    GLStateCache() : current(), lastFrame()
+    {
+        invalidate();
+    }
+
+    // forgets everything that is bound, the next call of each kind is always issued
+    void invalidate()
+    {
+        program = UNKNOWN;
+        vertexArray = UNKNOWN;
+        activeTextureUnit = UNKNOWN;
+        for (int unit = 0; unit < MAX_TEXTURE_UNITS; unit++)
+            for (int target = 0; target < TARGET_COUNT; target++)
+                textures[unit][target] = UNKNOWN;
+        depthFunction = UNKNOWN;
+    }
+
+    void useProgram(GLuint id)
+    {
+        if (changed(PROGRAM, program, id))
+            glUseProgram(id);
+    }
+
+    void bindVertexArray(GLuint id)
+    {
+        if (changed(VERTEX_ARRAY, vertexArray, id))
+            glBindVertexArray(id);
+    }
+
+    // binds a texture to the given unit (0 based, not GL_TEXTUREi)
+    void bindTexture(GLuint unit, GLenum target, GLuint id)
+    {
+        int targetIndex = textureTargetIndex(target);
+        if (unit >= MAX_TEXTURE_UNITS || targetIndex < 0)
+        {
+            // not tracked, pass through
+            glActiveTexture(GL_TEXTURE0 + unit);
+            glBindTexture(target, id);
+            activeTextureUnit = unit;
+            current.issued[TEXTURE]++;
+            return;
+        }
+        if (textures[unit][targetIndex] == id)
+        {
+            current.elided[TEXTURE]++;
+            return;
+        }
+        if (changed(ACTIVE_TEXTURE, activeTextureUnit, unit))
+            glActiveTexture(GL_TEXTURE0 + unit);
+        glBindTexture(target, id);
+        textures[unit][targetIndex] = id;
+        current.issued[TEXTURE]++;
+    }
+
+    void depthFunc(GLenum func)
+    {
+        if (changed(DEPTH_FUNC, depthFunction, func))
+            glDepthFunc(func);
+    }
+
+    // draw calls go through the cache only to be counted
+    void drawArrays(GLenum mode, GLint first, GLsizei count)
+    {
+        glDrawArrays(mode, first, count);
+        countDraw(mode, count, 1);
+    }
+
+    void drawArraysInstanced(GLenum mode, GLint first, GLsizei count, GLsizei instanceCount)
+    {
+        glDrawArraysInstanced(mode, first, count, instanceCount);
+        countDraw(mode, count, instanceCount);
+    }
+
+    void drawElements(GLenum mode, GLsizei count, GLenum type, const void* indices)
+    {
+        glDrawElements(mode, count, type, indices);
+        countDraw(mode, count, 1);
+    }
+
+    void drawElementsInstanced(GLenum mode, GLsizei count, GLenum type, const void* indices, GLsizei instanceCount)
+    {
+        glDrawElementsInstanced(mode, count, type, indices, instanceCount);
+        countDraw(mode, count, instanceCount);
+    }
+
+    // call once at the start of every frame, keeps the counters of the finished frame
+    void beginFrame()
+    {
+        lastFrame = current;
+        current = Counters();
+    }
+
+    // counters of the last finished frame
+    const Counters& frameCounters() const
+    {
+        return lastFrame;
+    }
+
+    void printFrameCounters() const
+    {
+        static const char* names[CALL_COUNT] = { "program", "vao", "active texture", "texture", "depth func" };
+        std::cout << "state changes: issued " << lastFrame.totalIssued() << ", elided " << lastFrame.totalElided() << " (";
+        for (int i = 0; i < CALL_COUNT; i++)
+            std::cout << (i ? ", " : "") << names[i] << " " << lastFrame.issued[i] << "/" << lastFrame.issued[i] + lastFrame.elided[i];
+        std::cout << "), draws " << lastFrame.draws << " (" << lastFrame.instances << " instances, " << lastFrame.triangles << " triangles)" << std::endl;
+    }
+
+private:
+    static const GLuint UNKNOWN = 0xFFFFFFFFu;
+    enum { TARGET_2D, TARGET_2D_ARRAY, TARGET_CUBE_MAP, TARGET_BUFFER, TARGET_COUNT };
+
+    GLuint program;
+    GLuint vertexArray;
+    GLuint activeTextureUnit;
+    GLuint textures[MAX_TEXTURE_UNITS][TARGET_COUNT];
+    GLuint depthFunction;
+    Counters current;
+    Counters lastFrame;
+
+    void countDraw(GLenum mode, GLsizei count, GLsizei instanceCount)
+    {
+        current.draws++;
+        current.instances += instanceCount;
+        if (mode == GL_TRIANGLES)
+            current.triangles += count / 3 * instanceCount;
+    }
+
+    // updates the cached value, returns true if the call has to be issued
+    bool changed(Call call, GLuint& cached, GLuint value)
+    {
+        if (cached == value)
+        {
+            current.elided[call]++;
+            return false;
+        }
+        cached = value;
+        current.issued[call]++;
+        return true;
+    }
+
+    static int textureTargetIndex(GLenum target)
+    {
+        switch (target)
+        {
+        case GL_TEXTURE_2D:       return TARGET_2D;
+        case GL_TEXTURE_2D_ARRAY: return TARGET_2D_ARRAY;
+        case GL_TEXTURE_CUBE_MAP: return TARGET_CUBE_MAP;
+        case GL_TEXTURE_BUFFER:   return TARGET_BUFFER;
+        default:                  return -1;
+        }
+    }
+};
+
+// the state cache of the (single) GL context
+inline GLStateCache& glState()
+{
+    static GLStateCache state;
+    return state;
+}
+#endif
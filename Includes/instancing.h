@@ -0,0 +1,83 @@
+#ifndef INSTANCING_H
+#define INSTANCING_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include <cstddef>
+#include <vector>
+
+// vertex attribute locations of the per-instance data, must match the INSTANCED
+// branch of the vertex shaders (mat4 takes 4 locations, mat3 takes 3)
+const GLuint INSTANCE_MODEL_LOCATION = 3;         // 3..6
+const GLuint INSTANCE_NORMAL_MATRIX_LOCATION = 7; // 7..9
+
+// per-instance vertex data: model matrix and the world space normal matrix computed
+// on the CPU once instead of inverse() per vertex
+struct InstanceData
+{
+    glm::mat4 model;
+    glm::mat3 normalMatrix;
+};
+
+inline InstanceData makeInstance(const glm::mat4& model)
+{
+    InstanceData instance;
+    instance.model = model;
+    instance.normalMatrix = glm::transpose(glm::inverse(glm::mat3(model)));
+    return instance;
+}
+
+// Vertex buffer of InstanceData read with a divisor of 1
+class InstanceBuffer
+{
+public:
+    unsigned int ID;
+    std::vector<InstanceData> instances;
+
+    InstanceBuffer() : ID(0)
+    {
+        glGenBuffers(1, &ID);
+    }
+
+    // uploads all instances (after the count changed)
+    void upload()
+    {
+        glBindBuffer(GL_ARRAY_BUFFER, ID);
+        glBufferData(GL_ARRAY_BUFFER, instances.size() * sizeof(InstanceData), instances.data(), GL_DYNAMIC_DRAW);
+    }
+
+    // re-uploads one instance that moved
+    void update(size_t index)
+    {
+        glBindBuffer(GL_ARRAY_BUFFER, ID);
+        glBufferSubData(GL_ARRAY_BUFFER, index * sizeof(InstanceData), sizeof(InstanceData), &instances[index]);
+    }
+
+    GLsizei count() const
+    {
+        return (GLsizei)instances.size();
+    }
+
+    // adds the instance attributes to the currently bound VAO
+    void setupAttributes() const
+    {
+        glBindBuffer(GL_ARRAY_BUFFER, ID);
+        for (GLuint column = 0; column < 4; column++)
+        {
+            GLuint location = INSTANCE_MODEL_LOCATION + column;
+            glVertexAttribPointer(location, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData), (void*)(offsetof(InstanceData, model) + column * sizeof(glm::vec4)));
+            glEnableVertexAttribArray(location);
+            glVertexAttribDivisor(location, 1);
+        }
+        for (GLuint column = 0; column < 3; column++)
+        {
+            GLuint location = INSTANCE_NORMAL_MATRIX_LOCATION + column;
+            glVertexAttribPointer(location, 3, GL_FLOAT, GL_FALSE, sizeof(InstanceData), (void*)(offsetof(InstanceData, normalMatrix) + column * sizeof(glm::vec3)));
+            glEnableVertexAttribArray(location);
+            glVertexAttribDivisor(location, 1);
+        }
+    }
+};
+#endif
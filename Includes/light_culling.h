@@ -0,0 +1,183 @@
+#ifndef LIGHT_CULLING_H
+#define LIGHT_CULLING_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include <lights.h>
+#include <benchmark.h>
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+// Per-object light culling for the forward path (K key, CULLED shader variants). Once per
+// frame every light of the Lights block gets a sphere of influence from its attenuation
+// radius (and a cone for spot lights); each draw then tests its bounding sphere against
+// them and passes the indices of the lights that reach it, so the fragment shaders only
+// loop over those (see light_lists.glsl).
+// A list is packed into one uint: count in bits 0..3, then 4 bits per light index.
+// Draws get a uvec2 (point list, spot list), as a uniform or a per-instance attribute.
+
+static_assert(NR_POINT_LIGHTS <= 7 && NR_SPOT_LIGHTS <= 7, "light lists hold at most 7 indices of 4 bits");
+
+// vertex attribute location of the per-instance light lists, must match the INSTANCED
+// branch of multiple_lights.vs (instancing.h uses 3..9)
+const GLuint INSTANCE_LIGHT_LIST_LOCATION = 10;
+
+struct BoundingSphere
+{
+    glm::vec3 center;
+    float radius;
+};
+
+// world space bounds of a mesh whose local bounds are a sphere around the origin
+inline BoundingSphere transformBounds(const glm::mat4& model, float localRadius)
+{
+    float scale = std::sqrt(std::max(glm::dot(glm::vec3(model[0]), glm::vec3(model[0])),
+        std::max(glm::dot(glm::vec3(model[1]), glm::vec3(model[1])), glm::dot(glm::vec3(model[2]), glm::vec3(model[2])))));
+    BoundingSphere bounds;
+    bounds.center = glm::vec3(model[3]);
+    bounds.radius = localRadius * scale;
+    return bounds;
+}
+
+// true if the sphere touches the cone (apex, unit axis, length, half angle as sin/cos);
+// the cone is capped by a plane at its length, which is conservative for a spherical cap
+inline bool coneIntersectsSphere(const glm::vec3& apex, const glm::vec3& axis, float length, float sinAngle, float cosAngle, const BoundingSphere& sphere)
+{
+    glm::vec3 v = sphere.center - apex;
+    float along = glm::dot(v, axis);
+    if (along < -sphere.radius || along > length + sphere.radius)
+        return false;
+    // distance from the sphere center to the cone's side
+    float across = std::sqrt(std::max(glm::dot(v, v) - along * along, 0.0f));
+    return across * cosAngle - along * sinAngle <= sphere.radius;
+}
+
+class LightCuller
+{
+public:
+    // lights kept and tested since the last resetStats()
+    struct Stats
+    {
+        double ms;
+        size_t draws;
+        size_t pointLights, pointLightsTested;
+        size_t spotLights, spotLightsTested;
+    };
+
+    LightCuller() : stats()
+    {
+    }
+
+    // computes the light volumes of this frame; spot lights below firstSpotLight are off
+    void prepare(const LightBlock& lights, int firstSpotLight)
+    {
+        for (int i = 0; i < NR_POINT_LIGHTS; i++)
+        {
+            pointVolumes[i].center = lights.pointLights[i].position;
+            pointVolumes[i].radius = lightRadius(lights.pointLights[i]);
+        }
+        for (int i = 0; i < NR_SPOT_LIGHTS; i++)
+        {
+            const SpotLight& light = lights.spotLight[i];
+            SpotVolume& volume = spotVolumes[i];
+            volume.apex = light.position;
+            volume.axis = glm::normalize(light.direction);
+            volume.length = i < firstSpotLight ? 0.0f : lightRadius(light);
+            volume.cosAngle = light.outerCutOff;
+            volume.sinAngle = std::sqrt(std::max(1.0f - light.outerCutOff * light.outerCutOff, 0.0f));
+        }
+    }
+
+    // packed (point, spot) light lists of an object
+    glm::uvec2 cull(const BoundingSphere& bounds)
+    {
+        GLuint points = 0, pointCount = 0;
+        for (int i = 0; i < NR_POINT_LIGHTS; i++)
+        {
+            float reach = pointVolumes[i].radius + bounds.radius;
+            glm::vec3 d = bounds.center - pointVolumes[i].center;
+            if (pointVolumes[i].radius > 0.0f && glm::dot(d, d) <= reach * reach)
+                points |= (GLuint)i << (4 + 4 * pointCount++);
+        }
+        GLuint spots = 0, spotCount = 0;
+        for (int i = 0; i < NR_SPOT_LIGHTS; i++)
+        {
+            const SpotVolume& volume = spotVolumes[i];
+            if (volume.length > 0.0f && coneIntersectsSphere(volume.apex, volume.axis, volume.length, volume.sinAngle, volume.cosAngle, bounds))
+                spots |= (GLuint)i << (4 + 4 * spotCount++);
+        }
+        stats.draws++;
+        stats.pointLights += pointCount;
+        stats.pointLightsTested += NR_POINT_LIGHTS;
+        stats.spotLights += spotCount;
+        stats.spotLightsTested += NR_SPOT_LIGHTS;
+        return glm::uvec2(points | pointCount, spots | spotCount);
+    }
+
+    // light lists of many objects at once
+    void cull(const std::vector<BoundingSphere>& bounds, std::vector<glm::uvec2>& lists)
+    {
+        Timer timer;
+        lists.resize(bounds.size());
+        for (size_t i = 0; i < bounds.size(); i++)
+            lists[i] = cull(bounds[i]);
+        stats.ms += timer.elapsedMs();
+    }
+
+    const Stats& lastStats() const
+    {
+        return stats;
+    }
+
+    void resetStats()
+    {
+        stats = Stats();
+    }
+
+private:
+    struct SpotVolume
+    {
+        glm::vec3 apex;
+        glm::vec3 axis;
+        float length;
+        float sinAngle, cosAngle;
+    };
+
+    BoundingSphere pointVolumes[NR_POINT_LIGHTS];
+    SpotVolume spotVolumes[NR_SPOT_LIGHTS];
+    Stats stats;
+};
+
+// Vertex buffer of per-instance light lists (uvec2) read with a divisor of 1
+class LightListBuffer
+{
+public:
+    unsigned int ID;
+    std::vector<glm::uvec2> lists;
+
+    LightListBuffer() : ID(0)
+    {
+        glGenBuffers(1, &ID);
+    }
+
+    // the lists follow the moving lights, all of them are replaced every frame
+    void upload()
+    {
+        glBindBuffer(GL_ARRAY_BUFFER, ID);
+        glBufferData(GL_ARRAY_BUFFER, lists.size() * sizeof(glm::uvec2), lists.data(), GL_STREAM_DRAW);
+    }
+
+    // adds the light list attribute to the currently bound VAO
+    void setupAttributes() const
+    {
+        glBindBuffer(GL_ARRAY_BUFFER, ID);
+        glVertexAttribIPointer(INSTANCE_LIGHT_LIST_LOCATION, 2, GL_UNSIGNED_INT, sizeof(glm::uvec2), (void*)0);
+        glEnableVertexAttribArray(INSTANCE_LIGHT_LIST_LOCATION);
+        glVertexAttribDivisor(INSTANCE_LIGHT_LIST_LOCATION, 1);
+    }
+};
+#endif
@@ -0,0 +1,122 @@
+#ifndef LIGHTS_H
+#define LIGHTS_H
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+
+// C++ mirror of the "Lights" uniform block declared in lights.glsl (std140 layout).
+// Every vec3 is followed by a float (or padding) so members land on 16 byte boundaries
+// exactly like the GLSL structs; keep both files in sync.
+// The scene keeps its lights in world space; the block holds them in view space, the
+// space all lit shaders shade in (see toViewSpace).
+
+// binding point of the "Lights" uniform block
+const unsigned int LIGHTS_BINDING = 0;
+
+const int NR_POINT_LIGHTS = 4;
+const int NR_SPOT_LIGHTS = 2;
+// order 3 spherical harmonics of the sky ambient, see spherical_harmonics.h
+const int SH_COEFFICIENTS = 9;
+
+struct DirLight
+{
+    glm::vec3 direction;
+    float pad0;
+    glm::vec3 ambient;
+    float pad1;
+    glm::vec3 diffuse;
+    float pad2;
+    glm::vec3 specular;
+    float pad3;
+};
+
+struct PointLight
+{
+    glm::vec3 position;
+    float constant;
+    glm::vec3 ambient;
+    float linear;
+    glm::vec3 diffuse;
+    float quadratic;
+    glm::vec3 specular;
+    float pad0;
+};
+
+struct SpotLight
+{
+    glm::vec3 position;
+    float cutOff;
+    glm::vec3 direction;
+    float outerCutOff;
+    glm::vec3 ambient;
+    float constant;
+    glm::vec3 diffuse;
+    float linear;
+    glm::vec3 specular;
+    float quadratic;
+};
+
+struct LightBlock
+{
+    DirLight dirLight;
+    PointLight pointLights[NR_POINT_LIGHTS];
+    SpotLight spotLight[NR_SPOT_LIGHTS];
+    glm::vec4 ambientSH[SH_COEFFICIENTS];   // world space, rgb (w unused), scaled by dirLight.ambient
+};
+
+static_assert(sizeof(DirLight) == 64, "DirLight must match std140 layout");
+static_assert(sizeof(PointLight) == 64, "PointLight must match std140 layout");
+static_assert(sizeof(SpotLight) == 80, "SpotLight must match std140 layout");
+static_assert(offsetof(LightBlock, pointLights) == 64, "LightBlock must match std140 layout");
+static_assert(offsetof(LightBlock, spotLight) == 64 + NR_POINT_LIGHTS * 64, "LightBlock must match std140 layout");
+static_assert(offsetof(LightBlock, ambientSH) == 64 + NR_POINT_LIGHTS * 64 + NR_SPOT_LIGHTS * 80, "LightBlock must match std140 layout");
+
+// distance at which the attenuation brings the brightest channel of a light below 5/256;
+// beyond it the light adds nothing visible and can be skipped
+inline float lightRadius(float constant, float linear, float quadratic, const glm::vec3& ambient, const glm::vec3& diffuse, const glm::vec3& specular)
+{
+    glm::vec3 brightest = glm::max(ambient, glm::max(diffuse, specular));
+    float intensity = std::max(brightest.x, std::max(brightest.y, brightest.z));
+    float c = constant - intensity * 256.0f / 5.0f;
+    if (c >= 0.0f)
+        return 0.0f; // never visible
+    if (quadratic <= 0.0f)
+        return linear > 0.0f ? -c / linear : 1e30f;
+    return (-linear + std::sqrt(linear * linear - 4.0f * quadratic * c)) / (2.0f * quadratic);
+}
+
+inline float lightRadius(const PointLight& light)
+{
+    return lightRadius(light.constant, light.linear, light.quadratic, light.ambient, light.diffuse, light.specular);
+}
+
+inline float lightRadius(const SpotLight& light)
+{
+    return lightRadius(light.constant, light.linear, light.quadratic, light.ambient, light.diffuse, light.specular);
+}
+
+// the same light with its position in view space
+inline PointLight toViewSpace(const PointLight& light, const glm::mat4& view)
+{
+    PointLight result = light;
+    result.position = glm::vec3(view * glm::vec4(light.position, 1.0f));
+    return result;
+}
+
+// world space lights transformed once per frame for the shaders
+inline void toViewSpace(const LightBlock& lights, const glm::mat4& view, LightBlock& result)
+{
+    result = lights;
+    result.dirLight.direction = glm::mat3(view) * lights.dirLight.direction;
+    for (int i = 0; i < NR_POINT_LIGHTS; i++)
+        result.pointLights[i] = toViewSpace(lights.pointLights[i], view);
+    for (int i = 0; i < NR_SPOT_LIGHTS; i++)
+    {
+        result.spotLight[i].position = glm::vec3(view * glm::vec4(lights.spotLight[i].position, 1.0f));
+        result.spotLight[i].direction = glm::mat3(view) * lights.spotLight[i].direction;
+    }
+}
+#endif
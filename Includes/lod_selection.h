@@ -0,0 +1,72 @@
+#ifndef LOD_SELECTION_H
+#define LOD_SELECTION_H
+
+#include <glm/glm.hpp>
+
+#include <light_culling.h>
+#include <parametric_mesh.h>
+
+#include <algorithm>
+#include <cmath>
+
+// Level of detail selection by screen-space error. Every level of a LodMesh knows its largest
+// distance to the true surface; projected at the object's distance that is a length in pixels,
+// and the coarsest level below a pixel threshold is drawn. The distance is the one to the
+// nearest point of the bounding sphere, so the error is never underestimated; a camera inside
+// the sphere gets the finest level.
+//
+// Without hysteresis an object whose error sits at the threshold would alternate between two
+// levels every few frames (popping). The selector only leaves the current level once the
+// decision is clear by a margin: a coarser level must be below threshold * (1 - hysteresis),
+// the current one must be above threshold * (1 + hysteresis) before a finer one is taken.
+
+// pixels covered by one unit at distance 1 for a vertical field of view and a viewport height
+inline float projectionScale(float fovy, float viewportHeight)
+{
+    return viewportHeight / (2.0f * std::tan(fovy * 0.5f));
+}
+
+// distance from the eye to the nearest point of the bounds, at least 'nearPlane'
+inline float lodDistance(const BoundingSphere& bounds, const glm::vec3& eye, float nearPlane)
+{
+    return std::max(glm::length(bounds.center - eye) - bounds.radius, nearPlane);
+}
+
+struct LodSelector
+{
+    float thresholdPixels;
+    float hysteresis; // fraction of the threshold
+
+    LodSelector(float thresholdPixels = 1.0f, float hysteresis = 0.25f) : thresholdPixels(thresholdPixels), hysteresis(hysteresis)
+    {
+    }
+
+    // error of a level in pixels; 'scale' is the object's world scale (its errors are in object space)
+    static float projectedError(const LodMesh& lods, size_t level, float scale, float distance, float pixelsPerUnit)
+    {
+        return lods.levels[level].error * scale * pixelsPerUnit / distance;
+    }
+
+    // the level to draw this frame, 'current' is the one drawn last frame
+    size_t select(const LodMesh& lods, float scale, float distance, float pixelsPerUnit, size_t current) const
+    {
+        size_t target = 0;
+        while (target + 1 < lods.levels.size() && projectedError(lods, target + 1, scale, distance, pixelsPerUnit) <= thresholdPixels)
+            target++;
+        current = std::min(current, lods.levels.size() - 1);
+        if (target > current)
+        {
+            // coarser: only to a level that is clearly good enough
+            while (target > current && projectedError(lods, target, scale, distance, pixelsPerUnit) > thresholdPixels * (1.0f - hysteresis))
+                target--;
+        }
+        else if (target < current)
+        {
+            // finer: only once the current level is clearly too coarse
+            if (projectedError(lods, current, scale, distance, pixelsPerUnit) <= thresholdPixels * (1.0f + hysteresis))
+                target = current;
+        }
+        return target;
+    }
+};
+#endif
@@ -0,0 +1,411 @@
+#ifndef MESH_OPTIMIZER_H
+#define MESH_OPTIMIZER_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <numeric>
+#include <unordered_map>
+#include <vector>
+
+// Mesh processing done once at load, before the buffers are created:
+//   deduplicateVertices  merges identical vertices, e.g. of a triangleListMesh (glDrawArrays)
+//   optimizeVertexCache  orders triangles for the post-transform vertex cache (Forsyth's
+//                        linear-speed algorithm, scored for an LRU cache of 32 entries)
+//   optimizeOverdraw     splits that order into clusters whose vertex cache efficiency stays
+//                        close to the whole order's and sorts them outward facing first (Sander
+//                        et al., "Fast triangle reordering for vertex locality and reduced overdraw")
+//   optimizeVertexFetch  stores the vertices in the order the triangles first use them
+//   packIndices          16 bit indices when every vertex can be addressed with them
+// analyzeVertexCache simulates a FIFO cache of VERTEX_CACHE_SIZE entries and gives the
+// vertex shader invocations per triangle (ACMR, 0.5 at best for large grids, 3 without reuse)
+// and per vertex (ATVR, 1 at best); optimizeMesh prints both before and after.
+
+const int VERTEX_CACHE_SIZE = 16;
+
+// interleaved float vertices (position first) and a triangle list
+struct IndexedMesh
+{
+    int floatsPerVertex;
+    std::vector<float> vertices;
+    std::vector<uint32_t> indices;
+
+    size_t vertexCount() const
+    {
+        return vertices.size() / floatsPerVertex;
+    }
+
+    size_t triangleCount() const
+    {
+        return indices.size() / 3;
+    }
+
+    glm::vec3 position(uint32_t index) const
+    {
+        const float* p = vertices.data() + (size_t)index * floatsPerVertex;
+        return glm::vec3(p[0], p[1], p[2]);
+    }
+};
+
+struct VertexCacheStats
+{
+    size_t transformed; // vertex shader invocations of one draw
+    float acmr;         // per triangle
+    float atvr;         // per vertex
+};
+
+inline VertexCacheStats analyzeVertexCache(const std::vector<uint32_t>& indices, size_t vertexCount, int cacheSize = VERTEX_CACHE_SIZE)
+{
+    // FIFO: a vertex is a hit while fewer than cacheSize misses happened since it was loaded
+    std::vector<size_t> loadedAt(vertexCount, 0);
+    size_t misses = 0;
+    for (uint32_t index : indices)
+    {
+        if (loadedAt[index] == 0 || misses - (loadedAt[index] - 1) >= (size_t)cacheSize)
+        {
+            misses++;
+            loadedAt[index] = misses;
+        }
+    }
+    VertexCacheStats stats;
+    stats.transformed = misses;
+    stats.acmr = indices.empty() ? 0.0f : (float)misses / (indices.size() / 3);
+    stats.atvr = vertexCount == 0 ? 0.0f : (float)misses / vertexCount;
+    return stats;
+}
+
+// a triangle list as glDrawArrays reads it, one index per vertex
+inline IndexedMesh triangleListMesh(const float* vertices, size_t vertexCount, int floatsPerVertex)
+{
+    IndexedMesh mesh;
+    mesh.floatsPerVertex = floatsPerVertex;
+    mesh.vertices.assign(vertices, vertices + vertexCount * floatsPerVertex);
+    mesh.indices.resize(vertexCount);
+    std::iota(mesh.indices.begin(), mesh.indices.end(), 0u);
+    return mesh;
+}
+
+// bitwise identical vertices become one
+inline void deduplicateVertices(IndexedMesh& mesh)
+{
+    const size_t vertexBytes = mesh.floatsPerVertex * sizeof(float);
+    auto hash = [&](const float* vertex)
+    {
+        // FNV-1a over the bytes
+        uint32_t h = 2166136261u;
+        const unsigned char* bytes = reinterpret_cast<const unsigned char*>(vertex);
+        for (size_t i = 0; i < vertexBytes; i++)
+            h = (h ^ bytes[i]) * 16777619u;
+        return h;
+    };
+    std::vector<float> vertices;
+    std::vector<uint32_t> remap(mesh.vertexCount());
+    std::unordered_multimap<uint32_t, uint32_t> unique;
+    for (size_t i = 0; i < mesh.vertexCount(); i++)
+    {
+        const float* vertex = mesh.vertices.data() + i * mesh.floatsPerVertex;
+        uint32_t h = hash(vertex);
+        uint32_t index = (uint32_t)(vertices.size() / mesh.floatsPerVertex);
+        auto range = unique.equal_range(h);
+        for (auto it = range.first; it != range.second; ++it)
+        {
+            if (std::memcmp(vertices.data() + (size_t)it->second * mesh.floatsPerVertex, vertex, vertexBytes) == 0)
+            {
+                index = it->second;
+                break;
+            }
+        }
+        if (index == vertices.size() / mesh.floatsPerVertex)
+        {
+            vertices.insert(vertices.end(), vertex, vertex + mesh.floatsPerVertex);
+            unique.insert(std::make_pair(h, index));
+        }
+        remap[i] = index;
+    }
+    for (uint32_t& index : mesh.indices)
+        index = remap[index];
+    mesh.vertices.swap(vertices);
+}
+
+inline void optimizeVertexCache(IndexedMesh& mesh)
+{
+    const int cacheSize = 32;
+    const size_t triangleCount = mesh.triangleCount();
+    const size_t vertexCount = mesh.vertexCount();
+    if (triangleCount == 0)
+        return;
+
+    // triangles of every vertex, the first 'remaining' entries are the ones not emitted yet
+    std::vector<uint32_t> remaining(vertexCount, 0);
+    for (uint32_t index : mesh.indices)
+        remaining[index]++;
+    std::vector<uint32_t> offsets(vertexCount + 1, 0);
+    for (size_t v = 0; v < vertexCount; v++)
+        offsets[v + 1] = offsets[v] + remaining[v];
+    std::vector<uint32_t> adjacency(mesh.indices.size());
+    std::vector<uint32_t> filled(offsets.begin(), offsets.end() - 1);
+    for (size_t t = 0; t < triangleCount; t++)
+        for (int k = 0; k < 3; k++)
+            adjacency[filled[mesh.indices[t * 3 + k]]++] = (uint32_t)t;
+
+    // vertices in recently used triangles score higher, the first three most, and so do
+    // vertices with few triangles left so that no lone triangles stay behind
+    auto vertexScore = [&](int cachePosition, uint32_t trianglesLeft)
+    {
+        if (trianglesLeft == 0)
+            return -1.0f;
+        float score = 0.0f;
+        if (cachePosition >= 0)
+            score = cachePosition < 3 ? 0.75f : std::pow(1.0f - (float)(cachePosition - 3) / (cacheSize - 3), 1.5f);
+        return score + 2.0f / std::sqrt((float)trianglesLeft);
+    };
+    std::vector<int> cachePosition(vertexCount, -1);
+    std::vector<float> score(vertexCount);
+    for (size_t v = 0; v < vertexCount; v++)
+        score[v] = vertexScore(-1, remaining[v]);
+    std::vector<float> triangleScore(triangleCount);
+    std::vector<bool> emitted(triangleCount, false);
+    for (size_t t = 0; t < triangleCount; t++)
+        triangleScore[t] = score[mesh.indices[t * 3]] + score[mesh.indices[t * 3 + 1]] + score[mesh.indices[t * 3 + 2]];
+
+    std::vector<uint32_t> result;
+    result.reserve(mesh.indices.size());
+    std::vector<uint32_t> cache, nextCache;
+    size_t scanStart = 0;
+    long long best = (long long)(std::max_element(triangleScore.begin(), triangleScore.end()) - triangleScore.begin());
+    while (result.size() < mesh.indices.size())
+    {
+        if (best < 0)
+        {
+            // nothing in the cache has triangles left, continue with the best remaining one
+            while (emitted[scanStart])
+                scanStart++;
+            best = (long long)scanStart;
+            for (size_t t = scanStart; t < triangleCount; t++)
+                if (!emitted[t] && triangleScore[t] > triangleScore[best])
+                    best = (long long)t;
+        }
+        emitted[best] = true;
+        const uint32_t* triangle = &mesh.indices[best * 3];
+        nextCache.assign(triangle, triangle + 3);
+        for (int k = 0; k < 3; k++)
+        {
+            uint32_t v = triangle[k];
+            result.push_back(v);
+            // drop the triangle from the vertex's live list
+            uint32_t* first = &adjacency[offsets[v]];
+            uint32_t* found = std::find(first, first + remaining[v], (uint32_t)best);
+            std::swap(*found, first[remaining[v] - 1]);
+            remaining[v]--;
+        }
+        for (uint32_t v : cache)
+            if (v != triangle[0] && v != triangle[1] && v != triangle[2])
+                nextCache.push_back(v);
+        for (size_t i = 0; i < nextCache.size(); i++)
+        {
+            uint32_t v = nextCache[i];
+            cachePosition[v] = i < (size_t)cacheSize ? (int)i : -1;
+            score[v] = vertexScore(cachePosition[v], remaining[v]);
+        }
+        // the scores changed for the cached (and just evicted) vertices only
+        best = -1;
+        for (uint32_t v : nextCache)
+        {
+            for (uint32_t i = 0; i < remaining[v]; i++)
+            {
+                uint32_t t = adjacency[offsets[v] + i];
+                triangleScore[t] = score[mesh.indices[t * 3]] + score[mesh.indices[t * 3 + 1]] + score[mesh.indices[t * 3 + 2]];
+                if (best < 0 || triangleScore[t] > triangleScore[best])
+                    best = t;
+            }
+        }
+        if (nextCache.size() > (size_t)cacheSize)
+            nextCache.resize(cacheSize);
+        cache.swap(nextCache);
+    }
+    mesh.indices.swap(result);
+}
+
+// expects the triangles in vertex cache order; 'threshold' is how much worse than the whole
+// order a cluster's cache efficiency may be (1.05: 5% more vertex shader invocations)
+inline void optimizeOverdraw(IndexedMesh& mesh, float threshold = 1.05f)
+{
+    const size_t triangleCount = mesh.triangleCount();
+    if (triangleCount == 0)
+        return;
+
+    // FIFO cache misses of a triangle, the cache restarts at the beginning of every cluster
+    std::vector<size_t> loadedAt;
+    size_t misses = 0;
+    auto resetCache = [&]()
+    {
+        loadedAt.assign(mesh.vertexCount(), 0);
+        misses = 0;
+    };
+    auto triangleMisses = [&](size_t t)
+    {
+        size_t before = misses;
+        for (int k = 0; k < 3; k++)
+        {
+            uint32_t v = mesh.indices[t * 3 + k];
+            if (loadedAt[v] == 0 || misses - (loadedAt[v] - 1) >= (size_t)VERTEX_CACHE_SIZE)
+                loadedAt[v] = ++misses;
+        }
+        return misses - before;
+    };
+
+    // hard boundaries where the cache order starts over (a triangle sharing nothing with the
+    // cache), then soft ones inside them wherever the cluster so far is efficient enough
+    std::vector<size_t> hard;
+    resetCache();
+    for (size_t t = 0; t < triangleCount; t++)
+        if (triangleMisses(t) == 3)
+            hard.push_back(t);
+    hard.push_back(triangleCount);
+    std::vector<size_t> clusters;
+    for (size_t h = 0; h + 1 < hard.size(); h++)
+    {
+        size_t start = hard[h], end = hard[h + 1];
+        resetCache();
+        for (size_t t = start; t < end; t++)
+            triangleMisses(t);
+        float clusterThreshold = threshold * (float)misses / (end - start);
+        resetCache();
+        size_t clusterStart = start;
+        clusters.push_back(start);
+        for (size_t t = start; t < end; t++)
+        {
+            triangleMisses(t);
+            if (t + 1 < end && (float)misses / (t + 1 - clusterStart) <= clusterThreshold)
+            {
+                clusters.push_back(t + 1);
+                clusterStart = t + 1;
+                resetCache();
+            }
+        }
+    }
+    clusters.push_back(triangleCount);
+
+    // clusters facing away from the mesh center are more likely in front of the rest
+    glm::vec3 meshCenter(0.0f);
+    for (size_t v = 0; v < mesh.vertexCount(); v++)
+        meshCenter += mesh.position((uint32_t)v);
+    meshCenter /= (float)mesh.vertexCount();
+    std::vector<float> sortKey(clusters.size() - 1);
+    for (size_t c = 0; c + 1 < clusters.size(); c++)
+    {
+        glm::vec3 center(0.0f), normal(0.0f);
+        float area = 0.0f;
+        for (size_t t = clusters[c]; t < clusters[c + 1]; t++)
+        {
+            glm::vec3 a = mesh.position(mesh.indices[t * 3]);
+            glm::vec3 b = mesh.position(mesh.indices[t * 3 + 1]);
+            glm::vec3 d = mesh.position(mesh.indices[t * 3 + 2]);
+            glm::vec3 n = glm::cross(b - a, d - a);
+            float triangleArea = glm::length(n);
+            center += (a + b + d) * (triangleArea / 3.0f);
+            normal += n;
+            area += triangleArea;
+        }
+        center = area > 0.0f ? center / area : mesh.position(mesh.indices[clusters[c] * 3]);
+        float normalLength = glm::length(normal);
+        sortKey[c] = normalLength > 0.0f ? glm::dot(center - meshCenter, normal / normalLength) : 0.0f;
+    }
+    std::vector<size_t> order(sortKey.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return sortKey[a] > sortKey[b]; });
+
+    std::vector<uint32_t> result;
+    result.reserve(mesh.indices.size());
+    for (size_t c : order)
+        result.insert(result.end(), mesh.indices.begin() + clusters[c] * 3, mesh.indices.begin() + clusters[c + 1] * 3);
+    mesh.indices.swap(result);
+}
+
+// unused vertices are dropped
+inline void optimizeVertexFetch(IndexedMesh& mesh)
+{
+    const uint32_t unused = 0xffffffffu;
+    std::vector<uint32_t> remap(mesh.vertexCount(), unused);
+    std::vector<float> vertices;
+    vertices.reserve(mesh.vertices.size());
+    uint32_t next = 0;
+    for (uint32_t& index : mesh.indices)
+    {
+        if (remap[index] == unused)
+        {
+            remap[index] = next++;
+            const float* vertex = mesh.vertices.data() + (size_t)index * mesh.floatsPerVertex;
+            vertices.insert(vertices.end(), vertex, vertex + mesh.floatsPerVertex);
+        }
+        index = remap[index];
+    }
+    mesh.vertices.swap(vertices);
+}
+
+// index buffer contents for glBufferData and the type for glDrawElements
+struct PackedIndices
+{
+    GLenum type;
+    std::vector<uint16_t> shorts;
+    std::vector<uint32_t> ints;
+
+    GLsizei count() const
+    {
+        return (GLsizei)(type == GL_UNSIGNED_SHORT ? shorts.size() : ints.size());
+    }
+
+    size_t bytes() const
+    {
+        return type == GL_UNSIGNED_SHORT ? shorts.size() * sizeof(uint16_t) : ints.size() * sizeof(uint32_t);
+    }
+
+    const void* data() const
+    {
+        return type == GL_UNSIGNED_SHORT ? (const void*)shorts.data() : (const void*)ints.data();
+    }
+};
+
+inline PackedIndices packIndices(const std::vector<uint32_t>& indices, size_t vertexCount)
+{
+    PackedIndices packed;
+    if (vertexCount <= 65536)
+    {
+        packed.type = GL_UNSIGNED_SHORT;
+        packed.shorts.assign(indices.begin(), indices.end());
+    }
+    else
+    {
+        packed.type = GL_UNSIGNED_INT;
+        packed.ints = indices;
+    }
+    return packed;
+}
+
+// all of the above in order; prints the vertex shader work of one draw before and after (unless
+// 'name' is NULL), vertices are compared bitwise so 'mesh' needs no padding between floats
+inline IndexedMesh optimizeMesh(const char* name, IndexedMesh mesh)
+{
+    VertexCacheStats before = analyzeVertexCache(mesh.indices, mesh.vertexCount());
+    size_t verticesBefore = mesh.vertexCount();
+    deduplicateVertices(mesh);
+    // per unique vertex, as after
+    before.atvr = (float)before.transformed / mesh.vertexCount();
+    optimizeVertexCache(mesh);
+    optimizeOverdraw(mesh);
+    optimizeVertexFetch(mesh);
+    if (!name)
+        return mesh;
+    VertexCacheStats after = analyzeVertexCache(mesh.indices, mesh.vertexCount());
+    std::cout << "mesh " << name << ": " << mesh.triangleCount() << " triangles, " << verticesBefore << " -> " << mesh.vertexCount()
+        << " vertices, transformed " << before.transformed << " -> " << after.transformed << ", ACMR " << before.acmr << " -> " << after.acmr
+        << ", ATVR " << before.atvr << " -> " << after.atvr << ", " << (mesh.vertexCount() <= 65536 ? 16 : 32) << " bit indices" << std::endl;
+    return mesh;
+}
+#endif
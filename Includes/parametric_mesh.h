@@ -0,0 +1,505 @@
+#ifndef PARAMETRIC_MESH_H
+#define PARAMETRIC_MESH_H
+
+#include <glm/glm.hpp>
+#include <glm/gtc/constants.hpp>
+
+#include <mesh_optimizer.h>
+#include <thread_pool.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <future>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// Smooth surfaces tessellated at load: UV sphere, torus and bicubic Bezier patch as grids over
+// (u, v) in [0, 1]^2, the icosphere as a subdivided icosahedron. Vertices are position, normal
+// and texture coordinates (8 floats, as the scene's cube). A LodMesh keeps several tessellations
+// of one surface in one vertex and index buffer, each level with the largest distance between
+// its triangles and the true surface for the LOD selection.
+//
+// A ParametricSurface evaluates a block of grid rows per call. What only depends on u (sin and
+// cos of the angle, the Bernstein weights) is computed once per column into tables, what only
+// depends on v once per row; the per-vertex loops are then multiply-adds over those tables, one
+// array per component so the compiler vectorizes them, and only the last loop interleaves the
+// vertices. Grids of more than PARAMETRIC_TASK_VERTICES vertices are split into row blocks
+// evaluated on a ThreadPool.
+
+const int PARAMETRIC_TASK_VERTICES = 16384;
+
+class ParametricSurface
+{
+public:
+    virtual ~ParametricSurface() {}
+
+    // vertex (i, j) at (u[i], v[j]) is written to out + (j * uCount + i) * 8
+    virtual void evaluate(const float* u, int uCount, const float* v, int vCount, float* out) const = 0;
+
+protected:
+    // one row of vertices as separate arrays
+    struct Row
+    {
+        std::vector<float> px, py, pz, nx, ny, nz, s, t;
+
+        explicit Row(int count) : px(count), py(count), pz(count), nx(count), ny(count), nz(count), s(count), t(count)
+        {
+        }
+
+        void interleave(float* out) const
+        {
+            for (size_t i = 0; i < px.size(); i++, out += 8)
+            {
+                out[0] = px[i];
+                out[1] = py[i];
+                out[2] = pz[i];
+                out[3] = nx[i];
+                out[4] = ny[i];
+                out[5] = nz[i];
+                out[6] = s[i];
+                out[7] = t[i];
+            }
+        }
+    };
+};
+
+// sphere around the origin with the poles on the z axis; u goes around z, v from the north
+// pole (v = 0) to the south pole
+class SphereSurface : public ParametricSurface
+{
+public:
+    explicit SphereSurface(float radius) : radius(radius)
+    {
+    }
+
+    void evaluate(const float* u, int uCount, const float* v, int vCount, float* out) const override
+    {
+        std::vector<float> cosU(uCount), sinU(uCount);
+        for (int i = 0; i < uCount; i++)
+        {
+            cosU[i] = std::cos(glm::two_pi<float>() * u[i]);
+            sinU[i] = std::sin(glm::two_pi<float>() * u[i]);
+        }
+        Row row(uCount);
+        for (int j = 0; j < vCount; j++)
+        {
+            float stackAngle = glm::half_pi<float>() - glm::pi<float>() * v[j];
+            float xy = std::cos(stackAngle), z = std::sin(stackAngle);
+            for (int i = 0; i < uCount; i++)
+            {
+                row.nx[i] = xy * cosU[i];
+                row.ny[i] = xy * sinU[i];
+                row.nz[i] = z;
+                row.px[i] = radius * row.nx[i];
+                row.py[i] = radius * row.ny[i];
+                row.pz[i] = radius * z;
+                row.s[i] = u[i];
+                row.t[i] = v[j];
+            }
+            row.interleave(out + (size_t)j * uCount * 8);
+        }
+    }
+
+private:
+    float radius;
+};
+
+// torus around the z axis: u goes around z at 'majorRadius', v around the tube of 'minorRadius'
+// starting at its top
+class TorusSurface : public ParametricSurface
+{
+public:
+    TorusSurface(float majorRadius, float minorRadius) : majorRadius(majorRadius), minorRadius(minorRadius)
+    {
+    }
+
+    void evaluate(const float* u, int uCount, const float* v, int vCount, float* out) const override
+    {
+        std::vector<float> cosU(uCount), sinU(uCount);
+        for (int i = 0; i < uCount; i++)
+        {
+            cosU[i] = std::cos(glm::two_pi<float>() * u[i]);
+            sinU[i] = std::sin(glm::two_pi<float>() * u[i]);
+        }
+        Row row(uCount);
+        for (int j = 0; j < vCount; j++)
+        {
+            float tubeAngle = glm::half_pi<float>() - glm::two_pi<float>() * v[j];
+            float cosV = std::cos(tubeAngle), sinV = std::sin(tubeAngle);
+            float ring = majorRadius + minorRadius * cosV;
+            for (int i = 0; i < uCount; i++)
+            {
+                row.nx[i] = cosV * cosU[i];
+                row.ny[i] = cosV * sinU[i];
+                row.nz[i] = sinV;
+                row.px[i] = ring * cosU[i];
+                row.py[i] = ring * sinU[i];
+                row.pz[i] = minorRadius * sinV;
+                row.s[i] = u[i];
+                row.t[i] = v[j];
+            }
+            row.interleave(out + (size_t)j * uCount * 8);
+        }
+    }
+
+private:
+    float majorRadius, minorRadius;
+};
+
+// bicubic Bezier patch of 4 x 4 control points, control[j * 4 + i] is the i-th point along u of
+// the j-th row along v; the normal is cross(dP/dv, dP/du), so a patch seen with u to the right and
+// v downwards faces the viewer as the other surfaces
+class BezierPatchSurface : public ParametricSurface
+{
+public:
+    explicit BezierPatchSurface(const glm::vec3 control[16])
+    {
+        std::copy(control, control + 16, this->control);
+    }
+
+    void evaluate(const float* u, int uCount, const float* v, int vCount, float* out) const override
+    {
+        // Bernstein weights of the columns and their derivatives
+        std::vector<float> b[4], db[4];
+        for (int k = 0; k < 4; k++)
+        {
+            b[k].resize(uCount);
+            db[k].resize(uCount);
+        }
+        for (int i = 0; i < uCount; i++)
+        {
+            float w[4], dw[4];
+            bernstein(u[i], w, dw);
+            for (int k = 0; k < 4; k++)
+            {
+                b[k][i] = w[k];
+                db[k][i] = dw[k];
+            }
+        }
+        Row row(uCount);
+        std::vector<float> dux(uCount), duy(uCount), duz(uCount), dvx(uCount), dvy(uCount), dvz(uCount);
+        for (int j = 0; j < vCount; j++)
+        {
+            // the row is a cubic curve in u: q are its control points, dq their derivatives in v
+            float w[4], dw[4];
+            bernstein(v[j], w, dw);
+            glm::vec3 q[4], dq[4];
+            for (int k = 0; k < 4; k++)
+            {
+                q[k] = w[0] * control[k] + w[1] * control[4 + k] + w[2] * control[8 + k] + w[3] * control[12 + k];
+                dq[k] = dw[0] * control[k] + dw[1] * control[4 + k] + dw[2] * control[8 + k] + dw[3] * control[12 + k];
+            }
+            for (int i = 0; i < uCount; i++)
+            {
+                row.px[i] = b[0][i] * q[0].x + b[1][i] * q[1].x + b[2][i] * q[2].x + b[3][i] * q[3].x;
+                row.py[i] = b[0][i] * q[0].y + b[1][i] * q[1].y + b[2][i] * q[2].y + b[3][i] * q[3].y;
+                row.pz[i] = b[0][i] * q[0].z + b[1][i] * q[1].z + b[2][i] * q[2].z + b[3][i] * q[3].z;
+                dux[i] = db[0][i] * q[0].x + db[1][i] * q[1].x + db[2][i] * q[2].x + db[3][i] * q[3].x;
+                duy[i] = db[0][i] * q[0].y + db[1][i] * q[1].y + db[2][i] * q[2].y + db[3][i] * q[3].y;
+                duz[i] = db[0][i] * q[0].z + db[1][i] * q[1].z + db[2][i] * q[2].z + db[3][i] * q[3].z;
+                dvx[i] = b[0][i] * dq[0].x + b[1][i] * dq[1].x + b[2][i] * dq[2].x + b[3][i] * dq[3].x;
+                dvy[i] = b[0][i] * dq[0].y + b[1][i] * dq[1].y + b[2][i] * dq[2].y + b[3][i] * dq[3].y;
+                dvz[i] = b[0][i] * dq[0].z + b[1][i] * dq[1].z + b[2][i] * dq[2].z + b[3][i] * dq[3].z;
+            }
+            for (int i = 0; i < uCount; i++)
+            {
+                float nx = dvy[i] * duz[i] - dvz[i] * duy[i];
+                float ny = dvz[i] * dux[i] - dvx[i] * duz[i];
+                float nz = dvx[i] * duy[i] - dvy[i] * dux[i];
+                // a collapsed edge has no tangent plane, its normal is left pointing along z
+                float length = std::sqrt(nx * nx + ny * ny + nz * nz);
+                float inverse = length > 0.0f ? 1.0f / length : 0.0f;
+                row.nx[i] = nx * inverse;
+                row.ny[i] = ny * inverse;
+                row.nz[i] = length > 0.0f ? nz * inverse : 1.0f;
+                row.s[i] = u[i];
+                row.t[i] = v[j];
+            }
+            row.interleave(out + (size_t)j * uCount * 8);
+        }
+    }
+
+private:
+    glm::vec3 control[16];
+
+    static void bernstein(float t, float w[4], float dw[4])
+    {
+        float s = 1.0f - t;
+        w[0] = s * s * s;
+        w[1] = 3.0f * s * s * t;
+        w[2] = 3.0f * s * t * t;
+        w[3] = t * t * t;
+        dw[0] = -3.0f * s * s;
+        dw[1] = 3.0f * s * s - 6.0f * s * t;
+        dw[2] = 6.0f * s * t - 3.0f * t * t;
+        dw[3] = 3.0f * t * t;
+    }
+};
+
+// evaluates the surface on a (uCount) x (vCount) grid, row blocks in parallel when 'pool' is set
+// and the grid is large enough
+inline void evaluateGrid(const ParametricSurface& surface, const std::vector<float>& u, const std::vector<float>& v, float* out, ThreadPool* pool)
+{
+    int uCount = (int)u.size(), vCount = (int)v.size();
+    int rowsPerTask = std::max(1, PARAMETRIC_TASK_VERTICES / uCount);
+    if (!pool || vCount <= rowsPerTask)
+    {
+        surface.evaluate(u.data(), uCount, v.data(), vCount, out);
+        return;
+    }
+    std::vector<std::future<void> > tasks;
+    for (int first = 0; first < vCount; first += rowsPerTask)
+    {
+        int count = std::min(rowsPerTask, vCount - first);
+        tasks.push_back(pool->submit([&surface, &u, &v, out, uCount, first, count]()
+        {
+            surface.evaluate(u.data(), uCount, v.data() + first, count, out + (size_t)first * uCount * 8);
+        }));
+    }
+    for (std::future<void>& task : tasks)
+        task.wait();
+}
+
+// (count + 1) parameters from 0 to 1, or the 'count' midpoints between them
+inline std::vector<float> parameterSteps(int count, bool midpoints)
+{
+    std::vector<float> steps(midpoints ? count : count + 1);
+    for (size_t i = 0; i < steps.size(); i++)
+        steps[i] = ((float)i + (midpoints ? 0.5f : 0.0f)) / (float)count;
+    return steps;
+}
+
+// triangle with a (near) zero area, e.g. at the pole of a sphere, where a grid row collapses
+inline bool isDegenerateTriangle(const IndexedMesh& mesh, uint32_t a, uint32_t b, uint32_t c)
+{
+    glm::vec3 e1 = mesh.position(b) - mesh.position(a), e2 = mesh.position(c) - mesh.position(a);
+    float area2 = glm::length(glm::cross(e1, e2));
+    return area2 <= 1e-5f * std::max(glm::dot(e1, e1), glm::dot(e2, e2));
+}
+
+// (columns + 1) x (rows + 1) vertices, two triangles per grid cell without the degenerate ones;
+// the first and last column meet at the seam of closed surfaces with different texture coordinates
+inline IndexedMesh tessellateSurface(const ParametricSurface& surface, int columns, int rows, ThreadPool* pool = NULL)
+{
+    IndexedMesh mesh;
+    mesh.floatsPerVertex = 8;
+    mesh.vertices.resize((size_t)(columns + 1) * (rows + 1) * 8);
+    evaluateGrid(surface, parameterSteps(columns, false), parameterSteps(rows, false), mesh.vertices.data(), pool);
+    mesh.indices.reserve((size_t)columns * rows * 6);
+    for (int j = 0; j < rows; j++)
+    {
+        for (int i = 0; i < columns; i++)
+        {
+            // a--c
+            // | /|
+            // |/ |
+            // b--d
+            uint32_t a = j * (columns + 1) + i, b = a + columns + 1, c = a + 1, d = b + 1;
+            if (!isDegenerateTriangle(mesh, a, b, c))
+                mesh.indices.insert(mesh.indices.end(), { a, b, c });
+            if (!isDegenerateTriangle(mesh, c, b, d))
+                mesh.indices.insert(mesh.indices.end(), { c, b, d });
+        }
+    }
+    return mesh;
+}
+
+// largest distance between the tessellated grid and the surface, measured at the cell centers
+// against the average of the cell's corners
+inline float tessellationError(const ParametricSurface& surface, const IndexedMesh& grid, int columns, int rows)
+{
+    std::vector<float> centers((size_t)columns * rows * 8);
+    evaluateGrid(surface, parameterSteps(columns, true), parameterSteps(rows, true), centers.data(), NULL);
+    float error = 0.0f;
+    for (int j = 0; j < rows; j++)
+    {
+        for (int i = 0; i < columns; i++)
+        {
+            uint32_t a = j * (columns + 1) + i, b = a + columns + 1;
+            glm::vec3 corners = (grid.position(a) + grid.position(a + 1) + grid.position(b) + grid.position(b + 1)) * 0.25f;
+            const float* center = centers.data() + ((size_t)j * columns + i) * 8;
+            error = std::max(error, glm::length(glm::vec3(center[0], center[1], center[2]) - corners));
+        }
+    }
+    return error;
+}
+
+// the point of barycentric weights (k, i, j) / frequency on a face: the terms are added in the
+// order of the corners' indices, so a vertex on an edge shared by two faces comes out bitwise
+// identical from both and deduplicateVertices merges them
+inline glm::vec3 icosahedronFacePoint(const glm::vec3* corners, const int* face, int k, int i, int j, int frequency)
+{
+    int order[3] = { 0, 1, 2 };
+    std::sort(order, order + 3, [face](int x, int y) { return face[x] < face[y]; });
+    const int weights[3] = { k, i, j };
+    glm::vec3 p(0.0f);
+    for (int n = 0; n < 3; n++)
+        p += corners[face[order[n]]] * ((float)weights[order[n]] / (float)frequency);
+    return glm::normalize(p);
+}
+
+// icosahedron whose faces are split into frequency^2 triangles each, projected on the sphere;
+// the faces are tessellated in parallel when 'pool' is set. Texture coordinates are the spherical
+// mapping of the direction (the seam isn't split, so a texture wraps across one column of triangles)
+inline IndexedMesh tessellateIcosphere(float radius, int frequency, ThreadPool* pool = NULL)
+{
+    const float a = 1.0f, b = (1.0f + std::sqrt(5.0f)) * 0.5f;
+    glm::vec3 corners[12] =
+    {
+        glm::vec3(-a,  b, 0), glm::vec3( a,  b, 0), glm::vec3(-a, -b, 0), glm::vec3( a, -b, 0),
+        glm::vec3( 0, -a, b), glm::vec3( 0,  a, b), glm::vec3( 0, -a, -b), glm::vec3( 0,  a, -b),
+        glm::vec3( b,  0, -a), glm::vec3( b,  0, a), glm::vec3(-b,  0, -a), glm::vec3(-b,  0, a)
+    };
+    static const int faces[20][3] =
+    {
+        { 0, 11, 5 }, { 0, 5, 1 }, { 0, 1, 7 }, { 0, 7, 10 }, { 0, 10, 11 },
+        { 1, 5, 9 }, { 5, 11, 4 }, { 11, 10, 2 }, { 10, 7, 6 }, { 7, 1, 8 },
+        { 3, 9, 4 }, { 3, 4, 2 }, { 3, 2, 6 }, { 3, 6, 8 }, { 3, 8, 9 },
+        { 4, 9, 5 }, { 2, 4, 11 }, { 6, 2, 10 }, { 8, 6, 7 }, { 9, 8, 1 }
+    };
+    const size_t faceVertices = (size_t)(frequency + 1) * (frequency + 2) / 2;
+    IndexedMesh mesh;
+    mesh.floatsPerVertex = 8;
+    mesh.vertices.resize(20 * faceVertices * 8);
+    // row i of a face holds the points i steps from the first corner towards the second
+    auto faceVertex = [frequency](int i, int j) { return (uint32_t)(i * (frequency + 1) - i * (i - 1) / 2 + j); };
+    auto tessellateFace = [&](int f)
+    {
+        float* out = mesh.vertices.data() + f * faceVertices * 8;
+        for (int i = 0; i <= frequency; i++)
+        {
+            for (int j = 0; i + j <= frequency; j++, out += 8)
+            {
+                glm::vec3 n = icosahedronFacePoint(corners, faces[f], frequency - i - j, i, j, frequency);
+                out[0] = radius * n.x;
+                out[1] = radius * n.y;
+                out[2] = radius * n.z;
+                out[3] = n.x;
+                out[4] = n.y;
+                out[5] = n.z;
+                out[6] = 0.5f + std::atan2(n.y, n.x) / glm::two_pi<float>();
+                out[7] = std::acos(glm::clamp(n.z, -1.0f, 1.0f)) / glm::pi<float>();
+            }
+        }
+    };
+    if (pool && 20 * faceVertices > (size_t)PARAMETRIC_TASK_VERTICES)
+    {
+        std::vector<std::future<void> > tasks;
+        for (int f = 0; f < 20; f++)
+            tasks.push_back(pool->submit([&tessellateFace, f]() { tessellateFace(f); }));
+        for (std::future<void>& task : tasks)
+            task.wait();
+    }
+    else
+    {
+        for (int f = 0; f < 20; f++)
+            tessellateFace(f);
+    }
+    mesh.indices.reserve(20 * (size_t)frequency * frequency * 3);
+    for (int f = 0; f < 20; f++)
+    {
+        uint32_t first = (uint32_t)(f * faceVertices);
+        for (int i = 0; i < frequency; i++)
+        {
+            for (int j = 0; i + j < frequency; j++)
+            {
+                uint32_t p = first + faceVertex(i, j), q = first + faceVertex(i + 1, j), r = first + faceVertex(i, j + 1);
+                mesh.indices.insert(mesh.indices.end(), { p, q, r });
+                if (i + j + 1 < frequency)
+                    mesh.indices.insert(mesh.indices.end(), { q, first + faceVertex(i + 1, j + 1), r });
+            }
+        }
+    }
+    deduplicateVertices(mesh);
+    return mesh;
+}
+
+// largest distance between the icosphere's triangles and the sphere, at the triangle centers
+inline float icosphereError(const IndexedMesh& mesh, float radius)
+{
+    float error = 0.0f;
+    for (size_t t = 0; t < mesh.indices.size(); t += 3)
+    {
+        glm::vec3 center = (mesh.position(mesh.indices[t]) + mesh.position(mesh.indices[t + 1]) + mesh.position(mesh.indices[t + 2])) / 3.0f;
+        error = std::max(error, radius - glm::length(center));
+    }
+    return error;
+}
+
+// levels of detail of one surface in one vertex and index buffer, the finest first; the indices
+// of every level are absolute, a level is drawn with its index range alone
+struct LodMesh
+{
+    struct Level
+    {
+        uint32_t firstIndex;
+        uint32_t indexCount;
+        uint32_t firstVertex;
+        uint32_t vertexCount;
+        float error; // largest distance to the true surface, object space
+    };
+
+    IndexedMesh mesh;
+    std::vector<Level> levels;
+
+    LodMesh()
+    {
+        mesh.floatsPerVertex = 8;
+    }
+
+    // optimizes the level (optimizeMesh) and appends it after the levels added before, finest first
+    void add(IndexedMesh level, float error)
+    {
+        level = optimizeMesh(NULL, level);
+        Level range = { (uint32_t)mesh.indices.size(), (uint32_t)level.indices.size(), (uint32_t)mesh.vertexCount(), (uint32_t)level.vertexCount(), error };
+        for (uint32_t index : level.indices)
+            mesh.indices.push_back(range.firstVertex + index);
+        mesh.vertices.insert(mesh.vertices.end(), level.vertices.begin(), level.vertices.end());
+        levels.push_back(range);
+    }
+
+    size_t triangleCount(size_t level) const
+    {
+        return levels[level].indexCount / 3;
+    }
+
+    // byte offset of a level in the index buffer for glDrawElements
+    const void* indexOffset(size_t level, GLenum indexType) const
+    {
+        return (const void*)((size_t)levels[level].firstIndex * (indexType == GL_UNSIGNED_SHORT ? 2 : 4));
+    }
+
+    void print(const char* name) const
+    {
+        std::cout << "lods " << name << ": " << mesh.vertexCount() << " vertices";
+        for (size_t i = 0; i < levels.size(); i++)
+            std::cout << (i == 0 ? ", " : " | ") << triangleCount(i) << " triangles error " << levels[i].error;
+        std::cout << std::endl;
+    }
+};
+
+// a chain of grid tessellations, 'sizes' holds columns x rows per level from fine to coarse
+inline LodMesh surfaceLods(const ParametricSurface& surface, const std::vector<glm::ivec2>& sizes, ThreadPool* pool = NULL)
+{
+    LodMesh lods;
+    for (const glm::ivec2& size : sizes)
+    {
+        IndexedMesh level = tessellateSurface(surface, size.x, size.y, pool);
+        lods.add(level, tessellationError(surface, level, size.x, size.y));
+    }
+    return lods;
+}
+
+inline LodMesh icosphereLods(float radius, const std::vector<int>& frequencies, ThreadPool* pool = NULL)
+{
+    LodMesh lods;
+    for (int frequency : frequencies)
+    {
+        IndexedMesh level = tessellateIcosphere(radius, frequency, pool);
+        lods.add(level, icosphereError(level, radius));
+    }
+    return lods;
+}
+#endif
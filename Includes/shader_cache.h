@@ -0,0 +1,144 @@
+#ifndef SHADER_CACHE_H
+#define SHADER_CACHE_H
+
+#include <glad/glad.h>
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <iomanip>
+#include <cstdint>
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+// On-disk cache of linked program binaries (glGetProgramBinary/glProgramBinary).
+// Entries are keyed by a hash of the preprocessed shader sources plus the GL vendor,
+// renderer and version strings, so a driver update or a shader edit simply misses the
+// cache. A binary the driver rejects is ignored and the program is compiled from source.
+class ShaderCache
+{
+public:
+    // directory the binaries are stored in (relative to the working directory)
+    static const char* directory()
+    {
+        return "shader_cache";
+    }
+
+    // caching can be turned off, e.g. with --no-shader-cache to measure cold startup
+    static bool& enabled()
+    {
+        static bool isEnabled = true;
+        return isEnabled;
+    }
+
+    static bool isSupported()
+    {
+        if (!enabled() || glProgramBinary == NULL || glGetProgramBinary == NULL)
+            return false;
+        GLint formats = 0;
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+        return formats > 0;
+    }
+
+    // builds the cache key of a program from its preprocessed sources and the driver strings
+    static std::string makeKey(const std::string& vertexCode, const std::string& fragmentCode)
+    {
+        uint64_t hash = 14695981039346656037ull; // FNV-1a
+        hashString(hash, vertexCode);
+        hashString(hash, fragmentCode);
+        hashString(hash, (const char*)glGetString(GL_VENDOR));
+        hashString(hash, (const char*)glGetString(GL_RENDERER));
+        hashString(hash, (const char*)glGetString(GL_VERSION));
+        std::stringstream key;
+        key << std::hex << std::setw(16) << std::setfill('0') << hash;
+        return key.str();
+    }
+
+    // loads the cached binary into 'program', returns false on a miss or when the driver rejects it
+    static bool load(GLuint program, const std::string& key)
+    {
+        if (!isSupported())
+            return false;
+        std::ifstream file(path(key), std::ios::binary);
+        if (!file)
+            return false;
+
+        uint32_t format = 0, length = 0;
+        file.read(reinterpret_cast<char*>(&format), sizeof(format));
+        file.read(reinterpret_cast<char*>(&length), sizeof(length));
+        std::vector<char> binary(length);
+        file.read(binary.data(), length);
+        if (!file || length == 0)
+            return false;
+
+        glProgramBinary(program, (GLenum)format, binary.data(), (GLsizei)length);
+        GLint success = GL_FALSE;
+        glGetProgramiv(program, GL_LINK_STATUS, &success);
+        if (!success)
+            std::cout << "SHADER_CACHE::BINARY_REJECTED: " << key << ", compiling from source" << std::endl;
+        return success == GL_TRUE;
+    }
+
+    // writes the binary of a successfully linked program to the cache
+    static void store(GLuint program, const std::string& key)
+    {
+        if (!isSupported())
+            return;
+        GLint success = GL_FALSE, length = 0;
+        glGetProgramiv(program, GL_LINK_STATUS, &success);
+        glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+        if (!success || length <= 0)
+            return;
+
+        std::vector<char> binary(length);
+        GLenum format = 0;
+        glGetProgramBinary(program, length, NULL, &format, binary.data());
+
+        makeDirectory(directory());
+        std::ofstream file(path(key), std::ios::binary | std::ios::trunc);
+        uint32_t format32 = (uint32_t)format, length32 = (uint32_t)length;
+        file.write(reinterpret_cast<const char*>(&format32), sizeof(format32));
+        file.write(reinterpret_cast<const char*>(&length32), sizeof(length32));
+        file.write(binary.data(), length);
+        if (!file)
+            std::cout << "SHADER_CACHE::WRITE_FAILED: " << path(key) << std::endl;
+    }
+
+private:
+    static std::string path(const std::string& key)
+    {
+        return std::string(directory()) + "/" + key + ".bin";
+    }
+
+    static void hashString(uint64_t& hash, const std::string& text)
+    {
+        for (unsigned char c : text)
+        {
+            hash ^= c;
+            hash *= 1099511628211ull;
+        }
+        // separator so that ("ab", "c") and ("a", "bc") hash differently
+        hash ^= 0xff;
+        hash *= 1099511628211ull;
+    }
+    static void hashString(uint64_t& hash, const char* text)
+    {
+        hashString(hash, std::string(text != NULL ? text : ""));
+    }
+
+    static void makeDirectory(const char* name)
+    {
+#ifdef _WIN32
+        _mkdir(name);
+#else
+        mkdir(name, 0755);
+#endif
+    }
+};
+#endif
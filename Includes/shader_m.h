@@ -4,7 +4,14 @@
 #include <glad/glad.h>
 #include <glm/glm.hpp>
 
+#include <shader_cache.h>
+#include <gl_state.h>
+
 #include <string>
+#include <unordered_map>
+#include <mutex>
+#include <vector>
+#include <cstring>
 #include <fstream>
 #include <sstream>
 #include <iostream>
@@ -12,133 +19,294 @@
 class Shader
 {
 public:
+    // typed handle to a uniform location, resolved once after linking so the
+    // render loop can upload values without any string lookups
+    struct Uniform
+    {
+        GLint location = -1;
+        int slot = -1; // index of the value shadow (one per location)
+        bool isValid() const { return location >= 0; }
+    };
+    // reflection data of one active uniform
+    struct UniformInfo
+    {
+        std::string name;
+        GLenum type;
+        GLint location;
+    };
+    // number of uniform uploads sent to the driver and skipped because the value didn't change
+    struct UploadStats
+    {
+        unsigned int uploaded = 0;
+        unsigned int skipped = 0;
+    };
+
     unsigned int ID;
-    // constructor generates the shader on the fly
+    // constructor generates the shader on the fly; 'defines' ("#define X\n" lines)
+    // are injected into both stages right after the #version line
     // ------------------------------------------------------------------------
-    Shader(const char* vertexPath, const char* fragmentPath)
+    Shader(const char* vertexPath, const char* fragmentPath, const std::string &defines = std::string())
+        : vertexPath(vertexPath), fragmentPath(fragmentPath), defines(defines)
     {
         // 1. retrieve the vertex/fragment source code from filePath
         std::string vertexCode;
         std::string fragmentCode;
-        std::ifstream vShaderFile;
-        std::ifstream fShaderFile;
-        // ensure ifstream objects can throw exceptions:
-        vShaderFile.exceptions (std::ifstream::failbit | std::ifstream::badbit);
-        fShaderFile.exceptions (std::ifstream::failbit | std::ifstream::badbit);
+        readSources(vertexCode, fragmentCode, &sourceFiles);
+        // 2. load the linked program from the binary cache or compile it from source
+        std::string cacheKey = ShaderCache::makeKey(vertexCode, fragmentCode);
+        ID = glCreateProgram();
+        if (!ShaderCache::load(ID, cacheKey))
+        {
+            glDeleteProgram(ID);
+            ID = compileProgram(vertexCode, fragmentCode);
+            ShaderCache::store(ID, cacheKey);
+        }
+        // 3. read the active uniforms once so lookups never reach the driver
+        cacheUniformLocations();
+    }
+    // reads the preprocessed sources of both stages again (no GL calls, safe on any thread);
+    // 'files' receives every file that was read, includes too
+    // ------------------------------------------------------------------------
+    bool readSources(std::string &vertexCode, std::string &fragmentCode, std::vector<std::string>* files = NULL) const
+    {
         try 
         {
-            // open files
-            vShaderFile.open(vertexPath);
-            fShaderFile.open(fragmentPath);
-            std::stringstream vShaderStream, fShaderStream;
-            // read file's buffer contents into streams
-            vShaderStream << vShaderFile.rdbuf();
-            fShaderStream << fShaderFile.rdbuf();		
-            // close file handlers
-            vShaderFile.close();
-            fShaderFile.close();
-            // convert stream into string
-            vertexCode = vShaderStream.str();
-            fragmentCode = fShaderStream.str();			
+            vertexCode = injectDefines(readShaderSource(vertexPath, files), defines);
+            fragmentCode = injectDefines(readShaderSource(fragmentPath, files), defines);
+            return true;
         }
         catch (std::ifstream::failure& e)
         {
             std::cout << "ERROR::SHADER::FILE_NOT_SUCCESSFULLY_READ: " << e.what() << std::endl;
+            return false;
         }
-        const char* vShaderCode = vertexCode.c_str();
-        const char * fShaderCode = fragmentCode.c_str();
-        // 2. compile shaders
-        unsigned int vertex, fragment;
-        // vertex shader
-        vertex = glCreateShader(GL_VERTEX_SHADER);
-        glShaderSource(vertex, 1, &vShaderCode, NULL);
-        glCompileShader(vertex);
-        checkCompileErrors(vertex, "VERTEX");
-        // fragment Shader
-        fragment = glCreateShader(GL_FRAGMENT_SHADER);
-        glShaderSource(fragment, 1, &fShaderCode, NULL);
-        glCompileShader(fragment);
-        checkCompileErrors(fragment, "FRAGMENT");
-        // shader Program
-        ID = glCreateProgram();
-        glAttachShader(ID, vertex);
-        glAttachShader(ID, fragment);
-        glLinkProgram(ID);
-        checkCompileErrors(ID, "PROGRAM");
-        // delete the shaders as they're linked into our program now and no longer necessary
-        glDeleteShader(vertex);
-        glDeleteShader(fragment);
-
     }
-    // activate the shader
+    // reads a shader file and the files it includes ahead of time (any thread, e.g. a worker
+    // during startup); shaders built afterwards use the text instead of opening the files
+    // ------------------------------------------------------------------------
+    static void preloadSource(const std::string &path)
+    {
+        std::string text;
+        try
+        {
+            text = readFile(path);
+        }
+        catch (std::ifstream::failure&)
+        {
+            return; // reported when the shader is built
+        }
+        {
+            std::lock_guard<std::mutex> lock(preloadedSourcesMutex());
+            preloadedSources()[path] = text;
+        }
+        std::istringstream lines(text);
+        std::string line;
+        while (std::getline(lines, line))
+        {
+            std::string include = includePath(path, line);
+            if (!include.empty())
+                preloadSource(include);
+        }
+    }
+    // drops the preloaded files, later builds (hot reload) read the files from disk again
+    // ------------------------------------------------------------------------
+    static void clearPreloadedSources()
+    {
+        std::lock_guard<std::mutex> lock(preloadedSourcesMutex());
+        preloadedSources().clear();
+    }
+    // files the program was built from, includes too
+    // ------------------------------------------------------------------------
+    const std::vector<std::string>& getSourceFiles() const
+    {
+        return sourceFiles;
+    }
+    // replaces the program with a newly linked one (hot reload); uniform handles
+    // resolved from the old program have to be resolved again
+    // ------------------------------------------------------------------------
+    void swapProgram(GLuint program)
+    {
+        glDeleteProgram(ID);
+        ID = program;
+        // the deleted name may be reused by the driver, don't trust the cached binding
+        glState().invalidate();
+        cacheUniformLocations();
+    }
+    // activate the shader (skipped by the state cache if it is already active)
     // ------------------------------------------------------------------------
     void use() const
     { 
-        glUseProgram(ID); 
+        glState().useProgram(ID); 
+    }
+    // binds a uniform block of the program to a fixed binding point shared with a UBO
+    // ------------------------------------------------------------------------
+    void bindUniformBlock(const std::string &name, GLuint bindingPoint) const
+    {
+        GLuint index = glGetUniformBlockIndex(ID, name.c_str());
+        if (index != GL_INVALID_INDEX)
+            glUniformBlockBinding(ID, index, bindingPoint);
+    }
+    // active uniforms of the program as reported by the driver after linking
+    // ------------------------------------------------------------------------
+    const std::vector<UniformInfo>& getActiveUniforms() const
+    {
+        return activeUniforms;
+    }
+    // returns the handle of an active uniform (invalid handle if the name isn't active)
+    // ------------------------------------------------------------------------
+    Uniform uniform(const std::string &name) const
+    {
+        auto it = uniformLocations.find(name);
+        return it != uniformLocations.end() ? it->second : Uniform();
+    }
+    // upload counters of all shaders, reset by the caller (e.g. once per frame)
+    // ------------------------------------------------------------------------
+    static UploadStats& uploadStats()
+    {
+        static UploadStats stats;
+        return stats;
+    }
+    // utility uniform functions taking a resolved handle (hot path); a value equal to
+    // the last one uploaded to the same location is not sent to the driver again
+    // ------------------------------------------------------------------------
+    void setBool(Uniform u, bool value) const
+    {
+        int i = (int)value;
+        if (changed(u, i))
+            glUniform1i(u.location, i);
     }
-    // utility uniform functions
+    // ------------------------------------------------------------------------
+    void setInt(Uniform u, int value) const
+    {
+        if (changed(u, value))
+            glUniform1i(u.location, value);
+    }
+    // ------------------------------------------------------------------------
+    void setFloat(Uniform u, float value) const
+    {
+        if (changed(u, value))
+            glUniform1f(u.location, value);
+    }
+    // ------------------------------------------------------------------------
+    void setVec2(Uniform u, const glm::vec2 &value) const
+    {
+        if (changed(u, value))
+            glUniform2fv(u.location, 1, &value[0]);
+    }
+    void setVec2(Uniform u, float x, float y) const
+    {
+        setVec2(u, glm::vec2(x, y));
+    }
+    // ------------------------------------------------------------------------
+    void setUvec2(Uniform u, const glm::uvec2 &value) const
+    {
+        if (changed(u, value))
+            glUniform2uiv(u.location, 1, &value[0]);
+    }
+    // ------------------------------------------------------------------------
+    void setVec3(Uniform u, const glm::vec3 &value) const
+    {
+        if (changed(u, value))
+            glUniform3fv(u.location, 1, &value[0]);
+    }
+    void setVec3(Uniform u, float x, float y, float z) const
+    {
+        setVec3(u, glm::vec3(x, y, z));
+    }
+    // ------------------------------------------------------------------------
+    void setVec4(Uniform u, const glm::vec4 &value) const
+    {
+        if (changed(u, value))
+            glUniform4fv(u.location, 1, &value[0]);
+    }
+    void setVec4(Uniform u, float x, float y, float z, float w) const
+    {
+        setVec4(u, glm::vec4(x, y, z, w));
+    }
+    // ------------------------------------------------------------------------
+    void setMat2(Uniform u, const glm::mat2 &mat) const
+    {
+        if (changed(u, mat))
+            glUniformMatrix2fv(u.location, 1, GL_FALSE, &mat[0][0]);
+    }
+    // ------------------------------------------------------------------------
+    void setMat3(Uniform u, const glm::mat3 &mat) const
+    {
+        if (changed(u, mat))
+            glUniformMatrix3fv(u.location, 1, GL_FALSE, &mat[0][0]);
+    }
+    // ------------------------------------------------------------------------
+    void setMat4(Uniform u, const glm::mat4 &mat) const
+    {
+        if (changed(u, mat))
+            glUniformMatrix4fv(u.location, 1, GL_FALSE, &mat[0][0]);
+    }
+    // utility uniform functions taking a name (resolved through the cached locations)
     // ------------------------------------------------------------------------
     void setBool(const std::string &name, bool value) const
     {         
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value); 
+        setBool(uniform(name), value);
     }
     // ------------------------------------------------------------------------
     void setInt(const std::string &name, int value) const
     { 
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), value); 
+        setInt(uniform(name), value);
     }
     // ------------------------------------------------------------------------
     void setFloat(const std::string &name, float value) const
     { 
-        glUniform1f(glGetUniformLocation(ID, name.c_str()), value); 
+        setFloat(uniform(name), value);
     }
     // ------------------------------------------------------------------------
     void setVec2(const std::string &name, const glm::vec2 &value) const
     { 
-        glUniform2fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]); 
+        setVec2(uniform(name), value);
     }
     void setVec2(const std::string &name, float x, float y) const
     { 
-        glUniform2f(glGetUniformLocation(ID, name.c_str()), x, y); 
+        setVec2(uniform(name), x, y);
+    }
+    // ------------------------------------------------------------------------
+    void setUvec2(const std::string &name, const glm::uvec2 &value) const
+    { 
+        setUvec2(uniform(name), value);
     }
     // ------------------------------------------------------------------------
     void setVec3(const std::string &name, const glm::vec3 &value) const
     { 
-        glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]); 
+        setVec3(uniform(name), value);
     }
     void setVec3(const std::string &name, float x, float y, float z) const
     { 
-        glUniform3f(glGetUniformLocation(ID, name.c_str()), x, y, z); 
+        setVec3(uniform(name), x, y, z);
     }
     // ------------------------------------------------------------------------
     void setVec4(const std::string &name, const glm::vec4 &value) const
     { 
-        glUniform4fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]); 
+        setVec4(uniform(name), value);
     }
     void setVec4(const std::string &name, float x, float y, float z, float w) const
     { 
-        glUniform4f(glGetUniformLocation(ID, name.c_str()), x, y, z, w); 
+        setVec4(uniform(name), x, y, z, w);
     }
     // ------------------------------------------------------------------------
     void setMat2(const std::string &name, const glm::mat2 &mat) const
     {
-        glUniformMatrix2fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        setMat2(uniform(name), mat);
     }
     // ------------------------------------------------------------------------
     void setMat3(const std::string &name, const glm::mat3 &mat) const
     {
-        glUniformMatrix3fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        setMat3(uniform(name), mat);
     }
     // ------------------------------------------------------------------------
     void setMat4(const std::string &name, const glm::mat4 &mat) const
     {
-        glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, &mat[0][0]);
+        setMat4(uniform(name), mat);
     }
-
-private:
-    // utility function for checking shader compilation/linking errors.
+    // utility function for checking shader compilation/linking errors, returns false on failure.
     // ------------------------------------------------------------------------
-    void checkCompileErrors(GLuint shader, std::string type)
+    static bool checkCompileErrors(GLuint shader, std::string type)
     {
         GLint success;
         GLchar infoLog[1024];
@@ -160,6 +328,215 @@ private:
                 std::cout << "ERROR::PROGRAM_LINKING_ERROR of type: " << type << "\n" << infoLog << "\n -- --------------------------------------------------- -- " << std::endl;
             }
         }
+        return success == GL_TRUE;
+    }
+
+private:
+    // last value uploaded to one uniform location
+    struct UniformShadow
+    {
+        size_t size;
+        unsigned char bytes[sizeof(glm::mat4)];
+    };
+
+    std::string vertexPath;
+    std::string fragmentPath;
+    std::string defines;
+    std::vector<std::string> sourceFiles;
+    std::unordered_map<std::string, Uniform> uniformLocations;
+    std::vector<UniformInfo> activeUniforms;
+    mutable std::vector<UniformShadow> uniformShadows;
+
+    // compares a value with the shadow of its location; returns true (and updates
+    // the shadow) if it has to be uploaded
+    // ------------------------------------------------------------------------
+    template<typename T>
+    bool changed(Uniform u, const T& value) const
+    {
+        static_assert(sizeof(T) <= sizeof(UniformShadow::bytes), "uniform value too large for the shadow");
+        if (!u.isValid())
+            return false;
+        if (u.slot < 0)
+            return true;
+        UniformShadow& shadow = uniformShadows[u.slot];
+        if (shadow.size == sizeof(T) && std::memcmp(shadow.bytes, &value, sizeof(T)) == 0)
+        {
+            uploadStats().skipped++;
+            return false;
+        }
+        std::memcpy(shadow.bytes, &value, sizeof(T));
+        shadow.size = sizeof(T);
+        uploadStats().uploaded++;
+        return true;
+    }
+
+    // compiles and links a program from source
+    // ------------------------------------------------------------------------
+    static GLuint compileProgram(const std::string &vertexCode, const std::string &fragmentCode)
+    {
+        const char* vShaderCode = vertexCode.c_str();
+        const char * fShaderCode = fragmentCode.c_str();
+        unsigned int vertex, fragment;
+        // vertex shader
+        vertex = glCreateShader(GL_VERTEX_SHADER);
+        glShaderSource(vertex, 1, &vShaderCode, NULL);
+        glCompileShader(vertex);
+        checkCompileErrors(vertex, "VERTEX");
+        // fragment Shader
+        fragment = glCreateShader(GL_FRAGMENT_SHADER);
+        glShaderSource(fragment, 1, &fShaderCode, NULL);
+        glCompileShader(fragment);
+        checkCompileErrors(fragment, "FRAGMENT");
+        // shader Program
+        GLuint program = glCreateProgram();
+        glAttachShader(program, vertex);
+        glAttachShader(program, fragment);
+        // the linked binary is written to the shader cache afterwards
+        if (ShaderCache::isSupported())
+            glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+        glLinkProgram(program);
+        checkCompileErrors(program, "PROGRAM");
+        // delete the shaders as they're linked into our program now and no longer necessary
+        glDeleteShader(vertex);
+        glDeleteShader(fragment);
+        return program;
+    }
+
+    // reads a shader file, expanding '#include "file"' lines (resolved relative to the including file)
+    // ------------------------------------------------------------------------
+    static std::string readShaderSource(const std::string &path, std::vector<std::string>* files = NULL)
+    {
+        std::string text;
+        if (!findPreloadedSource(path, text))
+            text = readFile(path);
+        if (files != NULL)
+            files->push_back(path);
+
+        std::istringstream lines(text);
+        std::string source, line;
+        while (std::getline(lines, line))
+        {
+            std::string include = includePath(path, line);
+            if (!include.empty())
+                source += readShaderSource(include, files);
+            else
+                source += line + "\n";
+        }
+        return source;
+    }
+    // ------------------------------------------------------------------------
+    static std::string readFile(const std::string &path)
+    {
+        std::ifstream file;
+        // ensure ifstream objects can throw exceptions:
+        file.exceptions(std::ifstream::failbit | std::ifstream::badbit);
+        file.open(path);
+        std::stringstream stream;
+        stream << file.rdbuf();
+        file.close();
+        return stream.str();
+    }
+    // returns the path of the file included by an '#include "file"' line, empty for other lines
+    // ------------------------------------------------------------------------
+    static std::string includePath(const std::string &includingPath, const std::string &line)
+    {
+        size_t first = line.find('"');
+        size_t last = line.rfind('"');
+        if (line.compare(0, 8, "#include") != 0 || first == std::string::npos || last <= first)
+            return std::string();
+        std::string directory = includingPath.substr(0, includingPath.find_last_of("/\\") + 1);
+        return directory + line.substr(first + 1, last - first - 1);
+    }
+
+    // file contents read ahead of time by preloadSource()
+    // ------------------------------------------------------------------------
+    static std::unordered_map<std::string, std::string>& preloadedSources()
+    {
+        static std::unordered_map<std::string, std::string> sources;
+        return sources;
+    }
+    static std::mutex& preloadedSourcesMutex()
+    {
+        static std::mutex mutex;
+        return mutex;
+    }
+    static bool findPreloadedSource(const std::string &path, std::string &text)
+    {
+        std::lock_guard<std::mutex> lock(preloadedSourcesMutex());
+        auto it = preloadedSources().find(path);
+        if (it == preloadedSources().end())
+            return false;
+        text = it->second;
+        return true;
+    }
+
+    // inserts the defines after the #version directive (which has to stay the first line)
+    // ------------------------------------------------------------------------
+    static std::string injectDefines(const std::string &source, const std::string &defines)
+    {
+        if (defines.empty())
+            return source;
+        size_t version = source.find("#version");
+        if (version == std::string::npos)
+            return defines + source;
+        size_t lineEnd = source.find('\n', version);
+        if (lineEnd == std::string::npos)
+            return source + "\n" + defines;
+        return source.substr(0, lineEnd + 1) + defines + source.substr(lineEnd + 1);
+    }
+
+    // queries every active uniform of the linked program and stores its location.
+    // array elements are registered individually ("lights[2]") as well as by base name.
+    // every location gets an empty value shadow, so the first upload is always sent
+    // ------------------------------------------------------------------------
+    void cacheUniformLocations()
+    {
+        uniformLocations.clear();
+        activeUniforms.clear();
+        uniformShadows.clear();
+        GLint count = 0, maxLength = 0;
+        glGetProgramiv(ID, GL_ACTIVE_UNIFORMS, &count);
+        glGetProgramiv(ID, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+        std::string name(maxLength > 0 ? maxLength : 1, '\0');
+        for (GLint i = 0; i < count; i++)
+        {
+            GLsizei length = 0;
+            GLint size = 0;
+            GLenum type = 0;
+            glGetActiveUniform(ID, (GLuint)i, maxLength, &length, &size, &type, &name[0]);
+            std::string uniformName(name.c_str(), length);
+            GLint location = glGetUniformLocation(ID, uniformName.c_str());
+            if (location < 0)
+                continue; // uniforms inside blocks have no location
+            uniformLocations[uniformName] = makeUniform(location);
+            activeUniforms.push_back(UniformInfo{ uniformName, type, location });
+
+            // "values[0]" is reported once for the whole array
+            const std::string suffix = "[0]";
+            if (uniformName.size() > suffix.size() && uniformName.compare(uniformName.size() - suffix.size(), suffix.size(), suffix) == 0)
+            {
+                std::string base = uniformName.substr(0, uniformName.size() - suffix.size());
+                uniformLocations[base] = uniformLocations[uniformName];
+                for (GLint element = 1; element < size; element++)
+                {
+                    std::string elementName = base + "[" + std::to_string(element) + "]";
+                    uniformLocations[elementName] = makeUniform(glGetUniformLocation(ID, elementName.c_str()));
+                }
+            }
+        }
+    }
+    // handle of a location with its own value shadow
+    // ------------------------------------------------------------------------
+    Uniform makeUniform(GLint location)
+    {
+        Uniform u;
+        u.location = location;
+        if (location >= 0)
+        {
+            u.slot = (int)uniformShadows.size();
+            uniformShadows.push_back(UniformShadow());
+        }
+        return u;
     }
 };
 #endif
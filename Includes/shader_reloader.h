@@ -0,0 +1,361 @@
+#ifndef SHADER_RELOADER_H
+#define SHADER_RELOADER_H
+
+#include <glad/glad.h>
+
+#include <shader_m.h>
+#include <shader_cache.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <poll.h>
+#include <unistd.h>
+#endif
+
+// GL_KHR_parallel_shader_compile / GL_ARB_parallel_shader_compile, not in the generated glad headers
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
+// Hot reload of shader sources while the app is running.
+// A worker thread watches the files every registered Shader was built from (inotify on
+// Linux, modification times elsewhere) and reads the changed sources. update() on the GL
+// thread starts compiling them and, when the driver supports parallel shader compile,
+// only polls for completion, so the frame doesn't wait for the compiler. A program
+// replaces the old one only after it linked; on errors the old program stays in use.
+class ShaderReloader
+{
+public:
+    explicit ShaderReloader(bool enabled = true) : enabled(enabled), running(enabled), parallelCompile(false)
+    {
+        if (!enabled)
+            return;
+        parallelCompile = hasParallelCompile();
+        worker = std::thread(&ShaderReloader::watchFiles, this);
+    }
+
+    ~ShaderReloader()
+    {
+        running = false;
+        if (worker.joinable())
+            worker.join();
+        for (Compile& compile : compiling)
+            deleteCompile(compile);
+    }
+
+    ShaderReloader(const ShaderReloader&) = delete;
+    ShaderReloader& operator=(const ShaderReloader&) = delete;
+
+    // reloads 'shader' whenever one of its source files changes; onReload runs after the
+    // new program is in place (resolve uniform handles again, bind uniform blocks, ...).
+    // the shader must stay at the same address while it is watched
+    void watch(Shader& shader, std::function<void()> onReload = std::function<void()>())
+    {
+        if (!enabled)
+            return;
+        std::lock_guard<std::mutex> lock(mutex);
+        Entry entry;
+        entry.shader = &shader;
+        entry.files = shader.getSourceFiles();
+        entry.onReload = onReload;
+        entries.push_back(entry);
+    }
+
+    // call once per frame on the GL thread: starts compiling changed sources and swaps in
+    // the programs that finished linking
+    void update()
+    {
+        if (!enabled)
+            return;
+
+        std::vector<Sources> changed;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            changed.swap(readSources);
+        }
+        for (const Sources& sources : changed)
+            startCompile(sources);
+
+        for (size_t i = 0; i < compiling.size(); )
+        {
+            if (parallelCompile)
+            {
+                GLint done = GL_FALSE;
+                glGetProgramiv(compiling[i].program, GL_COMPLETION_STATUS_KHR, &done);
+                if (!done)
+                {
+                    compiling[i].frames++;
+                    i++;
+                    continue;
+                }
+            }
+            finishCompile(compiling[i]);
+            compiling.erase(compiling.begin() + i);
+        }
+    }
+
+    // true if the driver compiles in the background (GL_KHR_parallel_shader_compile)
+    bool isParallel() const
+    {
+        return parallelCompile;
+    }
+
+private:
+    struct Entry
+    {
+        Shader* shader;
+        std::vector<std::string> files;
+        std::function<void()> onReload;
+    };
+    // sources read by the worker, waiting for the GL thread
+    struct Sources
+    {
+        size_t entry;
+        std::string vertexCode;
+        std::string fragmentCode;
+    };
+    // program being compiled/linked by the driver
+    struct Compile
+    {
+        size_t entry;
+        std::string cacheKey;
+        GLuint vertex;
+        GLuint fragment;
+        GLuint program;
+        int frames;
+        std::chrono::steady_clock::time_point start;
+    };
+
+    bool enabled;
+    std::atomic<bool> running;
+    bool parallelCompile;
+    std::thread worker;
+    std::mutex mutex;
+    std::vector<Entry> entries;      // guarded by mutex
+    std::vector<Sources> readSources; // guarded by mutex
+    std::vector<Compile> compiling;  // GL thread only
+
+    static bool hasParallelCompile()
+    {
+        GLint count = 0;
+        glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+        for (GLint i = 0; i < count; i++)
+        {
+            const char* name = (const char*)glGetStringi(GL_EXTENSIONS, (GLuint)i);
+            if (name != NULL && (std::strcmp(name, "GL_KHR_parallel_shader_compile") == 0 || std::strcmp(name, "GL_ARB_parallel_shader_compile") == 0))
+                return true;
+        }
+        return false;
+    }
+
+    // issues the compile and link commands without waiting for their results
+    void startCompile(const Sources& sources)
+    {
+        // a newer edit of the same shader supersedes a compile still in flight
+        for (size_t i = 0; i < compiling.size(); i++)
+        {
+            if (compiling[i].entry == sources.entry)
+            {
+                deleteCompile(compiling[i]);
+                compiling.erase(compiling.begin() + i);
+                break;
+            }
+        }
+
+        Compile compile;
+        compile.entry = sources.entry;
+        compile.cacheKey = ShaderCache::makeKey(sources.vertexCode, sources.fragmentCode);
+        compile.frames = 0;
+        compile.start = std::chrono::steady_clock::now();
+        const char* vShaderCode = sources.vertexCode.c_str();
+        const char* fShaderCode = sources.fragmentCode.c_str();
+        compile.vertex = glCreateShader(GL_VERTEX_SHADER);
+        glShaderSource(compile.vertex, 1, &vShaderCode, NULL);
+        glCompileShader(compile.vertex);
+        compile.fragment = glCreateShader(GL_FRAGMENT_SHADER);
+        glShaderSource(compile.fragment, 1, &fShaderCode, NULL);
+        glCompileShader(compile.fragment);
+        compile.program = glCreateProgram();
+        glAttachShader(compile.program, compile.vertex);
+        glAttachShader(compile.program, compile.fragment);
+        if (ShaderCache::isSupported())
+            glProgramParameteri(compile.program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+        glLinkProgram(compile.program);
+        compiling.push_back(compile);
+    }
+
+    // checks the results of a finished compile and swaps the program in if it linked
+    void finishCompile(Compile& compile)
+    {
+        Entry entry;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            entry = entries[compile.entry];
+        }
+        bool success = Shader::checkCompileErrors(compile.vertex, "VERTEX");
+        success = Shader::checkCompileErrors(compile.fragment, "FRAGMENT") && success;
+        success = success && Shader::checkCompileErrors(compile.program, "PROGRAM");
+        glDeleteShader(compile.vertex);
+        glDeleteShader(compile.fragment);
+        std::string name = entry.files.empty() ? std::string("?") : entry.files[0];
+        name = name.substr(0, name.find_last_of('.')); // "multiple_lights.vs" -> "multiple_lights"
+        if (!success)
+        {
+            glDeleteProgram(compile.program);
+            std::cout << "SHADER_RELOAD::FAILED: " << name << ", keeping the old program" << std::endl;
+            return;
+        }
+
+        entry.shader->swapProgram(compile.program);
+        ShaderCache::store(compile.program, compile.cacheKey);
+        if (entry.onReload)
+            entry.onReload();
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - compile.start).count();
+        std::cout << "SHADER_RELOAD: " << name << " in " << ms << " ms, " << compile.frames << " frames in flight"
+            << (parallelCompile ? "" : " (blocking compile)") << std::endl;
+    }
+
+    static void deleteCompile(Compile& compile)
+    {
+        glDeleteShader(compile.vertex);
+        glDeleteShader(compile.fragment);
+        glDeleteProgram(compile.program);
+    }
+
+    // worker thread: waits for file changes and reads the sources of the affected shaders
+    void watchFiles()
+    {
+#ifdef __linux__
+        int fd = inotify_init1(IN_NONBLOCK);
+        if (fd >= 0)
+        {
+            watchInotify(fd);
+            close(fd);
+            return;
+        }
+#endif
+        watchModificationTimes();
+    }
+
+#ifdef __linux__
+    void watchInotify(int fd)
+    {
+        std::map<int, std::string> directories; // watch descriptor -> directory prefix
+        std::set<std::string> watched;
+        std::vector<char> buffer(16 * 1024);
+        while (running)
+        {
+            // watch the directories of all files (new shaders may have been registered)
+            std::vector<std::string> files = allFiles();
+            for (const std::string& file : files)
+            {
+                std::string directory = file.substr(0, file.find_last_of("/\\") + 1);
+                if (!watched.insert(directory).second)
+                    continue;
+                int wd = inotify_add_watch(fd, directory.empty() ? "." : directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO);
+                if (wd >= 0)
+                    directories[wd] = directory;
+            }
+
+            pollfd descriptor = { fd, POLLIN, 0 };
+            if (poll(&descriptor, 1, 100) <= 0)
+                continue;
+
+            // editors often write several times (or write + rename) per save, collect them all
+            std::set<std::string> changed;
+            do
+            {
+                ssize_t length;
+                while ((length = read(fd, buffer.data(), buffer.size())) > 0)
+                {
+                    for (ssize_t offset = 0; offset < length; )
+                    {
+                        const inotify_event* event = reinterpret_cast<const inotify_event*>(buffer.data() + offset);
+                        if (event->len > 0)
+                            changed.insert(directories[event->wd] + event->name);
+                        offset += sizeof(inotify_event) + event->len;
+                    }
+                }
+            } while (poll(&descriptor, 1, 50) > 0);
+            readChanged(changed);
+        }
+    }
+#endif
+
+    // fallback without inotify: compares the modification times of all files periodically
+    void watchModificationTimes()
+    {
+        std::map<std::string, time_t> times;
+        while (running)
+        {
+            std::set<std::string> changed;
+            std::vector<std::string> files = allFiles();
+            for (const std::string& file : files)
+            {
+                struct stat info;
+                if (stat(file.c_str(), &info) != 0)
+                    continue;
+                std::map<std::string, time_t>::iterator it = times.find(file);
+                if (it != times.end() && it->second != info.st_mtime)
+                    changed.insert(file);
+                times[file] = info.st_mtime;
+            }
+            readChanged(changed);
+            for (int i = 0; i < 5 && running; i++)
+                std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        }
+    }
+
+    std::vector<std::string> allFiles()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::vector<std::string> files;
+        for (const Entry& entry : entries)
+            files.insert(files.end(), entry.files.begin(), entry.files.end());
+        return files;
+    }
+
+    // reads the sources of every shader that uses one of the changed files
+    void readChanged(const std::set<std::string>& changed)
+    {
+        if (changed.empty())
+            return;
+        std::vector<std::pair<size_t, const Shader*> > affected;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            for (size_t i = 0; i < entries.size(); i++)
+                for (const std::string& file : entries[i].files)
+                    if (changed.count(file))
+                    {
+                        affected.push_back(std::make_pair(i, entries[i].shader));
+                        break;
+                    }
+        }
+        for (size_t i = 0; i < affected.size(); i++)
+        {
+            Sources sources;
+            sources.entry = affected[i].first;
+            std::vector<std::string> files;
+            if (!affected[i].second->readSources(sources.vertexCode, sources.fragmentCode, &files))
+                continue;
+            std::lock_guard<std::mutex> lock(mutex);
+            entries[sources.entry].files = files; // includes may have changed
+            readSources.push_back(sources);
+        }
+    }
+};
+#endif
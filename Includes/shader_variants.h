@@ -0,0 +1,118 @@
+#ifndef SHADER_VARIANTS_H
+#define SHADER_VARIANTS_H
+
+#include <shader_m.h>
+#include <lights.h>
+#include <shader_reloader.h>
+
+#include <map>
+#include <string>
+
+// Compile time features of the lit shaders. Each combination is compiled into its own
+// program with matching #defines, so the fragment shaders carry no runtime branches
+// for switches that are constant during a draw.
+enum ShaderFeature
+{
+    SHADER_BLINN      = 1 << 0, // Blinn-Phong instead of Phong specular
+    SHADER_FOG        = 1 << 1, // distance fog
+    SHADER_FLASHLIGHT = 1 << 2, // spotLight[0] (camera flashlight) is on
+    SHADER_INSTANCED  = 1 << 3, // model/normal matrices come from instance attributes
+    SHADER_CLUSTERED  = 1 << 4, // point lights come from the froxel light lists (clusters.h)
+    SHADER_CULLED     = 1 << 5, // lights come from per-draw light lists (light_culling.h)
+    SHADER_SHADOWS    = 1 << 6  // the directional light is shadowed (shadows.h)
+};
+
+// returns the #define block of a feature mask, light counts come from lights.h
+inline std::string shaderFeatureDefines(unsigned int features)
+{
+    std::string defines;
+    defines += "#define NR_POINT_LIGHTS " + std::to_string(NR_POINT_LIGHTS) + "\n";
+    defines += "#define NR_SPOT_LIGHTS " + std::to_string(NR_SPOT_LIGHTS) + "\n";
+    defines += std::string("#define FIRST_SPOT_LIGHT ") + ((features & SHADER_FLASHLIGHT) ? "0" : "1") + "\n";
+    if (features & SHADER_BLINN)
+        defines += "#define BLINN\n";
+    if (features & SHADER_FOG)
+        defines += "#define FOG\n";
+    if (features & SHADER_INSTANCED)
+        defines += "#define INSTANCED\n";
+    if (features & SHADER_CLUSTERED)
+        defines += "#define CLUSTERED\n";
+    if (features & SHADER_CULLED)
+        defines += "#define CULLED\n";
+    if (features & SHADER_SHADOWS)
+        defines += "#define SHADOWS\n";
+    return defines;
+}
+
+// Set of programs built from one vertex/fragment pair, one per feature mask.
+// Variants are compiled on first use and cached by their bitmask; Uniforms is a struct
+// of Shader::Uniform handles constructible from a Shader, resolved once per variant.
+template <typename Uniforms>
+class ShaderVariants
+{
+public:
+    struct Variant
+    {
+        Shader shader;
+        Uniforms uniforms;
+    };
+
+    // supportedFeatures masks out features the shader ignores so they don't create duplicates;
+    // setup is called once on every new program (e.g. to bind uniform blocks)
+    ShaderVariants(const char* vertexPath, const char* fragmentPath, unsigned int supportedFeatures, void (*setup)(const Shader&) = NULL)
+        : vertexPath(vertexPath), fragmentPath(fragmentPath), supportedFeatures(supportedFeatures), setup(setup), reloader(NULL)
+    {
+    }
+
+    Variant& get(unsigned int features)
+    {
+        features &= supportedFeatures;
+        typename std::map<unsigned int, Variant>::iterator it = variants.find(features);
+        if (it == variants.end())
+        {
+            Shader shader(vertexPath.c_str(), fragmentPath.c_str(), shaderFeatureDefines(features));
+            if (setup)
+                setup(shader);
+            it = variants.insert(std::make_pair(features, Variant{ shader, Uniforms(shader) })).first;
+            if (reloader)
+                watchVariant(it->second);
+        }
+        return it->second;
+    }
+
+    // hot-reloads the variants compiled so far and every variant compiled later
+    void watch(ShaderReloader& shaderReloader)
+    {
+        reloader = &shaderReloader;
+        for (typename std::map<unsigned int, Variant>::iterator it = variants.begin(); it != variants.end(); ++it)
+            watchVariant(it->second);
+    }
+
+    // number of programs compiled so far
+    size_t size() const
+    {
+        return variants.size();
+    }
+
+private:
+    std::string vertexPath;
+    std::string fragmentPath;
+    unsigned int supportedFeatures;
+    void (*setup)(const Shader&);
+    std::map<unsigned int, Variant> variants;
+    ShaderReloader* reloader;
+
+    // a reloaded variant runs setup again and resolves its uniform handles from the new program
+    void watchVariant(Variant& variant)
+    {
+        Variant* reloaded = &variant;
+        void (*setupProgram)(const Shader&) = setup;
+        reloader->watch(variant.shader, [reloaded, setupProgram]()
+        {
+            if (setupProgram)
+                setupProgram(reloaded->shader);
+            reloaded->uniforms = Uniforms(reloaded->shader);
+        });
+    }
+};
+#endif
@@ -0,0 +1,650 @@
+#ifndef SHADOWS_H
+#define SHADOWS_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <lights.h>
+#include <light_culling.h>
+#include <uniform_buffer.h>
+#include <gl_state.h>
+#include <benchmark.h>
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+// Cascaded shadow maps of the directional light (H key, SHADOWS shader variants).
+// The view frustum up to the shadow distance is split into cascades, each rendered into
+// one layer of a depth texture array. Static geometry is cached: it is drawn into a
+// separate static array only when a cascade's light projection changes (or invalidate()
+// is called after static objects changed); every frame the static layers are copied into
+// the sampled array and the dynamic objects are drawn on top.
+// Cascades are fitted to a bounding sphere of their frustum slice, whose size only depends
+// on the projection, and their center is snapped to a coarse grid in light space, so the
+// projection stays the same while the camera rotates or moves within a grid cell.
+
+// Spot lights share one shadow atlas (SpotShadowAtlas below): every light gets a square
+// tile sized by how much of the screen its cone covers, and a tile is only redrawn when
+// its light's view changed or a moving caster reached its cone, within a texel budget per frame.
+
+// binding points of the "Shadows" and "SpotShadows" uniform blocks and texture units of the maps
+const unsigned int SHADOWS_BINDING = 3;
+const unsigned int SPOT_SHADOWS_BINDING = 4;
+const unsigned int SHADOW_MAP_UNIT = 8;
+const unsigned int SPOT_SHADOW_ATLAS_UNIT = 9;
+
+// number of cascades, must match NR_SHADOW_CASCADES in shadows.glsl
+const int SHADOW_CASCADES = 3;
+
+// C++ mirror of the "Shadows" uniform block in shadows.glsl (std140 layout)
+struct ShadowUniforms
+{
+    glm::mat4 shadowMatrices[SHADOW_CASCADES]; // view space -> shadow map texture coordinates and depth
+    glm::vec4 splits;                          // far view depth of each cascade
+    glm::vec4 texelSizes;                      // world size of a shadow map texel per cascade
+};
+
+static_assert(sizeof(ShadowUniforms) == SHADOW_CASCADES * 64 + 32, "ShadowUniforms must match std140 layout");
+
+// C++ mirror of the "SpotShadows" uniform block in shadows.glsl (std140 layout)
+struct SpotShadowUniforms
+{
+    glm::mat4 spotShadowMatrices[NR_SPOT_LIGHTS]; // view space -> light clip space the tile was drawn with
+    glm::vec4 spotShadowTiles[NR_SPOT_LIGHTS];    // atlas offset xy and size z (0 - no shadow), w: texel size at distance 1
+};
+
+static_assert(sizeof(SpotShadowUniforms) == NR_SPOT_LIGHTS * 80, "SpotShadowUniforms must match std140 layout");
+
+class CascadedShadowMap
+{
+public:
+    // GPU time of the last static rebuild and of the last per-frame dynamic part
+    struct Stats
+    {
+        double staticMs;
+        double dynamicMs;
+        unsigned int staticLayers;  // static layers rebuilt since the last resetStats()
+        unsigned int frames;
+    };
+
+    UniformBuffer<ShadowUniforms> uniforms;
+
+    CascadedShadowMap(int resolution, float shadowDistance) : uniforms(SHADOWS_BINDING), resolution(resolution), shadowDistance(shadowDistance), stats()
+    {
+        glGenTextures(1, &shadowTexture);
+        glGenTextures(1, &staticTexture);
+        allocate(shadowTexture, true);
+        allocate(staticTexture, false);
+        glGenFramebuffers(1, &FBO);
+        glGenFramebuffers(1, &staticFBO);
+        // depth only, GL 3.3 needs the color buffers turned off for completeness
+        const unsigned int framebuffers[2] = { FBO, staticFBO };
+        for (unsigned int framebuffer : framebuffers)
+        {
+            glBindFramebuffer(GL_FRAMEBUFFER, framebuffer);
+            glDrawBuffer(GL_NONE);
+            glReadBuffer(GL_NONE);
+        }
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glState().invalidate();
+        for (int i = 0; i < SHADOW_CASCADES; i++)
+            cascades[i].lightSpace = glm::mat4(0.0f);
+        invalidate();
+    }
+
+    // fits the cascades to the camera frustum; cascades whose light projection changed
+    // get their static layer rebuilt by the next render()
+    void update(const glm::vec3& lightDirection, const glm::mat4& inverseView, float fovY, float aspect, float zNear)
+    {
+        glm::vec3 direction = glm::normalize(lightDirection);
+        glm::vec3 up = std::abs(direction.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+        glm::mat4 lightView = glm::lookAt(glm::vec3(0.0f), direction, up);
+        float tanY = std::tan(fovY * 0.5f);
+        float tanX = tanY * aspect;
+        float k2 = tanX * tanX + tanY * tanY;
+
+        float sliceNear = zNear;
+        for (int i = 0; i < SHADOW_CASCADES; i++)
+        {
+            // split between a uniform and a logarithmic distribution
+            float t = (i + 1) / (float)SHADOW_CASCADES;
+            float sliceFar = glm::mix(zNear + (shadowDistance - zNear) * t, zNear * std::pow(shadowDistance / zNear, t), 0.75f);
+
+            // bounding sphere of the slice, centered on the view axis
+            float center = std::min((sliceNear + sliceFar) * (1.0f + k2) * 0.5f, sliceFar);
+            float radius = std::sqrt(std::max((center - sliceNear) * (center - sliceNear) + sliceNear * sliceNear * k2,
+                (sliceFar - center) * (sliceFar - center) + sliceFar * sliceFar * k2));
+            radius = std::ceil(radius * 16.0f) / 16.0f;
+
+            // the map covers the sphere plus a margin, its center moves in steps of whole texels
+            float halfSize = radius * 1.25f;
+            float texel = 2.0f * halfSize / resolution;
+            float step = texel * std::max(1.0f, std::floor(radius * 0.25f / texel));
+            glm::vec3 lightCenter = glm::vec3(lightView * inverseView * glm::vec4(0.0f, 0.0f, -center, 1.0f));
+            lightCenter = glm::floor(lightCenter / step + 0.5f) * step;
+            // the depth range reaches CASTER_DISTANCE towards the light for casters outside the slice
+            glm::mat4 projection = glm::ortho(lightCenter.x - halfSize, lightCenter.x + halfSize, lightCenter.y - halfSize, lightCenter.y + halfSize,
+                -(lightCenter.z + halfSize + CASTER_DISTANCE), -(lightCenter.z - halfSize));
+            glm::mat4 lightSpace = projection * lightView;
+
+            if (lightSpace != cascades[i].lightSpace)
+            {
+                cascades[i].lightSpace = lightSpace;
+                cascades[i].isStaticDirty = true;
+            }
+            const glm::mat4 bias = glm::translate(glm::mat4(1.0f), glm::vec3(0.5f)) * glm::scale(glm::mat4(1.0f), glm::vec3(0.5f));
+            uniforms.data.shadowMatrices[i] = bias * lightSpace * inverseView;
+            uniforms.data.splits[i] = sliceFar;
+            uniforms.data.texelSizes[i] = texel;
+            sliceNear = sliceFar;
+        }
+        uniforms.upload();
+    }
+
+    // renders the shadow map; drawStatic/drawDynamic(lightSpace) draw the casters with the
+    // world to light clip space matrix, the depth-only program is bound by the callbacks
+    template<typename DrawStatic, typename DrawDynamic>
+    void render(DrawStatic drawStatic, DrawDynamic drawDynamic)
+    {
+        GLint viewport[4];
+        glGetIntegerv(GL_VIEWPORT, viewport);
+        glViewport(0, 0, resolution, resolution);
+        // depth bias against acne, the shaders add a normal offset on top
+        glEnable(GL_POLYGON_OFFSET_FILL);
+        glPolygonOffset(2.0f, 4.0f);
+
+        bool isRebuilt = false;
+        for (int i = 0; i < SHADOW_CASCADES; i++)
+            isRebuilt = isRebuilt || cascades[i].isStaticDirty;
+        if (isRebuilt)
+        {
+            staticTimer.begin();
+            glBindFramebuffer(GL_FRAMEBUFFER, staticFBO);
+            for (int i = 0; i < SHADOW_CASCADES; i++)
+            {
+                if (!cascades[i].isStaticDirty)
+                    continue;
+                glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, staticTexture, 0, i);
+                glClear(GL_DEPTH_BUFFER_BIT);
+                drawStatic(cascades[i].lightSpace);
+                cascades[i].isStaticDirty = false;
+                stats.staticLayers++;
+            }
+            staticTimer.end();
+        }
+
+        dynamicTimer.begin();
+        for (int i = 0; i < SHADOW_CASCADES; i++)
+        {
+            // copy the cached static depth, then add the dynamic casters
+            glBindFramebuffer(GL_READ_FRAMEBUFFER, staticFBO);
+            glFramebufferTextureLayer(GL_READ_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, staticTexture, 0, i);
+            glBindFramebuffer(GL_DRAW_FRAMEBUFFER, FBO);
+            glFramebufferTextureLayer(GL_DRAW_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, shadowTexture, 0, i);
+            glBlitFramebuffer(0, 0, resolution, resolution, 0, 0, resolution, resolution, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+            glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+            drawDynamic(cascades[i].lightSpace);
+        }
+        dynamicTimer.end();
+        stats.frames++;
+
+        glDisable(GL_POLYGON_OFFSET_FILL);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+    }
+
+    // static casters changed, every static layer is rebuilt by the next render()
+    void invalidate()
+    {
+        for (int i = 0; i < SHADOW_CASCADES; i++)
+            cascades[i].isStaticDirty = true;
+    }
+
+    // binds the shadow map to its texture unit
+    void bind() const
+    {
+        glState().bindTexture(SHADOW_MAP_UNIT, GL_TEXTURE_2D_ARRAY, shadowTexture);
+    }
+
+    const Stats& lastStats()
+    {
+        stats.staticMs = staticTimer.elapsedMs();
+        stats.dynamicMs = dynamicTimer.elapsedMs();
+        return stats;
+    }
+
+    void resetStats()
+    {
+        stats.staticLayers = 0;
+        stats.frames = 0;
+    }
+
+    int size() const
+    {
+        return resolution;
+    }
+
+    void destroy()
+    {
+        GLuint textures[2] = { shadowTexture, staticTexture };
+        GLuint framebuffers[2] = { FBO, staticFBO };
+        glDeleteTextures(2, textures);
+        glDeleteFramebuffers(2, framebuffers);
+        glDeleteBuffers(1, &uniforms.ID);
+        staticTimer.destroy();
+        dynamicTimer.destroy();
+    }
+
+private:
+    // distance behind a cascade (towards the light) that still casts into it
+    static constexpr float CASTER_DISTANCE = 50.0f;
+
+    struct Cascade
+    {
+        glm::mat4 lightSpace;   // world -> light clip space
+        bool isStaticDirty;
+    };
+
+    int resolution;
+    float shadowDistance;
+    unsigned int shadowTexture, staticTexture;
+    unsigned int FBO, staticFBO;
+    Cascade cascades[SHADOW_CASCADES];
+    GpuTimer staticTimer, dynamicTimer;
+    Stats stats;
+
+    // depth array with one layer per cascade; the sampled one compares in hardware (2x2 PCF)
+    void allocate(unsigned int texture, bool isSampled)
+    {
+        glBindTexture(GL_TEXTURE_2D_ARRAY, texture);
+        glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_DEPTH_COMPONENT24, resolution, resolution, SHADOW_CASCADES, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, NULL);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, isSampled ? GL_LINEAR : GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, isSampled ? GL_LINEAR : GL_NEAREST);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
+        glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
+        const float border[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
+        glTexParameterfv(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_BORDER_COLOR, border);
+        if (isSampled)
+        {
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+            glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+        }
+    }
+};
+
+class SpotShadowAtlas
+{
+public:
+    // work of the last render() and totals since the last resetStats()
+    struct Stats
+    {
+        double ms;                  // GPU time of the last frame that redrew tiles
+        unsigned int lights;        // lights with a tile
+        unsigned int atlasTexels;   // texels of all tiles
+        unsigned int updates;       // tiles redrawn since resetStats()
+        unsigned int deferred;      // dirty tiles left for a later frame since resetStats()
+        unsigned int frames;
+    };
+
+    UniformBuffer<SpotShadowUniforms> uniforms;
+
+    // texelBudget: texels redrawn per frame at most (0 - no limit); the most stale dirty
+    // tile is always redrawn so a tile larger than the budget can't starve
+    SpotShadowAtlas(int atlasSize, int minTileSize, int maxTileSize, unsigned int texelBudget) : uniforms(SPOT_SHADOWS_BINDING),
+        atlasSize(atlasSize), minTileSize(minTileSize), maxTileSize(maxTileSize), texelBudget(texelBudget), stats()
+    {
+        glGenTextures(1, &texture);
+        glBindTexture(GL_TEXTURE_2D, texture);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, atlasSize, atlasSize, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, NULL);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_COMPARE_REF_TO_TEXTURE);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+        glGenFramebuffers(1, &FBO);
+        glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, texture, 0);
+        glDrawBuffer(GL_NONE);
+        glReadBuffer(GL_NONE);
+        glBindFramebuffer(GL_FRAMEBUFFER, 0);
+        glState().invalidate();
+        for (int i = 0; i < NR_SPOT_LIGHTS; i++)
+            tiles[i] = Tile();
+    }
+
+    // sizes the tiles by the screen coverage of each light (lights before firstLight get none)
+    // and marks the lights whose view changed; lights are in world space
+    void update(const SpotLight (&lights)[NR_SPOT_LIGHTS], int firstLight, const glm::mat4& view, const glm::mat4& inverseView, float fovY, float aspect)
+    {
+        this->inverseView = inverseView;
+        bool isRepacked = false;
+        for (int i = 0; i < NR_SPOT_LIGHTS; i++)
+        {
+            Tile& tile = tiles[i];
+            const SpotLight& light = lights[i];
+            tile.range = i < firstLight ? 0.0f : lightRadius(light);
+            tile.sinAngle = std::sqrt(std::max(1.0f - light.outerCutOff * light.outerCutOff, 0.0f));
+            tile.cosAngle = light.outerCutOff;
+            tile.apex = light.position;
+            tile.axis = glm::normalize(light.direction);
+            tile.coverage = tile.range > 0.0f ? screenCoverage(tile, view, fovY, aspect) : 0.0f;
+            int size = idealTileSize(tile.coverage, tile.size);
+            if (size != tile.size)
+            {
+                release(tile);
+                tile.size = size;
+                isRepacked = true;
+            }
+            if (tile.size == 0)
+                continue;
+            // the cone plus a small margin so the PCF taps at its edge stay inside the tile
+            float angle = std::acos(std::min(std::max(light.outerCutOff, -1.0f), 1.0f));
+            glm::vec3 up = std::abs(tile.axis.y) > 0.99f ? glm::vec3(0.0f, 0.0f, 1.0f) : glm::vec3(0.0f, 1.0f, 0.0f);
+            glm::mat4 lightSpace = glm::perspective(std::min(2.0f * angle * 1.05f, glm::radians(170.0f)), 1.0f, NEAR_PLANE, tile.range)
+                * glm::lookAt(light.position, light.position + tile.axis, up);
+            tile.texelSize = 2.0f * std::tan(std::min(angle * 1.05f, glm::radians(85.0f)));
+            if (lightSpace != tile.lightSpace)
+            {
+                tile.lightSpace = lightSpace;
+                tile.isDirty = true;
+            }
+        }
+        if (isRepacked)
+            pack();
+    }
+
+    // a moving caster (bounds before or after the move) reaching a cone makes its tile stale
+    void castersChanged(const BoundingSphere& bounds)
+    {
+        for (int i = 0; i < NR_SPOT_LIGHTS; i++)
+        {
+            Tile& tile = tiles[i];
+            if (tile.size > 0 && !tile.isDirty && coneIntersectsSphere(tile.apex, tile.axis, tile.range, tile.sinAngle, tile.cosAngle, bounds))
+                tile.isDirty = true;
+        }
+    }
+
+    // every tile is redrawn, still within the budget
+    void invalidate()
+    {
+        for (int i = 0; i < NR_SPOT_LIGHTS; i++)
+            tiles[i].isDirty = true;
+    }
+
+    void setBudget(unsigned int texels)
+    {
+        texelBudget = texels;
+    }
+
+    // redraws the dirty tiles that fit into the budget, most stale (weighted by coverage) first;
+    // draw(lightSpace) draws all casters with the world to light clip space matrix
+    template<typename Draw>
+    void render(Draw draw)
+    {
+        int order[NR_SPOT_LIGHTS];
+        int dirtyCount = 0;
+        for (int i = 0; i < NR_SPOT_LIGHTS; i++)
+        {
+            if (tiles[i].size > 0 && tiles[i].isDirty)
+            {
+                tiles[i].staleFrames++;
+                order[dirtyCount++] = i;
+            }
+        }
+        // tiles that were never drawn have no shadow yet and go first
+        std::sort(order, order + dirtyCount, [this](int a, int b)
+        {
+            if (tiles[a].isDrawn != tiles[b].isDrawn)
+                return !tiles[a].isDrawn;
+            return tiles[a].staleFrames * (0.1f + tiles[a].coverage) > tiles[b].staleFrames * (0.1f + tiles[b].coverage);
+        });
+
+        if (dirtyCount > 0)
+        {
+            GLint viewport[4];
+            glGetIntegerv(GL_VIEWPORT, viewport);
+            glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+            glEnable(GL_SCISSOR_TEST);
+            glEnable(GL_POLYGON_OFFSET_FILL);
+            glPolygonOffset(2.0f, 4.0f);
+            timer.begin();
+            unsigned int texels = 0;
+            for (int i = 0; i < dirtyCount; i++)
+            {
+                Tile& tile = tiles[order[i]];
+                unsigned int tileTexels = (unsigned int)(tile.size * tile.size);
+                if (texelBudget > 0 && texels > 0 && texels + tileTexels > texelBudget)
+                {
+                    stats.deferred++;
+                    continue;
+                }
+                texels += tileTexels;
+                glViewport(tile.x, tile.y, tile.size, tile.size);
+                glScissor(tile.x, tile.y, tile.size, tile.size);
+                glClear(GL_DEPTH_BUFFER_BIT);
+                draw(tile.lightSpace);
+                tile.drawnLightSpace = tile.lightSpace;
+                tile.drawnTexelSize = tile.texelSize;
+                tile.isDrawn = true;
+                tile.isDirty = false;
+                tile.staleFrames = 0;
+                stats.updates++;
+            }
+            timer.end();
+            glDisable(GL_POLYGON_OFFSET_FILL);
+            glDisable(GL_SCISSOR_TEST);
+            glBindFramebuffer(GL_FRAMEBUFFER, 0);
+            glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+        }
+        stats.frames++;
+
+        // a tile keeps being sampled with the matrix it was drawn with until it is redrawn
+        const glm::mat4 bias = glm::translate(glm::mat4(1.0f), glm::vec3(0.5f)) * glm::scale(glm::mat4(1.0f), glm::vec3(0.5f));
+        stats.lights = 0;
+        stats.atlasTexels = 0;
+        for (int i = 0; i < NR_SPOT_LIGHTS; i++)
+        {
+            const Tile& tile = tiles[i];
+            if (tile.size == 0 || !tile.isDrawn)
+            {
+                uniforms.data.spotShadowTiles[i] = glm::vec4(0.0f);
+                continue;
+            }
+            uniforms.data.spotShadowMatrices[i] = bias * tile.drawnLightSpace * inverseView;
+            uniforms.data.spotShadowTiles[i] = glm::vec4(glm::vec3(tile.x, tile.y, tile.size) / (float)atlasSize, tile.drawnTexelSize / tile.size);
+            stats.lights++;
+            stats.atlasTexels += (unsigned int)(tile.size * tile.size);
+        }
+        uniforms.upload();
+    }
+
+    // binds the atlas to its texture unit
+    void bind() const
+    {
+        glState().bindTexture(SPOT_SHADOW_ATLAS_UNIT, GL_TEXTURE_2D, texture);
+    }
+
+    const Stats& lastStats()
+    {
+        stats.ms = timer.elapsedMs();
+        return stats;
+    }
+
+    void resetStats()
+    {
+        stats.updates = 0;
+        stats.deferred = 0;
+        stats.frames = 0;
+    }
+
+    int size() const
+    {
+        return atlasSize;
+    }
+
+    // tile size of a light, 0 if it has none
+    int tileSize(int light) const
+    {
+        return tiles[light].size;
+    }
+
+    void destroy()
+    {
+        glDeleteTextures(1, &texture);
+        glDeleteFramebuffers(1, &FBO);
+        glDeleteBuffers(1, &uniforms.ID);
+        timer.destroy();
+    }
+
+private:
+    static constexpr float NEAR_PLANE = 0.1f;
+
+    struct Tile
+    {
+        int x, y, size;                 // texels in the atlas, size 0 - no tile
+        bool isPlaced;                  // size was packed into the atlas
+        bool isDirty, isDrawn;
+        unsigned int staleFrames;       // frames waiting for a redraw
+        float coverage;                 // share of the screen covered by the cone
+        glm::vec3 apex, axis;           // the light's cone this frame
+        float range, sinAngle, cosAngle;
+        glm::mat4 lightSpace;           // world -> light clip space this frame
+        float texelSize;                // width of the view at distance 1
+        glm::mat4 drawnLightSpace;      // the same when the tile was last drawn
+        float drawnTexelSize;
+
+        Tile() : x(0), y(0), size(0), isPlaced(false), isDirty(false), isDrawn(false), staleFrames(0), coverage(0.0f),
+            apex(0.0f), axis(0.0f, 0.0f, -1.0f), range(0.0f), sinAngle(0.0f), cosAngle(1.0f), lightSpace(0.0f), texelSize(0.0f),
+            drawnLightSpace(0.0f), drawnTexelSize(0.0f)
+        {
+        }
+    };
+
+    int atlasSize, minTileSize, maxTileSize;
+    unsigned int texelBudget;
+    unsigned int texture;
+    unsigned int FBO;
+    Tile tiles[NR_SPOT_LIGHTS];
+    glm::mat4 inverseView;
+    GpuTimer timer;
+    Stats stats;
+
+    // share of the screen covered by the bounding sphere of a light's cone
+    static float screenCoverage(const Tile& tile, const glm::mat4& view, float fovY, float aspect)
+    {
+        float radius, offset;
+        if (tile.cosAngle < 0.70710678f)
+        {
+            // wide cones: the sphere around the cap
+            offset = tile.range * tile.cosAngle;
+            radius = tile.range * tile.sinAngle;
+        }
+        else
+        {
+            // narrow cones: the sphere through the apex and the cap rim
+            offset = tile.range / (2.0f * tile.cosAngle);
+            radius = offset;
+        }
+        glm::vec3 center = glm::vec3(view * glm::vec4(tile.apex + tile.axis * offset, 1.0f));
+        if (center.z - radius > 0.0f)
+            return 0.0f; // behind the camera
+        float distance2 = glm::dot(center, center);
+        if (distance2 <= radius * radius)
+            return 1.0f; // the camera is inside
+        // projected radius in normalized device coordinates (height), circle area over the [-1, 1] square
+        float ndcRadius = radius / (std::sqrt(distance2 - radius * radius) * std::tan(fovY * 0.5f));
+        return std::min(3.14159265f * ndcRadius * ndcRadius / (4.0f * aspect), 1.0f);
+    }
+
+    // power of two tile size with texels in proportion to the covered pixels; the current
+    // size is kept until the ideal one is 1.68 times larger or smaller so tiles don't flicker
+    int idealTileSize(float coverage, int current) const
+    {
+        if (coverage <= 0.0f)
+            return 0;
+        float ideal = std::log2(std::max(maxTileSize * std::sqrt(coverage), 1.0f));
+        if (current > 0 && std::abs(ideal - std::log2((float)current)) < 0.75f)
+            return current;
+        int size = 1 << (int)std::floor(ideal + 0.5f);
+        return std::min(std::max(size, minTileSize), maxTileSize);
+    }
+
+    void release(Tile& tile)
+    {
+        tile.isPlaced = false;
+        tile.isDrawn = false;
+        tile.isDirty = true;
+    }
+
+    // places the tiles without a position, largest first, on a grid of their own size so
+    // power of two tiles never straddle each other; when a tile doesn't fit every tile is
+    // placed again from scratch, and as a last resort the largest ones are halved
+    void pack()
+    {
+        for (int attempt = 0; attempt < 8; attempt++)
+        {
+            if (place())
+                return;
+            for (int i = 0; i < NR_SPOT_LIGHTS; i++)
+                release(tiles[i]);
+            if (place())
+                return;
+            int largest = 0;
+            for (int i = 0; i < NR_SPOT_LIGHTS; i++)
+                largest = std::max(largest, tiles[i].size);
+            for (int i = 0; i < NR_SPOT_LIGHTS; i++)
+                if (tiles[i].size == largest && largest > minTileSize)
+                    tiles[i].size /= 2;
+            for (int i = 0; i < NR_SPOT_LIGHTS; i++)
+                release(tiles[i]);
+        }
+        std::cout << "SHADOWS::ATLAS_FULL: some spot lights have no shadow" << std::endl;
+        for (int i = 0; i < NR_SPOT_LIGHTS; i++)
+            if (!tiles[i].isPlaced)
+                tiles[i].size = 0;
+    }
+
+    bool place()
+    {
+        int order[NR_SPOT_LIGHTS];
+        for (int i = 0; i < NR_SPOT_LIGHTS; i++)
+            order[i] = i;
+        std::sort(order, order + NR_SPOT_LIGHTS, [this](int a, int b) { return tiles[a].size > tiles[b].size; });
+        bool isComplete = true;
+        for (int i : order)
+        {
+            Tile& tile = tiles[i];
+            if (tile.size == 0 || tile.isPlaced)
+                continue;
+            bool isFree = false;
+            for (int y = 0; y + tile.size <= atlasSize && !isFree; y += tile.size)
+            {
+                for (int x = 0; x + tile.size <= atlasSize && !isFree; x += tile.size)
+                {
+                    isFree = true;
+                    for (const Tile& other : tiles)
+                    {
+                        if (other.isPlaced && x < other.x + other.size && other.x < x + tile.size && y < other.y + other.size && other.y < y + tile.size)
+                        {
+                            isFree = false;
+                            break;
+                        }
+                    }
+                    if (isFree)
+                    {
+                        tile.x = x;
+                        tile.y = y;
+                    }
+                }
+            }
+            tile.isPlaced = isFree;
+            isComplete = isComplete && isFree;
+        }
+        return isComplete;
+    }
+};
+#endif
@@ -0,0 +1,316 @@
+#ifndef SPHERICAL_HARMONICS_H
+#define SPHERICAL_HARMONICS_H
+
+#include <glm/glm.hpp>
+
+#include <lights.h>
+#include <asset_loader.h>
+#include <benchmark.h>
+#include <thread_pool.h>
+
+#include <cmath>
+#include <fstream>
+#include <future>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SH_SIMD 1
+#endif
+
+// Image based ambient light from the skybox. Every cubemap is projected into the 9
+// coefficients of order 3 spherical harmonics once; the coefficients are convolved with
+// the cosine lobe, so evaluating them for a world space normal gives the diffuse ambient
+// (irradiance / pi) with a handful of multiply-adds, see CalcAmbient in lights.glsl.
+// Faces are projected on the thread pool as soon as the loader has decoded them, 4 texels
+// at a time with SSE2; the result is cached next to the face images.
+
+// constant factors of the basis functions 1, y, z, x, xy, yz, 3z^2 - 1, xz, x^2 - y^2
+const float SH_BASIS_CONSTANTS[SH_COEFFICIENTS] = {
+    0.282095f, 0.488603f, 0.488603f, 0.488603f, 1.092548f, 1.092548f, 0.315392f, 1.092548f, 0.546274f
+};
+
+// ambient coefficients ready for the shader (LightBlock::ambientSH): the basis constants
+// are folded in and the average is normalized to a luminance of 1
+struct SHAmbient
+{
+    glm::vec4 coefficients[SH_COEFFICIENTS];  // rgb, w unused (std140 vec4 array)
+};
+
+// radiance projected onto the basis, summed over texels: sum(color * Y(direction) * solid angle)
+struct SHProjection
+{
+    glm::vec3 sums[SH_COEFFICIENTS];
+    double solidAngle;
+};
+
+// unit direction through texel (u, v) in [-1, 1] of a GL cubemap face, v grows with the
+// image rows as uploaded (t in the GL spec)
+inline glm::vec3 cubemapDirection(int face, float u, float v)
+{
+    switch (face)
+    {
+    case 0: return glm::vec3(1.0f, -v, -u);
+    case 1: return glm::vec3(-1.0f, -v, u);
+    case 2: return glm::vec3(u, 1.0f, v);
+    case 3: return glm::vec3(u, -1.0f, -v);
+    case 4: return glm::vec3(u, -v, 1.0f);
+    default: return glm::vec3(-u, -v, -1.0f);
+    }
+}
+
+// projects one 8 bit face; the solid angle of a texel is texelArea / (1 + u^2 + v^2)^(3/2)
+inline SHProjection projectCubemapFace(int face, const unsigned char* pixels, int size, int components)
+{
+    const float texelArea = (2.0f / size) * (2.0f / size);
+    // every direction component is linear in u with a face dependent sign and position
+    const glm::vec3 du = cubemapDirection(face, 1.0f, 0.0f) - cubemapDirection(face, 0.0f, 0.0f);
+    const glm::vec3 dv = cubemapDirection(face, 0.0f, 1.0f) - cubemapDirection(face, 0.0f, 0.0f);
+    const glm::vec3 axis = cubemapDirection(face, 0.0f, 0.0f);
+    const int channels = components < 3 ? 1 : 3;
+    double sums[SH_COEFFICIENTS][3] = {};
+    double solidAngle = 0.0;
+
+    for (int y = 0; y < size; y++)
+    {
+        const float v = (y + 0.5f) * 2.0f / size - 1.0f;
+        const unsigned char* row = pixels + (size_t)y * size * components;
+        int x = 0;
+#ifdef SH_SIMD
+        // rows are summed in float, the totals of the face in double
+        __m128 acc[SH_COEFFICIENTS][3];
+        for (int k = 0; k < SH_COEFFICIENTS; k++)
+            for (int c = 0; c < 3; c++)
+                acc[k][c] = _mm_setzero_ps();
+        __m128 accWeight = _mm_setzero_ps();
+        const __m128 one = _mm_set1_ps(1.0f);
+        const __m128 vv = _mm_set1_ps(v * v);
+        const __m128 step = _mm_set1_ps(2.0f / size);
+        for (; x + 4 <= size; x += 4)
+        {
+            __m128 u = _mm_sub_ps(_mm_mul_ps(_mm_set_ps(x + 3.5f, x + 2.5f, x + 1.5f, x + 0.5f), step), one);
+            __m128 lengthSq = _mm_add_ps(_mm_add_ps(one, _mm_mul_ps(u, u)), vv);
+            __m128 invLength = _mm_div_ps(one, _mm_sqrt_ps(lengthSq));
+            __m128 weight = _mm_mul_ps(_mm_set1_ps(texelArea), _mm_mul_ps(invLength, _mm_mul_ps(invLength, invLength)));
+            // normalized direction
+            __m128 dx = _mm_mul_ps(_mm_add_ps(_mm_set1_ps(axis.x + dv.x * v), _mm_mul_ps(_mm_set1_ps(du.x), u)), invLength);
+            __m128 dy = _mm_mul_ps(_mm_add_ps(_mm_set1_ps(axis.y + dv.y * v), _mm_mul_ps(_mm_set1_ps(du.y), u)), invLength);
+            __m128 dz = _mm_mul_ps(_mm_add_ps(_mm_set1_ps(axis.z + dv.z * v), _mm_mul_ps(_mm_set1_ps(du.z), u)), invLength);
+            // basis without its constants, they are applied once per face
+            __m128 basis[SH_COEFFICIENTS] = {
+                one, dy, dz, dx,
+                _mm_mul_ps(dx, dy), _mm_mul_ps(dy, dz), _mm_sub_ps(_mm_mul_ps(_mm_set1_ps(3.0f), _mm_mul_ps(dz, dz)), one),
+                _mm_mul_ps(dx, dz), _mm_sub_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy))
+            };
+            const unsigned char* p = row + (size_t)x * components;
+            for (int c = 0; c < 3; c++)
+            {
+                int channel = c < channels ? c : 0;
+                __m128 color = _mm_set_ps(p[3 * components + channel], p[2 * components + channel], p[components + channel], p[channel]);
+                __m128 weighted = _mm_mul_ps(color, weight);
+                for (int k = 0; k < SH_COEFFICIENTS; k++)
+                    acc[k][c] = _mm_add_ps(acc[k][c], _mm_mul_ps(basis[k], weighted));
+            }
+            accWeight = _mm_add_ps(accWeight, weight);
+        }
+        float lanes[4];
+        for (int k = 0; k < SH_COEFFICIENTS; k++)
+        {
+            for (int c = 0; c < 3; c++)
+            {
+                _mm_storeu_ps(lanes, acc[k][c]);
+                sums[k][c] += (double)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+            }
+        }
+        _mm_storeu_ps(lanes, accWeight);
+        solidAngle += (double)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#endif
+        // the remaining texels of the row (all of them without SSE2)
+        for (; x < size; x++)
+        {
+            float u = (x + 0.5f) * 2.0f / size - 1.0f;
+            float lengthSq = 1.0f + u * u + v * v;
+            float invLength = 1.0f / std::sqrt(lengthSq);
+            float weight = texelArea * invLength * invLength * invLength;
+            glm::vec3 d = (axis + du * u + dv * v) * invLength;
+            const float basis[SH_COEFFICIENTS] = { 1.0f, d.y, d.z, d.x, d.x * d.y, d.y * d.z, 3.0f * d.z * d.z - 1.0f, d.x * d.z, d.x * d.x - d.y * d.y };
+            const unsigned char* p = row + (size_t)x * components;
+            for (int c = 0; c < 3; c++)
+            {
+                float color = p[c < channels ? c : 0] * weight;
+                for (int k = 0; k < SH_COEFFICIENTS; k++)
+                    sums[k][c] += basis[k] * color;
+            }
+            solidAngle += weight;
+        }
+    }
+
+    // basis constants and 8 bit to [0, 1]
+    SHProjection projection;
+    for (int k = 0; k < SH_COEFFICIENTS; k++)
+        projection.sums[k] = glm::vec3(sums[k][0], sums[k][1], sums[k][2]) * (SH_BASIS_CONSTANTS[k] / 255.0f);
+    projection.solidAngle = solidAngle;
+    return projection;
+}
+
+// ambient coefficients from the projections of all faces: radiance to irradiance / pi
+// (cosine lobe convolution 1, 2/3, 1/4 per band), basis constants folded in once more for
+// the evaluation, average luminance normalized to 1
+inline SHAmbient toAmbient(const SHProjection* faces, int faceCount)
+{
+    static const float bands[SH_COEFFICIENTS] = { 1.0f, 2.0f / 3.0f, 2.0f / 3.0f, 2.0f / 3.0f, 0.25f, 0.25f, 0.25f, 0.25f, 0.25f };
+    glm::vec3 radiance[SH_COEFFICIENTS] = {};
+    double solidAngle = 0.0;
+    for (int f = 0; f < faceCount; f++)
+    {
+        for (int k = 0; k < SH_COEFFICIENTS; k++)
+            radiance[k] += faces[f].sums[k];
+        solidAngle += faces[f].solidAngle;
+    }
+    // the texel solid angles sum to about 4 pi, rescale so a constant sky projects exactly
+    float correction = solidAngle > 0.0 ? (float)(4.0 * 3.14159265358979 / solidAngle) : 0.0f;
+    SHAmbient ambient;
+    for (int k = 0; k < SH_COEFFICIENTS; k++)
+        ambient.coefficients[k] = glm::vec4(radiance[k] * (correction * bands[k] * SH_BASIS_CONSTANTS[k]), 0.0f);
+    float luminance = glm::dot(glm::vec3(ambient.coefficients[0]), glm::vec3(0.2126f, 0.7152f, 0.0722f));
+    if (luminance > 0.0f)
+        for (int k = 0; k < SH_COEFFICIENTS; k++)
+            ambient.coefficients[k] /= luminance;
+    return ambient;
+}
+
+// evaluates ambient coefficients for a world space normal, the same as CalcAmbient in lights.glsl
+inline glm::vec3 evaluateAmbient(const SHAmbient& ambient, const glm::vec3& n)
+{
+    const glm::vec4* c = ambient.coefficients;
+    glm::vec4 result = c[0] + c[1] * n.y + c[2] * n.z + c[3] * n.x + c[4] * (n.x * n.y) + c[5] * (n.y * n.z)
+        + c[6] * (3.0f * n.z * n.z - 1.0f) + c[7] * (n.x * n.z) + c[8] * (n.x * n.x - n.y * n.y);
+    return glm::vec3(result);
+}
+
+// ambient of one cubemap: read from the cache next to its faces, or projected from the
+// decoded faces handed over by the asset loader and written to the cache
+class CubemapAmbient
+{
+public:
+    // isCacheRead false projects the faces even if the cache is valid (and rewrites it)
+    CubemapAmbient(ThreadPool& pool, const std::vector<std::string>& faces, bool isCacheRead) : pool(pool), faces(faces), isLoaded(false), projectMs(0.0)
+    {
+        for (size_t i = 0; i < faces.size(); i++)
+            faceBytes.push_back(AssetLoader::fileSize(faces[i]));
+        isLoaded = isCacheRead && readCache();
+        projections.resize(faces.size());
+    }
+
+    // true if the coefficients came from the cache and the faces need no projection
+    bool isCached() const
+    {
+        return isLoaded;
+    }
+
+    // queues the projection of a decoded face; the pixels are copied, the loader frees them
+    void addFace(unsigned int face, const AssetLoader::Image& image)
+    {
+        if (isLoaded || !image.data || image.width != image.height || face >= projections.size())
+            return;
+        std::shared_ptr<std::vector<unsigned char> > pixels = std::make_shared<std::vector<unsigned char> >(
+            image.data, image.data + (size_t)image.width * image.height * image.nrComponents);
+        int size = image.width, components = image.nrComponents;
+        projections[face] = pool.submit([face, pixels, size, components]()
+        {
+            Timer timer;
+            SHProjection projection = projectCubemapFace((int)face, pixels->data(), size, components);
+            return std::make_pair(projection, timer.elapsedMs());
+        });
+    }
+
+    // the coefficients; waits for the projections of all faces the first time after a cache miss
+    const SHAmbient& get()
+    {
+        if (isLoaded)
+            return ambient;
+        std::vector<SHProjection> results;
+        for (size_t i = 0; i < projections.size(); i++)
+        {
+            if (!projections[i].valid())
+            {
+                std::cout << "SH::FACE_MISSING: " << faces[i] << ", ambient stays black" << std::endl;
+                isLoaded = true;
+                ambient = SHAmbient();
+                return ambient;
+            }
+            std::pair<SHProjection, double> result = projections[i].get();
+            results.push_back(result.first);
+            projectMs += result.second;
+        }
+        ambient = toAmbient(results.data(), (int)results.size());
+        isLoaded = true;
+        writeCache();
+        std::cout << "SH: projected " << faces[0] << " and " << faces.size() - 1 << " more faces in " << projectMs
+            << " ms on workers, cached in " << cachePath() << std::endl;
+        return ambient;
+    }
+
+private:
+    static const int CACHE_VERSION = 1;
+
+    ThreadPool& pool;
+    std::vector<std::string> faces;
+    std::vector<long long> faceBytes;
+    std::vector<std::future<std::pair<SHProjection, double> > > projections;
+    SHAmbient ambient;
+    bool isLoaded;
+    double projectMs;
+
+    // "resources/textures/right.jpg" -> "resources/textures/right.sh"
+    std::string cachePath() const
+    {
+        return AssetLoader::siblingPath(faces[0], ".sh");
+    }
+
+    // the cache is valid for the same face files (names and sizes)
+    bool readCache()
+    {
+        std::ifstream file(cachePath());
+        if (!file)
+            return false;
+        int version = 0;
+        size_t count = 0;
+        file >> version >> count;
+        if (version != CACHE_VERSION || count != faces.size())
+            return false;
+        for (size_t i = 0; i < faces.size(); i++)
+        {
+            std::string name;
+            long long bytes = 0;
+            file >> name >> bytes;
+            if (!file || name != faces[i] || bytes != faceBytes[i] || bytes < 0)
+                return false;
+        }
+        for (int k = 0; k < SH_COEFFICIENTS; k++)
+        {
+            glm::vec4& c = ambient.coefficients[k];
+            file >> c.r >> c.g >> c.b;
+            c.a = 0.0f;
+        }
+        return (bool)file;
+    }
+
+    void writeCache() const
+    {
+        std::ofstream file(cachePath());
+        if (!file)
+            return;
+        file << CACHE_VERSION << " " << faces.size() << "\n";
+        for (size_t i = 0; i < faces.size(); i++)
+            file << faces[i] << " " << faceBytes[i] << "\n";
+        file.precision(9);
+        for (int k = 0; k < SH_COEFFICIENTS; k++)
+            file << ambient.coefficients[k].r << " " << ambient.coefficients[k].g << " " << ambient.coefficients[k].b << "\n";
+    }
+};
+#endif
@@ -0,0 +1,157 @@
+#ifndef STATIC_BATCH_H
+#define STATIC_BATCH_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+
+#include <gl_state.h>
+#include <light_culling.h>
+#include <mesh_optimizer.h>
+#include <vertex_format.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// Static geometry batching. Meshes that never move and are drawn with the same shader and
+// material are transformed into world space once at load and appended to one vertex and
+// index buffer, so all of them cost a single draw and no per-object uniforms. Vertices are
+// added in the scene's layout (position, normal, texture coordinates as 8 floats) and encoded
+// at upload (vertex_format.h), quantized positions relative to the world bounds of the batch;
+// the meshes come from optimizeMesh, and the indices are 16 bit while the batch has at most
+// 65536 vertices.
+// A batch is drawn like one object with an identity model matrix; it has a single bounding
+// sphere, so per-object light culling (K key) gives it one list for all its meshes.
+class StaticBatch
+{
+public:
+    static const int FLOATS_PER_VERTEX = 8;
+
+    StaticBatch() : VAO(0), VBO(0), EBO(0), indexType(GL_UNSIGNED_SHORT), meshes(0), uploadedIndices(0), uploadedVertexBytes(0)
+    {
+        sphere.center = glm::vec3(0.0f);
+        sphere.radius = 0.0f;
+    }
+
+    // appends a mesh in the vertex layout above
+    void add(const IndexedMesh& mesh, const glm::mat4& model)
+    {
+        glm::mat3 normalMatrix = glm::transpose(glm::inverse(glm::mat3(model)));
+        uint32_t first = (uint32_t)vertexCount();
+        for (size_t i = 0; i < mesh.vertexCount(); i++)
+        {
+            const float* vertex = mesh.vertices.data() + i * FLOATS_PER_VERTEX;
+            glm::vec3 position = glm::vec3(model * glm::vec4(vertex[0], vertex[1], vertex[2], 1.0f));
+            glm::vec3 normal = glm::normalize(normalMatrix * glm::vec3(vertex[3], vertex[4], vertex[5]));
+            const float transformed[FLOATS_PER_VERTEX] = { position.x, position.y, position.z, normal.x, normal.y, normal.z, vertex[6], vertex[7] };
+            vertices.insert(vertices.end(), transformed, transformed + FLOATS_PER_VERTEX);
+        }
+        for (uint32_t index : mesh.indices)
+            indices.push_back(first + index);
+        meshes++;
+    }
+
+    // creates the buffers and the VAO (attributes as the scene's cube VAO), the CPU copy is
+    // kept for the bounds and the vertex counts
+    void upload(VertexEncoding encoding)
+    {
+        computeBounds();
+        if (!VAO)
+        {
+            glGenVertexArrays(1, &VAO);
+            glGenBuffers(1, &VBO);
+            glGenBuffers(1, &EBO);
+        }
+        glBindVertexArray(VAO);
+        glBindBuffer(GL_ARRAY_BUFFER, VBO);
+        EncodedVertices encoded = encodeVertices(vertices.data(), vertexCount(), FLOATS_PER_VERTEX, encoding);
+        encoded.upload();
+        uploadedVertexBytes = encoded.vertexBytes();
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+        PackedIndices packed = packIndices(indices, vertexCount());
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, packed.bytes(), packed.data(), GL_STATIC_DRAW);
+        indexType = packed.type;
+        uploadedIndices = indices.size();
+    }
+
+    // one draw for every mesh; the shader's model and normal matrix must be identity
+    void draw() const
+    {
+        glState().bindVertexArray(VAO);
+        glState().drawElements(GL_TRIANGLES, (GLsizei)uploadedIndices, indexType, 0);
+    }
+
+    bool empty() const
+    {
+        return uploadedIndices == 0;
+    }
+
+    size_t meshCount() const
+    {
+        return meshes;
+    }
+
+    size_t vertexCount() const
+    {
+        return vertices.size() / FLOATS_PER_VERTEX;
+    }
+
+    size_t indexCount() const
+    {
+        return indices.size();
+    }
+
+    // size of the encoded vertices on the GPU
+    size_t vertexBytes() const
+    {
+        return uploadedVertexBytes;
+    }
+
+    // world space sphere around all meshes
+    const BoundingSphere& bounds() const
+    {
+        return sphere;
+    }
+
+    void destroy()
+    {
+        glDeleteVertexArrays(1, &VAO);
+        glDeleteBuffers(1, &VBO);
+        glDeleteBuffers(1, &EBO);
+        VAO = VBO = EBO = 0;
+    }
+
+private:
+    unsigned int VAO, VBO, EBO;
+    GLenum indexType;
+    std::vector<float> vertices;
+    std::vector<uint32_t> indices;
+    size_t meshes;
+    size_t uploadedIndices;
+    size_t uploadedVertexBytes;
+    BoundingSphere sphere;
+
+    // centered on the box around the vertices, large enough to hold all of them
+    void computeBounds()
+    {
+        if (vertices.empty())
+            return;
+        glm::vec3 lo(vertices[0], vertices[1], vertices[2]), hi = lo;
+        for (size_t i = 0; i < vertices.size(); i += FLOATS_PER_VERTEX)
+        {
+            glm::vec3 p(vertices[i], vertices[i + 1], vertices[i + 2]);
+            lo = glm::min(lo, p);
+            hi = glm::max(hi, p);
+        }
+        sphere.center = (lo + hi) * 0.5f;
+        float radius2 = 0.0f;
+        for (size_t i = 0; i < vertices.size(); i += FLOATS_PER_VERTEX)
+        {
+            glm::vec3 d = glm::vec3(vertices[i], vertices[i + 1], vertices[i + 2]) - sphere.center;
+            radius2 = std::max(radius2, glm::dot(d, d));
+        }
+        sphere.radius = std::sqrt(radius2);
+    }
+};
+#endif
@@ -0,0 +1,54 @@
+#ifndef UNIFORM_BUFFER_H
+#define UNIFORM_BUFFER_H
+
+#include <glad/glad.h>
+
+#include <cstring>
+
+// Uniform Buffer Object holding one std140 block of type T, bound to a fixed binding point.
+// Edit 'data' on the CPU and call upload(); only the byte range that changed since the
+// last upload is sent to the driver, unchanged blocks cost nothing.
+template <typename T>
+class UniformBuffer
+{
+public:
+    unsigned int ID;
+    T data;
+
+    UniformBuffer(GLuint bindingPoint) : data(), uploaded(), uploadedOnce(false)
+    {
+        glGenBuffers(1, &ID);
+        glBindBuffer(GL_UNIFORM_BUFFER, ID);
+        glBufferData(GL_UNIFORM_BUFFER, sizeof(T), NULL, GL_DYNAMIC_DRAW);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        glBindBufferBase(GL_UNIFORM_BUFFER, bindingPoint, ID);
+    }
+
+    // sends the changed part of 'data' to the GPU, returns the number of bytes uploaded
+    size_t upload()
+    {
+        const unsigned char* current = reinterpret_cast<const unsigned char*>(&data);
+        const unsigned char* previous = reinterpret_cast<const unsigned char*>(&uploaded);
+        size_t first = 0, last = sizeof(T);
+        if (uploadedOnce)
+        {
+            while (first < sizeof(T) && current[first] == previous[first])
+                first++;
+            if (first == sizeof(T))
+                return 0;
+            while (current[last - 1] == previous[last - 1])
+                last--;
+        }
+        glBindBuffer(GL_UNIFORM_BUFFER, ID);
+        glBufferSubData(GL_UNIFORM_BUFFER, first, last - first, current + first);
+        glBindBuffer(GL_UNIFORM_BUFFER, 0);
+        std::memcpy(&uploaded, &data, sizeof(T));
+        uploadedOnce = true;
+        return last - first;
+    }
+
+private:
+    T uploaded;
+    bool uploadedOnce;
+};
+#endif
@@ -0,0 +1,287 @@
+#ifndef VERTEX_FORMAT_H
+#define VERTEX_FORMAT_H
+
+#include <glad/glad.h>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/packing.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include <mesh_optimizer.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// How the vertices of a mesh are stored in its vertex buffer. The meshes are built as floats
+// (IndexedMesh: position, normal, texture coordinates) and encoded once when uploaded:
+//   VERTEX_FLOAT       32 bytes  3 + 3 + 2 floats as built
+//   VERTEX_PACKED      16 bytes  positions as unorm16 quantized against the mesh bounds, normals
+//                                as GL_INT_2_10_10_10_REV, texture coordinates as half floats
+//   VERTEX_OCTAHEDRAL  16 bytes  as packed, the normals octahedral encoded in two snorm16
+// Meshes without normals or texture coordinates leave those attributes out. The attribute
+// pointers are generated from a VertexFormat, the descriptor of one encoding.
+//
+// The decoding constants (position scale and offset, normal encoding) are stored after the
+// vertices and read as two more attributes with a divisor larger than any instance count, so
+// every instance reads the same value and the shaders (vertex_format.glsl) need no variant or
+// uniform per encoding; the VAO carries how its mesh is stored.
+enum VertexEncoding
+{
+    VERTEX_FLOAT,
+    VERTEX_PACKED,
+    VERTEX_OCTAHEDRAL
+};
+
+// vertex attribute locations, must match vertex_format.glsl
+const GLuint VERTEX_POSITION_LOCATION = 0;
+const GLuint VERTEX_NORMAL_LOCATION = 1;
+const GLuint VERTEX_TEXCOORDS_LOCATION = 2;
+const GLuint VERTEX_DECODE_LOCATION = 11; // 11..12, after the instance attributes (instancing.h)
+
+// one glVertexAttribPointer call
+struct VertexAttribute
+{
+    GLuint location;
+    GLint size;
+    GLenum type;
+    GLboolean normalized;
+    GLuint offset;
+};
+
+struct VertexFormat
+{
+    VertexEncoding encoding;
+    std::vector<VertexAttribute> attributes;
+    GLsizei stride;
+
+    // the layout of an encoding for a mesh with 'floatsPerVertex' floats: 3 position only,
+    // 6 with normals, 8 with normals and texture coordinates
+    static VertexFormat make(VertexEncoding encoding, int floatsPerVertex)
+    {
+        VertexFormat format;
+        format.encoding = encoding;
+        format.stride = 0;
+        bool isFloat = encoding == VERTEX_FLOAT;
+        // the unorm16 position is padded to 8 bytes to keep the next attribute aligned
+        format.add(VERTEX_POSITION_LOCATION, 3, isFloat ? GL_FLOAT : GL_UNSIGNED_SHORT, !isFloat, isFloat ? 12 : 8);
+        if (floatsPerVertex >= 6)
+        {
+            if (encoding == VERTEX_FLOAT)
+                format.add(VERTEX_NORMAL_LOCATION, 3, GL_FLOAT, GL_FALSE, 12);
+            else if (encoding == VERTEX_PACKED)
+                format.add(VERTEX_NORMAL_LOCATION, 4, GL_INT_2_10_10_10_REV, GL_TRUE, 4);
+            else
+                format.add(VERTEX_NORMAL_LOCATION, 2, GL_SHORT, GL_TRUE, 4);
+        }
+        if (floatsPerVertex >= 8)
+            format.add(VERTEX_TEXCOORDS_LOCATION, 2, isFloat ? GL_FLOAT : GL_HALF_FLOAT, GL_FALSE, isFloat ? 8 : 4);
+        return format;
+    }
+
+    // enables the attributes on the bound VAO, reading the bound GL_ARRAY_BUFFER; the decoding
+    // constants are read from 'decodeOffset' in the same buffer
+    void setupAttributes(size_t decodeOffset) const
+    {
+        for (const VertexAttribute& attribute : attributes)
+        {
+            glVertexAttribPointer(attribute.location, attribute.size, attribute.type, attribute.normalized, stride, (void*)(size_t)attribute.offset);
+            glEnableVertexAttribArray(attribute.location);
+        }
+        for (GLuint i = 0; i < 2; i++)
+        {
+            glVertexAttribPointer(VERTEX_DECODE_LOCATION + i, 4, GL_FLOAT, GL_FALSE, 0, (void*)(decodeOffset + i * sizeof(glm::vec4)));
+            glEnableVertexAttribArray(VERTEX_DECODE_LOCATION + i);
+            glVertexAttribDivisor(VERTEX_DECODE_LOCATION + i, 0x7fffffff);
+        }
+    }
+
+    static const char* name(VertexEncoding encoding)
+    {
+        switch (encoding)
+        {
+        case VERTEX_PACKED:     return "packed";
+        case VERTEX_OCTAHEDRAL: return "octahedral";
+        default:                return "float";
+        }
+    }
+
+    // "float", "packed" or "octahedral" (--vertex-format), 'fallback' for anything else
+    static VertexEncoding parse(const char* name, VertexEncoding fallback)
+    {
+        if (!name)
+            return fallback;
+        for (int encoding = VERTEX_FLOAT; encoding <= VERTEX_OCTAHEDRAL; encoding++)
+            if (std::string(name) == VertexFormat::name((VertexEncoding)encoding))
+                return (VertexEncoding)encoding;
+        return fallback;
+    }
+
+private:
+    void add(GLuint location, GLint size, GLenum type, GLboolean normalized, GLsizei bytes)
+    {
+        VertexAttribute attribute = { location, size, type, normalized, (GLuint)stride };
+        attributes.push_back(attribute);
+        stride += bytes;
+    }
+};
+
+// the encoded vertex buffer contents: vertices, then the decoding constants
+struct EncodedVertices
+{
+    VertexFormat format;
+    std::vector<unsigned char> bytes;
+    size_t vertexCount;
+    size_t decodeOffset;
+    float maxPositionError; // object space, from quantizing against the bounds
+    float maxNormalError;   // degrees
+
+    // uploads to the bound GL_ARRAY_BUFFER and sets the attributes of the bound VAO
+    void upload(GLenum usage = GL_STATIC_DRAW) const
+    {
+        glBufferData(GL_ARRAY_BUFFER, bytes.size(), bytes.data(), usage);
+        format.setupAttributes(decodeOffset);
+    }
+
+    // vertex data only, without the 32 bytes of decoding constants
+    size_t vertexBytes() const
+    {
+        return vertexCount * format.stride;
+    }
+};
+
+// octahedral mapping of a unit vector to [-1, 1]^2, the lower hemisphere folded over the diagonals
+inline glm::vec2 octahedralEncode(const glm::vec3& n)
+{
+    glm::vec2 p = glm::vec2(n) / (std::abs(n.x) + std::abs(n.y) + std::abs(n.z));
+    if (n.z < 0.0f)
+        p = (1.0f - glm::abs(glm::vec2(p.y, p.x))) * glm::vec2(p.x >= 0.0f ? 1.0f : -1.0f, p.y >= 0.0f ? 1.0f : -1.0f);
+    return p;
+}
+
+// the inverse, as decodeNormal in vertex_format.glsl
+inline glm::vec3 octahedralDecode(const glm::vec2& p)
+{
+    glm::vec3 n(p.x, p.y, 1.0f - std::abs(p.x) - std::abs(p.y));
+    float t = std::max(-n.z, 0.0f);
+    n.x += n.x >= 0.0f ? -t : t;
+    n.y += n.y >= 0.0f ? -t : t;
+    return glm::normalize(n);
+}
+
+// signed normalized, GL 4.2 rules: -1 and 1 map to -max and max, 0 to 0
+inline int toSnorm(float value, int bits)
+{
+    float max = (float)((1 << (bits - 1)) - 1);
+    return (int)std::round(glm::clamp(value, -1.0f, 1.0f) * max);
+}
+
+inline float fromSnorm(int value, int bits)
+{
+    return std::max((float)value / (float)((1 << (bits - 1)) - 1), -1.0f);
+}
+
+inline uint32_t packNormal2_10_10_10(const glm::vec3& n)
+{
+    return ((uint32_t)toSnorm(n.x, 10) & 0x3ffu) | (((uint32_t)toSnorm(n.y, 10) & 0x3ffu) << 10) | (((uint32_t)toSnorm(n.z, 10) & 0x3ffu) << 20);
+}
+
+inline float angleDegrees(const glm::vec3& a, const glm::vec3& b)
+{
+    return glm::degrees(std::acos(glm::clamp(glm::dot(glm::normalize(a), glm::normalize(b)), -1.0f, 1.0f)));
+}
+
+// encodes 'count' interleaved float vertices; the vertex order is kept, so the indices stay valid
+inline EncodedVertices encodeVertices(const float* vertices, size_t count, int floatsPerVertex, VertexEncoding encoding)
+{
+    EncodedVertices result;
+    result.format = VertexFormat::make(encoding, floatsPerVertex);
+    result.vertexCount = count;
+    result.maxPositionError = 0.0f;
+    result.maxNormalError = 0.0f;
+    const VertexFormat& format = result.format;
+    result.decodeOffset = count * format.stride;
+    result.bytes.resize(result.decodeOffset + 2 * sizeof(glm::vec4));
+
+    // positions map the bounds to [0, 1]; a flat axis keeps a scale of 1 so nothing divides by 0
+    glm::vec3 lo(0.0f), hi(0.0f);
+    for (size_t i = 0; i < count; i++)
+    {
+        glm::vec3 p = glm::make_vec3(vertices + i * floatsPerVertex);
+        lo = i == 0 ? p : glm::min(lo, p);
+        hi = i == 0 ? p : glm::max(hi, p);
+    }
+    glm::vec4 scale(1.0f, 1.0f, 1.0f, encoding == VERTEX_OCTAHEDRAL ? 1.0f : 0.0f), offset(0.0f);
+    if (encoding != VERTEX_FLOAT)
+    {
+        for (int axis = 0; axis < 3; axis++)
+            scale[axis] = hi[axis] > lo[axis] ? hi[axis] - lo[axis] : 1.0f;
+        offset = glm::vec4(lo, 0.0f);
+    }
+
+    for (size_t i = 0; i < count; i++)
+    {
+        const float* source = vertices + i * floatsPerVertex;
+        unsigned char* out = result.bytes.data() + i * format.stride;
+        glm::vec3 position = glm::make_vec3(source);
+        if (encoding == VERTEX_FLOAT)
+        {
+            std::memcpy(out, source, floatsPerVertex * sizeof(float));
+            continue;
+        }
+        uint16_t quantized[4] = { 0, 0, 0, 0 };
+        for (int axis = 0; axis < 3; axis++)
+        {
+            float unorm = (position[axis] - offset[axis]) / scale[axis];
+            quantized[axis] = (uint16_t)std::round(glm::clamp(unorm, 0.0f, 1.0f) * 65535.0f);
+            float decoded = quantized[axis] / 65535.0f * scale[axis] + offset[axis];
+            result.maxPositionError = std::max(result.maxPositionError, std::abs(decoded - position[axis]));
+        }
+        std::memcpy(out, quantized, sizeof(quantized));
+        if (format.attributes.size() > 1)
+        {
+            glm::vec3 normal = glm::normalize(glm::make_vec3(source + 3));
+            glm::vec3 decoded;
+            if (encoding == VERTEX_PACKED)
+            {
+                uint32_t packed = packNormal2_10_10_10(normal);
+                std::memcpy(out + format.attributes[1].offset, &packed, sizeof(packed));
+                decoded = glm::vec3(fromSnorm(toSnorm(normal.x, 10), 10), fromSnorm(toSnorm(normal.y, 10), 10), fromSnorm(toSnorm(normal.z, 10), 10));
+            }
+            else
+            {
+                glm::vec2 octahedral = octahedralEncode(normal);
+                int16_t packed[2] = { (int16_t)toSnorm(octahedral.x, 16), (int16_t)toSnorm(octahedral.y, 16) };
+                std::memcpy(out + format.attributes[1].offset, packed, sizeof(packed));
+                decoded = octahedralDecode(glm::vec2(fromSnorm(packed[0], 16), fromSnorm(packed[1], 16)));
+            }
+            result.maxNormalError = std::max(result.maxNormalError, angleDegrees(normal, decoded));
+        }
+        if (format.attributes.size() > 2)
+        {
+            uint16_t texCoords[2] = { glm::packHalf1x16(source[6]), glm::packHalf1x16(source[7]) };
+            std::memcpy(out + format.attributes[2].offset, texCoords, sizeof(texCoords));
+        }
+    }
+    std::memcpy(result.bytes.data() + result.decodeOffset, &scale[0], sizeof(glm::vec4));
+    std::memcpy(result.bytes.data() + result.decodeOffset + sizeof(glm::vec4), &offset[0], sizeof(glm::vec4));
+    return result;
+}
+
+inline EncodedVertices encodeVertices(const IndexedMesh& mesh, VertexEncoding encoding)
+{
+    return encodeVertices(mesh.vertices.data(), mesh.vertexCount(), mesh.floatsPerVertex, encoding);
+}
+
+// one line of the startup report: size against the float layout and the quantization error
+inline void printVertexFormat(const char* name, const EncodedVertices& encoded, int floatsPerVertex)
+{
+    std::cout << "vertices " << name << ": " << VertexFormat::name(encoded.format.encoding) << ", " << encoded.vertexCount << " x "
+        << encoded.format.stride << " bytes (float " << floatsPerVertex * sizeof(float) << "), max position error " << encoded.maxPositionError
+        << ", max normal error " << encoded.maxNormalError << " deg" << std::endl;
+}
+#endif
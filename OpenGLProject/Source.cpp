@@ -9,27 +9,73 @@
 
 #include <shader_m.h>
 #include <camera.h>
+#include <benchmark.h>
+#include <uniform_buffer.h>
+#include <lights.h>
+#include <frame_uniforms.h>
+#include <shader_variants.h>
+#include <gl_state.h>
+#include <shader_reloader.h>
+#include <thread_pool.h>
+#include <asset_loader.h>
+#include <instancing.h>
+#include <mesh_optimizer.h>
+#include <vertex_format.h>
+#include <static_batch.h>
+#include <parametric_mesh.h>
+#include <lod_selection.h>
+#include <frustum_culling.h>
+#include <clusters.h>
+#include <deferred.h>
+#include <light_culling.h>
+#include <shadows.h>
+#include <spherical_harmonics.h>
+#include <environment_map.h>
 
 #include <iostream>
 #include <cmath>
 #include <vector>
 #include <string>
+#include <random>
 
 // TODO Dodanie map wektorw normalnych/bump mapping
 // TODO Jeden z nich gadki - kula, torus lub powierzchnia Beziera
 // TODO Instrukcja
 
+// uniform handles of the lit shaders (multiple_lights, sphere), resolved once after linking.
+// lights and camera matrices are not uniforms anymore, they live in the shared "Lights"/"Frame" UBOs
+struct MaterialUniforms { Shader::Uniform diffuse, specular, shininess, objectColor; };
+struct LitShaderUniforms
+{
+	Shader::Uniform model;
+	Shader::Uniform normalMatrix;
+	Shader::Uniform lightList;
+	MaterialUniforms material;
+
+	explicit LitShaderUniforms(const Shader& shader);
+};
+
 void key_callback(GLFWwindow* window, int key, int scancode, int action, int mods);
 void framebuffer_size_callback(GLFWwindow* window, int width, int height);
 void mouse_callback(GLFWwindow* window, double xpos, double ypos);
 void scroll_callback(GLFWwindow* window, double xoffset, double yoffset);
 void processInput(GLFWwindow* window);
-unsigned int loadTexture(const char* path);
-unsigned int loadCubemapTexture(std::vector<std::string> faces);
+unsigned int uploadTexture(const AssetLoader::Image& image);
+unsigned int createCubemapTexture();
+void uploadCubemapFace(unsigned int textureID, unsigned int face, const AssetLoader::Image& image);
 void changeCameraId(int id);
-Camera getCurrentCamera();
+Camera& getCurrentCamera();
 void ChangeCameraDir(Camera_Movement direction, float deltaTime);
 glm::vec3 CountLightFront();
+glm::mat4 containerModel(const glm::vec3& position, unsigned int i);
+void setupLitShader(const Shader& shader);
+unsigned int currentLitFeatures();
+std::vector<PointLight> makeBenchmarkLights(const LightBlock& lights, size_t count);
+void benchmarkSkybox(const Shader& skyboxShader, unsigned int cubemap, unsigned int vao, UniformBuffer<FrameUniforms>& frameUBO);
+void benchmarkVertexFormats(const Shader& litShader, const IndexedMesh& cube, const IndexedMesh& sphere, UniformBuffer<FrameUniforms>& frameUBO);
+void benchmarkSurfaces();
+void benchmarkLod(const LodMesh& lods, float scale, float radius);
+void benchmarkCulling();
 
 // settings
 const unsigned int SCR_WIDTH = 1200;
@@ -51,6 +97,7 @@ float lastFrame = 0.0f;
 // lighting
 bool isDay = true;
 bool isBlinn = false;
+bool isFog = true;
 bool isSpotlightCurrCamera = true;
 float lightYaw = 0.0f;
 float lightPitch = 0.0f;
@@ -61,8 +108,117 @@ float movingObjTime = NULL;
 float movingObjRadius = 5.0f;
 float movingObjSpeed = 0.75f;
 
-int main()
+// the big sphere around the origin (U key); it encloses most containers, so it's hidden by default
+bool isSphereDrawn = false;
+// its level of detail follows the projected error (E key: always the finest level)
+bool isLodSelected = true;
+// objects outside the camera's frustum aren't drawn (X key); the shadow passes draw every caster
+bool isFrustumCulled = true;
+
+// rendering
+bool isInstanced = true;
+// static containers and lamps baked into world space batches, one draw each (O key); takes
+// precedence over isInstanced, the moving cube is then drawn on its own with uniforms
+bool isBatched = true;
+const int STRESS_INSTANCES = 100000;
+bool isClustered = false;
+bool isDeferred = false;
+bool isLightCulled = true;
+bool isShadowed = true;
+// M cycles what the skybox shows: 0 the cubemap, then the prefiltered mips, then the irradiance cube
+int skyboxView = 0;
+
+// profiling
+bool isStatsPrinted = false;
+float lastStatsTime = 0.0f;
+int statsFrames = 0;
+double statsSubmitMs = 0.0;
+
+int main(int argc, char* argv[])
 {
+	// startup timing, reported once the first frame is presented
+	Timer startupTimer;
+	bool firstFrame = true;
+	// --no-shader-cache: always compile shaders from source (cold startup)
+	ShaderCache::enabled() = !hasArg(argc, argv, "--no-shader-cache");
+	// --stress: STRESS_INSTANCES containers instead of 8, stats printed every second
+	bool isStress = hasArg(argc, argv, "--stress");
+	if (isStress)
+		isStatsPrinted = true;
+	// --bench-lights: sweep the number of point lights, clustered vs brute force vs deferred, and quit
+	bool isLightBenchmark = hasArg(argc, argv, "--bench-lights");
+	// --vertex-format float|packed|octahedral: how the meshes are stored (vertex_format.h)
+	VertexEncoding vertexEncoding = VertexFormat::parse(argValue(argc, argv, "--vertex-format"), VERTEX_PACKED);
+
+	// --bench-surfaces: tessellation speed of the parametric surfaces and quit, no window needed
+	if (hasArg(argc, argv, "--bench-surfaces"))
+	{
+		benchmarkSurfaces();
+		return 0;
+	}
+	// --bench-culling: frustum tests of a million bounding volumes and quit, no window needed
+	if (hasArg(argc, argv, "--bench-culling"))
+	{
+		benchmarkCulling();
+		return 0;
+	}
+
+	// start reading and decoding all assets on worker threads right away,
+	// the window and the GL context come up in the meantime
+	// ---------------------------------------------------------------------
+	ThreadPool threadPool;
+	AssetLoader assets(threadPool, startupTimer);
+	int lightingSources = assets.loadShaderSources("multiple_lights.vs", "multiple_lights.fs");
+	int sphereSources = assets.loadShaderSources("sphere.vs", "sphere.fs");
+	int lightCubeSources = assets.loadShaderSources("light_cube.vs", "light_cube.fs");
+	int skyboxSources = assets.loadShaderSources("skybox.vs", "skybox.fs");
+
+	int normalMapImage = assets.loadImage("resources/textures/brickwall_normal.jpg");
+
+	// Cubemaps
+	std::vector<std::string> faces
+	{
+		"resources/textures/right.jpg",
+		"resources/textures/left.jpg",
+		"resources/textures/top.jpg",
+		"resources/textures/bottom.jpg",
+		"resources/textures/front.jpg",
+		"resources/textures/back.jpg"
+	};
+	std::vector<std::string> facesNight
+	{
+		"resources/textures/right_night.jpg",
+		"resources/textures/left_night.jpg",
+		"resources/textures/top_night.jpg",
+		"resources/textures/bottom_night.jpg",
+		"resources/textures/front_night.jpg",
+		"resources/textures/back_night.jpg"
+	};
+	// image ids of the faces are consecutive; the skybox samples mips, the workers build them
+	int firstFaceImage = -1, firstNightFaceImage = -1;
+	for (unsigned int i = 0; i < faces.size(); i++)
+	{
+		int id = assets.loadImage(faces[i], true);
+		if (i == 0)
+			firstFaceImage = id;
+	}
+	for (unsigned int i = 0; i < facesNight.size(); i++)
+	{
+		int id = assets.loadImage(facesNight[i], true);
+		if (i == 0)
+			firstNightFaceImage = id;
+	}
+	// sky ambient of both cubemaps, read from the cache next to the faces or projected on the
+	// workers as the faces arrive (--no-ambient-cache: always projected)
+	bool isAmbientCached = !hasArg(argc, argv, "--no-ambient-cache");
+	CubemapAmbient dayAmbient(threadPool, faces, isAmbientCached);
+	CubemapAmbient nightAmbient(threadPool, facesNight, isAmbientCached);
+	// GGX prefiltered mips and irradiance cubes for reflective materials, built the same way
+	// (--no-environment-cache: always built)
+	bool isEnvironmentCached = !hasArg(argc, argv, "--no-environment-cache");
+	EnvironmentMap dayEnvironment(threadPool, faces, isEnvironmentCached);
+	EnvironmentMap nightEnvironment(threadPool, facesNight, isEnvironmentCached);
+
 	// glfw: initialize and configure
 	// ------------------------------
 	glfwInit();
@@ -103,18 +259,98 @@ int main()
 	// configure global opengl state
 	// -----------------------------
 	glEnable(GL_DEPTH_TEST);
-
-	// load textures
-   // -------------
-	unsigned int normalMap = loadTexture("resources/textures/brickwall_normal.jpg");
-
+	// filter across cube faces, the prefiltered environment mips are only a few texels wide
+	glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
 
 	// build and compile our shader zprogram
 	// ------------------------------------
-	Shader lightingShader("multiple_lights.vs", "multiple_lights.fs");
+	// sources were read by the loader threads, compiling needs the GL context
+	assets.waitForShaderSources();
+	Timer compileTimer;
+	// lit shaders are compiled per feature set (see shader_variants.h), the variant
+	// matching the current settings is picked every frame; the startup one is built here
+	ShaderVariants<LitShaderUniforms> lightingShaders("multiple_lights.vs", "multiple_lights.fs", SHADER_BLINN | SHADER_FOG | SHADER_FLASHLIGHT | SHADER_INSTANCED | SHADER_CLUSTERED | SHADER_CULLED | SHADER_SHADOWS, setupLitShader);
+	lightingShaders.get(currentLitFeatures());
+	assets.addMainThreadTime(lightingSources, compileTimer.elapsedMs());
+	compileTimer.reset();
+	ShaderVariants<LitShaderUniforms> sphereShaders("sphere.vs", "sphere.fs", SHADER_FLASHLIGHT | SHADER_CLUSTERED | SHADER_CULLED | SHADER_SHADOWS, setupLitShader);
+	sphereShaders.get(currentLitFeatures());
+	assets.addMainThreadTime(sphereSources, compileTimer.elapsedMs());
+	compileTimer.reset();
 	Shader lightCubeShader("light_cube.vs", "light_cube.fs");
-	Shader sphereShader("sphere.vs", "sphere.fs");
+	Shader lightCubeInstancedShader("light_cube.vs", "light_cube.fs", "#define INSTANCED\n");
+	assets.addMainThreadTime(lightCubeSources, compileTimer.elapsedMs());
+	compileTimer.reset();
 	Shader skyboxShader("skybox.vs", "skybox.fs");
+	assets.addMainThreadTime(skyboxSources, compileTimer.elapsedMs());
+	// deferred path (G key), its variants are compiled on first use
+	ShaderVariants<LitShaderUniforms> gbufferShaders("multiple_lights.vs", "gbuffer.fs", SHADER_BLINN | SHADER_FOG | SHADER_INSTANCED, setupLitShader);
+	ShaderVariants<LitShaderUniforms> deferredLightShaders("deferred.vs", "deferred_light.fs", SHADER_FLASHLIGHT | SHADER_SHADOWS, setupDeferredShader);
+	Shader sphereGBufferShader("sphere.vs", "gbuffer.fs");
+	Shader lightVolumeShader("light_volume.vs", "light_volume.fs");
+	// shadow casters (H key)
+	Shader shadowDepthShader("shadow_depth.vs", "shadow_depth.fs");
+	Shader shadowDepthInstancedShader("shadow_depth.vs", "shadow_depth.fs", "#define INSTANCED\n");
+	// later builds (other variants, hot reload) read the files again
+	Shader::clearPreloadedSources();
+
+	// --bench-uniforms: compare string lookups against cached handles and quit
+	if (hasArg(argc, argv, "--bench-uniforms"))
+	{
+		benchmarkUniformUploads(lightingShaders.get(currentLitFeatures()).shader, "lightingShader");
+		benchmarkUniformUploads(sphereShaders.get(currentLitFeatures()).shader, "sphereShader");
+		glfwTerminate();
+		return 0;
+	}
+
+	// resolve uniform handles once, the render loop never looks uniforms up by name
+	Shader::Uniform lightCubeModel = lightCubeShader.uniform("model");
+
+	// edited shader files are recompiled in the background and swapped in (--no-hot-reload to turn off)
+	ShaderReloader shaderReloader(!hasArg(argc, argv, "--no-hot-reload"));
+	lightingShaders.watch(shaderReloader);
+	sphereShaders.watch(shaderReloader);
+	gbufferShaders.watch(shaderReloader);
+	deferredLightShaders.watch(shaderReloader);
+	shaderReloader.watch(lightCubeShader, [&]()
+	{
+		lightCubeModel = lightCubeShader.uniform("model");
+		lightCubeShader.bindUniformBlock("Frame", FRAME_BINDING);
+	});
+	shaderReloader.watch(lightCubeInstancedShader, [&]()
+	{
+		lightCubeInstancedShader.bindUniformBlock("Frame", FRAME_BINDING);
+	});
+	Shader::Uniform skyboxLod = skyboxShader.uniform("skyboxLod");
+	shaderReloader.watch(skyboxShader, [&]()
+	{
+		skyboxLod = skyboxShader.uniform("skyboxLod");
+		skyboxShader.use();
+		skyboxShader.setInt("skybox", 0);
+		skyboxShader.bindUniformBlock("Frame", FRAME_BINDING);
+	});
+	LitShaderUniforms sphereGBufferUniforms(sphereGBufferShader);
+	shaderReloader.watch(sphereGBufferShader, [&]()
+	{
+		sphereGBufferUniforms = LitShaderUniforms(sphereGBufferShader);
+		sphereGBufferShader.bindUniformBlock("Frame", FRAME_BINDING);
+	});
+	shaderReloader.watch(lightVolumeShader, [&]()
+	{
+		setupDeferredShader(lightVolumeShader);
+	});
+	Shader::Uniform shadowDepthModel = shadowDepthShader.uniform("model");
+	Shader::Uniform shadowDepthLightSpace = shadowDepthShader.uniform("lightSpace");
+	Shader::Uniform shadowDepthInstancedLightSpace = shadowDepthInstancedShader.uniform("lightSpace");
+	shaderReloader.watch(shadowDepthShader, [&]()
+	{
+		shadowDepthModel = shadowDepthShader.uniform("model");
+		shadowDepthLightSpace = shadowDepthShader.uniform("lightSpace");
+	});
+	shaderReloader.watch(shadowDepthInstancedShader, [&]()
+	{
+		shadowDepthInstancedLightSpace = shadowDepthInstancedShader.uniform("lightSpace");
+	});
 
 	// set up vertex data (and buffer(s)) and configure vertex attributes
 	// ------------------------------------------------------------------
@@ -182,181 +418,174 @@ int main()
 		glm::vec3(-4.0f,  2.0f, -12.0f),
 		glm::vec3(0.0f,  0.0f, -3.0f)
 	};
-	float skyboxVertices[] = {
-		// positions          
-		-1.0f,  1.0f, -1.0f,
-		-1.0f, -1.0f, -1.0f,
-		 1.0f, -1.0f, -1.0f,
-		 1.0f, -1.0f, -1.0f,
-		 1.0f,  1.0f, -1.0f,
-		-1.0f,  1.0f, -1.0f,
-
-		-1.0f, -1.0f,  1.0f,
-		-1.0f, -1.0f, -1.0f,
-		-1.0f,  1.0f, -1.0f,
-		-1.0f,  1.0f, -1.0f,
-		-1.0f,  1.0f,  1.0f,
-		-1.0f, -1.0f,  1.0f,
-
-		 1.0f, -1.0f, -1.0f,
-		 1.0f, -1.0f,  1.0f,
-		 1.0f,  1.0f,  1.0f,
-		 1.0f,  1.0f,  1.0f,
-		 1.0f,  1.0f, -1.0f,
-		 1.0f, -1.0f, -1.0f,
-
-		-1.0f, -1.0f,  1.0f,
-		-1.0f,  1.0f,  1.0f,
-		 1.0f,  1.0f,  1.0f,
-		 1.0f,  1.0f,  1.0f,
-		 1.0f, -1.0f,  1.0f,
-		-1.0f, -1.0f,  1.0f,
-
-		-1.0f,  1.0f, -1.0f,
-		 1.0f,  1.0f, -1.0f,
-		 1.0f,  1.0f,  1.0f,
-		 1.0f,  1.0f,  1.0f,
-		-1.0f,  1.0f,  1.0f,
-		-1.0f,  1.0f, -1.0f,
-
-		-1.0f, -1.0f, -1.0f,
-		-1.0f, -1.0f,  1.0f,
-		 1.0f, -1.0f, -1.0f,
-		 1.0f, -1.0f, -1.0f,
-		-1.0f, -1.0f,  1.0f,
-		 1.0f, -1.0f,  1.0f
-	};
+
+	// the cube's 36 vertices repeat every corner of a face, index and reorder them once
+	IndexedMesh cubeMesh = optimizeMesh("cube", triangleListMesh(cubeVertices, 36, 8));
+	PackedIndices cubeIndices = packIndices(cubeMesh.indices, cubeMesh.vertexCount());
 
 	// first, configure the cube's VAO (and VBO)
-	unsigned int cubeVBO, cubeVAO;
+	unsigned int cubeVBO, cubeVAO, cubeEBO;
 	glGenVertexArrays(1, &cubeVAO);
 	glGenBuffers(1, &cubeVBO);
-
-	glBindBuffer(GL_ARRAY_BUFFER, cubeVBO);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(cubeVertices), cubeVertices, GL_STATIC_DRAW);
+	glGenBuffers(1, &cubeEBO);
 
 	glBindVertexArray(cubeVAO);
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)0);
-	glEnableVertexAttribArray(0);
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(3 * sizeof(float)));
-	glEnableVertexAttribArray(1);
-	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)(6 * sizeof(float)));
-	glEnableVertexAttribArray(2);
-
-	// second, configure the light's VAO (VBO stays the same; the vertices are the same for the light object which is also a 3D cube)
-	unsigned int lightCubeVAO;
-	glGenVertexArrays(1, &lightCubeVAO);
-	glBindVertexArray(lightCubeVAO);
-
 	glBindBuffer(GL_ARRAY_BUFFER, cubeVBO);
-	// note that we update the lamp's position attribute's stride to reflect the updated buffer data
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 8 * sizeof(float), (void*)0);
-	glEnableVertexAttribArray(0);
-
-	// Cubemaps
-	std::vector<std::string> faces
+	// the attribute pointers follow from the encoding
+	EncodedVertices cubeVertexData = encodeVertices(cubeMesh, vertexEncoding);
+	cubeVertexData.upload();
+	printVertexFormat("cube", cubeVertexData, cubeMesh.floatsPerVertex);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, cubeEBO);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, cubeIndices.bytes(), cubeIndices.data(), GL_STATIC_DRAW);
+
+	// per-instance model/normal matrices of the containers, drawn with one instanced call.
+	// the last instance is the moving cube, its matrix is updated every frame
+	// ------------------------------------------------------------------------------------
+	InstanceBuffer containerInstances;
+	if (isStress || isLightBenchmark)
 	{
-		"resources/textures/right.jpg",
-		"resources/textures/left.jpg",
-		"resources/textures/top.jpg",
-		"resources/textures/bottom.jpg",
-		"resources/textures/front.jpg",
-		"resources/textures/back.jpg"
-	};
-	std::vector<std::string> facesNight
-	{
-		"resources/textures/right_night.jpg",
-		"resources/textures/left_night.jpg",
-		"resources/textures/top_night.jpg",
-		"resources/textures/bottom_night.jpg",
-		"resources/textures/front_night.jpg",
-		"resources/textures/back_night.jpg"
-	};
-
-	unsigned int cubemapTexture = loadCubemapTexture(faces);
-	unsigned int cubemapTextureNight = loadCubemapTexture(facesNight);
-	unsigned int skyboxVAO, skyboxVBO;
-	glGenVertexArrays(1, &skyboxVAO);
-	glGenBuffers(1, &skyboxVBO);
-	glBindVertexArray(skyboxVAO);
-	glBindBuffer(GL_ARRAY_BUFFER, skyboxVBO);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(skyboxVertices), &skyboxVertices, GL_STATIC_DRAW);
-	glEnableVertexAttribArray(0);
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void*)0);
-
-#pragma region Sphere
-	const float PI = acos(-1.0f);
-
-	int sectorCount = 36;
-	int stackCount = 18;
-	float sphereRadius = 5.0f;
-	float x, y, z, xy;                              // vertex position
-	float nx, ny, nz, lengthInv = 1.0f / sphereRadius;    // normal
-	float s, t;                                     // texCoord
-
-	float sectorStep = 2 * PI / sectorCount;
-	float stackStep = PI / stackCount;
-	float sectorAngle, stackAngle;
-
-	std::vector<GLfloat> sphereVertices;
-	for (int i = 0; i <= stackCount; ++i)
-	{
-		stackAngle = PI / 2 - i * stackStep;        // starting from pi/2 to -pi/2
-		xy = sphereRadius * cosf(stackAngle);             // r * cos(u)
-		z = sphereRadius * sinf(stackAngle);              // r * sin(u)
-
-		// add (sectorCount+1) vertices per stack
-		// the first and last vertices have same position and normal, but different tex coords
-		for (int j = 0; j <= sectorCount; ++j)
+		// a 100 x 10 x 100 grid below the scene; the light benchmark only uses its top layer as a lit floor
+		int count = isStress ? STRESS_INSTANCES : STRESS_INSTANCES / 10;
+		for (int i = 0; i < count; i++)
 		{
-			sectorAngle = j * sectorStep;           // starting from 0 to 2pi
-
-			// vertex position
-			x = xy * cosf(sectorAngle);
-			sphereVertices.push_back(x);      // x = r * cos(u) * cos(v)
-			y = xy * sinf(sectorAngle);
-			sphereVertices.push_back(y);      // y = r * cos(u) * sin(v)
-			sphereVertices.push_back(z);
-
-			// normalized vertex normal
-			sphereVertices.push_back(x * lengthInv);
-			sphereVertices.push_back(y * lengthInv);
-			sphereVertices.push_back(z * lengthInv);
-
+			glm::vec3 position((i % 100 - 50) * 2.0f, -4.0f - (i / 10000) * 2.0f, -((i / 100) % 100) * 2.0f);
+			containerInstances.instances.push_back(makeInstance(containerModel(position, i)));
 		}
 	}
-
-	std::vector<unsigned int> indices;
-
-	// indices
-	//  k1--k1+1
-	//  |  / |
-	//  | /  |
-	//  k2--k2+1
-	unsigned int k1, k2;
-	for (int i = 0; i < stackCount; ++i)
+	else
 	{
-		k1 = i * (sectorCount + 1);     // beginning of current stack
-		k2 = k1 + sectorCount + 1;      // beginning of next stack
+		for (unsigned int i = 1; i < 9; i++)
+			containerInstances.instances.push_back(makeInstance(containerModel(cubePositions[i], i)));
+	}
+	size_t movingInstance = containerInstances.instances.size();
+	containerInstances.instances.push_back(makeInstance(glm::mat4(1.0f)));
+	containerInstances.upload();
+	// the non-instanced shaders simply don't read the instance attributes
+	containerInstances.setupAttributes();
+
+	// bounding spheres and per-draw light lists of the containers (K key, see light_culling.h);
+	// the lists are rebuilt every frame because the spot lights move
+	const float containerRadius = std::sqrt(0.75f);
+	std::vector<BoundingSphere> containerBounds;
+	for (const InstanceData& instance : containerInstances.instances)
+		containerBounds.push_back(transformBounds(instance.model, containerRadius));
+	LightListBuffer containerLightLists;
+	containerLightLists.lists.resize(containerBounds.size());
+	containerLightLists.upload();
+	containerLightLists.setupAttributes();
+	LightCuller lightCuller;
+
+	// the same spheres tested against the camera's frustum (X key); instanced, the visible
+	// containers are copied into a second instance buffer drawn with its own VAO, the full one
+	// stays as it is for the shadow passes
+	SphereSet containerCullSpheres;
+	for (const BoundingSphere& bounds : containerBounds)
+		containerCullSpheres.add(bounds);
+	std::vector<uint32_t> visibleContainers;
+	size_t visibleContainerCount = containerBounds.size();
+	InstanceBuffer visibleInstances;
+	LightListBuffer visibleLightLists;
+	unsigned int visibleCubeVAO;
+	glGenVertexArrays(1, &visibleCubeVAO);
+	glBindVertexArray(visibleCubeVAO);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, cubeEBO);
+	glBindBuffer(GL_ARRAY_BUFFER, cubeVBO);
+	cubeVertexData.format.setupAttributes(cubeVertexData.decodeOffset);
+	visibleInstances.setupAttributes();
+	visibleLightLists.setupAttributes();
+	glBindVertexArray(cubeVAO);
 
-		for (int j = 0; j < sectorCount; ++j, ++k1, ++k2)
+	// the light cubes are drawn with cubeVAO as well when they aren't instanced (light_cube.vs
+	// only reads the position), so switching from the containers to the lamps doesn't need a VAO bind
+	InstanceBuffer lampInstances;
+	for (unsigned int i = 0; i < 4; i++)
+	{
+		glm::mat4 model = glm::mat4(1.0f);
+		model = glm::translate(model, pointLightPositions[i]);
+		model = glm::scale(model, glm::vec3(0.2f)); // Make it a smaller cube
+		lampInstances.instances.push_back(makeInstance(model));
+	}
+	lampInstances.upload();
+	SphereSet lampCullSpheres;
+	for (const InstanceData& lamp : lampInstances.instances)
+		lampCullSpheres.add(transformBounds(lamp.model, containerRadius));
+	std::vector<uint32_t> visibleLamps;
+	size_t visibleLampCount = lampCullSpheres.size();
+
+	unsigned int lampVAO;
+	glGenVertexArrays(1, &lampVAO);
+	glBindVertexArray(lampVAO);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, cubeEBO);
+	glBindBuffer(GL_ARRAY_BUFFER, cubeVBO);
+	cubeVertexData.format.setupAttributes(cubeVertexData.decodeOffset);
+	lampInstances.setupAttributes();
+
+	// static batches of the scene (O key): the containers but the moving one share the lit shader
+	// and material, the lamps the light cube shader; the stress grid stays instanced
+	StaticBatch containerBatch;
+	StaticBatch lampBatch;
+	if (!isStress && !isLightBenchmark)
+	{
+		for (size_t i = 0; i < movingInstance; i++)
+			containerBatch.add(cubeMesh, containerInstances.instances[i].model);
+		containerBatch.upload(vertexEncoding);
+		for (const InstanceData& lamp : lampInstances.instances)
+			lampBatch.add(cubeMesh, lamp.model);
+		lampBatch.upload(vertexEncoding);
+	}
+	glm::uvec2 containerBatchLightList(0);
+	bool isContainerBatchVisible = true, isMovingVisible = true, isLampBatchVisible = true, isSphereVisible = true;
+	double cullMs = 0.0;
+
+	// textures: upload every image as soon as a loader thread has decoded it
+	// -----------------------------------------------------------------------
+	unsigned int normalMap = 0;
+	unsigned int cubemapTexture = createCubemapTexture();
+	unsigned int cubemapTextureNight = createCubemapTexture();
+	assets.uploadImages([&](const AssetLoader::Image& image)
+	{
+		if (image.id == normalMapImage)
+			normalMap = uploadTexture(image);
+		else if (image.id >= firstFaceImage && image.id < firstFaceImage + (int)faces.size())
 		{
-			// 2 triangles per sector excluding 1st and last stacks
-			if (i != 0)
-			{
-				indices.push_back(k1);   // k1---k2---k1+
-				indices.push_back(k2);
-				indices.push_back(k1 + 1);
-			}
-
-			if (i != (stackCount - 1))
-			{
-				indices.push_back(k1 + 1); // k1+1---k2---k2+1
-				indices.push_back(k2);
-				indices.push_back(k2 + 1);
-			}
+			uploadCubemapFace(cubemapTexture, image.id - firstFaceImage, image);
+			dayAmbient.addFace(image.id - firstFaceImage, image);
+			dayEnvironment.addFace(image.id - firstFaceImage, image);
+		}
+		else if (image.id >= firstNightFaceImage && image.id < firstNightFaceImage + (int)facesNight.size())
+		{
+			uploadCubemapFace(cubemapTextureNight, image.id - firstNightFaceImage, image);
+			nightAmbient.addFace(image.id - firstNightFaceImage, image);
+			nightEnvironment.addFace(image.id - firstNightFaceImage, image);
 		}
+	});
+	dayEnvironment.prefilter();
+	nightEnvironment.prefilter();
+	const SHAmbient& dayAmbientSH = dayAmbient.get();
+	const SHAmbient& nightAmbientSH = nightAmbient.get();
+	dayEnvironment.upload();
+	nightEnvironment.upload();
+	// the skybox and the deferred lighting pass are fullscreen triangles without attributes
+	unsigned int fullscreenVAO;
+	glGenVertexArrays(1, &fullscreenVAO);
+
+#pragma region Sphere
+	// levels of detail of the sphere in one buffer (parametric_mesh.h), the finest as the 36 x 18
+	// UV sphere built here before
+	const float sphereRadius = 5.0f;
+	SphereSurface sphereSurface(sphereRadius);
+	LodMesh sphereLods = surfaceLods(sphereSurface, { glm::ivec2(36, 18), glm::ivec2(24, 12), glm::ivec2(16, 8), glm::ivec2(8, 4) }, &threadPool);
+	sphereLods.print("sphere");
+	// --bench-lod: the sphere's level along a camera path away from it and back and quit (the
+	// scene draws it scaled by 2)
+	if (hasArg(argc, argv, "--bench-lod"))
+	{
+		benchmarkLod(sphereLods, 2.0f, sphereRadius);
+		glfwTerminate();
+		return 0;
 	}
+	const IndexedMesh& sphereMesh = sphereLods.mesh;
+	PackedIndices sphereIndices = packIndices(sphereMesh.indices, sphereMesh.vertexCount());
 
 	unsigned int sphereVBO, sphereVAO, sphereEBO;
 	glGenVertexArrays(1, &sphereVAO);
@@ -366,15 +595,12 @@ int main()
 	glBindVertexArray(sphereVAO);
 
 	glBindBuffer(GL_ARRAY_BUFFER, sphereVBO);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(sphereVertices), sphereVertices.data(), GL_STATIC_DRAW);
+	EncodedVertices sphereVertexData = encodeVertices(sphereMesh, vertexEncoding);
+	sphereVertexData.upload();
+	printVertexFormat("sphere", sphereVertexData, sphereMesh.floatsPerVertex);
 
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, sphereEBO);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices.data(), GL_STATIC_DRAW);
-
-	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)0);
-	glEnableVertexAttribArray(0);
-	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(float), (void*)(3 * sizeof(float)));
-	glEnableVertexAttribArray(1);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sphereIndices.bytes(), sphereIndices.data(), GL_STATIC_DRAW);
 
 #pragma endregion
 
@@ -382,7 +608,183 @@ int main()
 	// --------------------
 	skyboxShader.use();
 	skyboxShader.setInt("skybox", 0);
+	lightCubeShader.bindUniformBlock("Frame", FRAME_BINDING);
+	lightCubeInstancedShader.bindUniformBlock("Frame", FRAME_BINDING);
+	skyboxShader.bindUniformBlock("Frame", FRAME_BINDING);
+	sphereGBufferShader.bindUniformBlock("Frame", FRAME_BINDING);
+	setupDeferredShader(lightVolumeShader);
+
+	// camera matrices shared by all shaders, filled once per frame
+	UniformBuffer<FrameUniforms> frameUBO(FRAME_BINDING);
+
+	// --bench-skybox: time the skybox pass alone at several resolutions and quit
+	if (hasArg(argc, argv, "--bench-skybox"))
+	{
+		benchmarkSkybox(skyboxShader, isDay ? cubemapTexture : cubemapTextureNight, fullscreenVAO, frameUBO);
+		glfwTerminate();
+		return 0;
+	}
+
+	// lights shared by all lit shaders, set up here in world space; every frame they are
+	// moved into view space in lightsUBO and only the values that change are re-uploaded
+	// -------------------------------------------------------------------------------
+	UniformBuffer<LightBlock> lightsUBO(LIGHTS_BINDING);
+	LightBlock lights = LightBlock();
+	// directional light
+	lights.dirLight.direction = glm::vec3(-0.2f, -1.0f, -0.3f);
+	lights.dirLight.diffuse = glm::vec3(0.4f, 0.4f, 0.4f);
+	lights.dirLight.specular = glm::vec3(0.5f, 0.5f, 0.5f);
+	// point lights
+	for (int i = 0; i < NR_POINT_LIGHTS; i++)
+	{
+		lights.pointLights[i].position = pointLightPositions[i];
+		lights.pointLights[i].ambient = glm::vec3(0.05f, 0.05f, 0.05f);
+		lights.pointLights[i].diffuse = glm::vec3(0.8f, 0.8f, 0.8f);
+		lights.pointLights[i].specular = glm::vec3(1.0f, 1.0f, 1.0f);
+		lights.pointLights[i].constant = 1.0f;
+		lights.pointLights[i].linear = 0.09f;
+		lights.pointLights[i].quadratic = 0.032f;
+	}
+	// spot lights: [0] flashlight of the current camera, [1] light attached to the moving cube
+	for (int i = 0; i < NR_SPOT_LIGHTS; i++)
+	{
+		lights.spotLight[i].ambient = glm::vec3(0.0f, 0.0f, 0.0f);
+		lights.spotLight[i].constant = 1.0f;
+		lights.spotLight[i].linear = 0.09f;
+		lights.spotLight[i].quadratic = 0.032f;
+		lights.spotLight[i].cutOff = glm::cos(glm::radians(12.5f));
+		lights.spotLight[i].outerCutOff = glm::cos(glm::radians(15.0f));
+	}
+	for (int i = 0; i < NR_SPOT_LIGHTS; i++)
+	{
+		lights.spotLight[i].diffuse = glm::vec3(1.0f, 1.0f, 1.0f);
+		lights.spotLight[i].specular = glm::vec3(1.0f, 1.0f, 1.0f);
+	}
+
+	// --bench-vertex-formats: draw instanced grids of the meshes in every vertex format and quit
+	if (hasArg(argc, argv, "--bench-vertex-formats"))
+	{
+		lightsUBO.data = lights;
+		lightsUBO.upload();
+		benchmarkVertexFormats(lightingShaders.get(SHADER_INSTANCED).shader, cubeMesh, optimizeMesh(NULL, tessellateSurface(sphereSurface, 36, 18)), frameUBO);
+		glfwTerminate();
+		return 0;
+	}
+
+	// clustered forward shading (C key): every fragment only evaluates the point lights listed
+	// for its froxel instead of looping over the Lights block; the lists are rebuilt every frame
+	// --------------------------------------------------------------------------------------------
+	std::vector<PointLight> pointLights(lights.pointLights, lights.pointLights + NR_POINT_LIGHTS);
+	ClusterGrid clusters(16, 9, 24);
+
+	// deferred shading (G key): the G-buffer follows the framebuffer size, the point lights
+	// are drawn as light volumes and the fullscreen pass is a triangle without attributes
+	// -------------------------------------------------------------------------------------
+	GBuffer gbuffer;
+	LightVolumes lightVolumes;
+
+	// cascaded shadow maps of the directional light (H key); the static containers and the
+	// sphere are cached, only the moving cube is drawn every frame (--no-shadow-cache: all of them)
+	// -------------------------------------------------------------------------------------------
+	CascadedShadowMap shadowMap(1024, 50.0f);
+	bool isShadowCached = !hasArg(argc, argv, "--no-shadow-cache");
+
+	// spot light shadows share one atlas, tiles of 128..1024 texels by screen coverage; at most
+	// one full size tile is redrawn per frame (--no-shadow-cache: every tile, every frame)
+	SpotShadowAtlas spotShadows(2048, 128, 1024, isShadowCached ? 1024 * 1024 : 0);
+	glm::mat4 lastModelMoving = glm::mat4(0.0f);
+	bool lastSphereDrawn = isSphereDrawn;
+
+	// level of detail of the sphere, picked every frame from its error in pixels (lod_selection.h);
+	// lodTrianglesSaved counts what the coarser level left out against the finest one
+	LodSelector sphereLodSelector;
+	size_t sphereLevel = 0, lastSphereLevel = 0;
+	float sphereLodPixels = 0.0f;
+	unsigned int lodTrianglesSaved = 0, frameLodTrianglesSaved = 0;
+	auto drawSphere = [&]()
+	{
+		glState().bindVertexArray(sphereVAO);
+		glState().drawElements(GL_TRIANGLES, sphereLods.levels[sphereLevel].indexCount, sphereIndices.type, sphereLods.indexOffset(sphereLevel, sphereIndices.type));
+		lodTrianglesSaved += (unsigned int)(sphereLods.triangleCount(0) - sphereLods.triangleCount(sphereLevel));
+	};
+
+	// --bench-lights: renders the scene with 4..4096 point lights, clustered, brute force
+	// (the same shader with one froxel, every fragment loops over all lights in view) and deferred
+	const size_t benchLightCounts[] = { 4, 16, 64, 256, 1024, 4096 };
+	const size_t benchLightSteps = sizeof(benchLightCounts) / sizeof(benchLightCounts[0]);
+	const double benchBruteForceLimitMs = 2000.0;
+	bool isBruteForceSkipped = false;
+	FrameSweep lightSweep(benchLightSteps * 3, 3, 10);
+	if (isLightBenchmark)
+	{
+		isClustered = true;
+		std::cout << "--bench-lights: ms/frame of the whole scene, brute force stops above " << benchBruteForceLimitMs << " ms/frame" << std::endl;
+	}
+
+	// containers are drawn by the forward and the G-buffer pass, the CPU time of issuing them is part of the stats
+	auto drawContainers = [&](const Shader& shader, const LitShaderUniforms& uniforms)
+	{
+		Timer submitTimer;
+		if (isBatched)
+		{
+			// the static containers are already in world space, the moving cube is one more draw
+			shader.setMat4(uniforms.model, glm::mat4(1.0f));
+			shader.setMat3(uniforms.normalMatrix, glm::mat3(1.0f));
+			shader.setUvec2(uniforms.lightList, containerBatchLightList);
+			if (isContainerBatchVisible)
+				containerBatch.draw();
+			if (isMovingVisible)
+			{
+				const InstanceData& moving = containerInstances.instances[movingInstance];
+				shader.setMat4(uniforms.model, moving.model);
+				shader.setMat3(uniforms.normalMatrix, moving.normalMatrix);
+				shader.setUvec2(uniforms.lightList, containerLightLists.lists[movingInstance]);
+				glState().bindVertexArray(cubeVAO);
+				glState().drawElements(GL_TRIANGLES, cubeIndices.count(), cubeIndices.type, 0);
+			}
+		}
+		else if (isInstanced && isFrustumCulled)
+		{
+			// only the visible instances and their light lists, in a buffer of their own
+			visibleInstances.instances.resize(visibleContainerCount);
+			visibleLightLists.lists.resize(visibleContainerCount);
+			for (size_t i = 0; i < visibleContainerCount; i++)
+			{
+				visibleInstances.instances[i] = containerInstances.instances[visibleContainers[i]];
+				visibleLightLists.lists[i] = containerLightLists.lists[visibleContainers[i]];
+			}
+			if (visibleContainerCount > 0)
+			{
+				visibleInstances.upload();
+				visibleLightLists.upload();
+				glState().bindVertexArray(visibleCubeVAO);
+				glState().drawElementsInstanced(GL_TRIANGLES, cubeIndices.count(), cubeIndices.type, 0, visibleInstances.count());
+			}
+		}
+		else if (isInstanced)
+		{
+			glState().bindVertexArray(cubeVAO);
+			containerInstances.update(movingInstance);
+			glState().drawElementsInstanced(GL_TRIANGLES, cubeIndices.count(), cubeIndices.type, 0, containerInstances.count());
+		}
+		else
+		{
+			// one draw per container, model matrix passed as a uniform
+			glState().bindVertexArray(cubeVAO);
+			for (size_t visible = 0; visible < visibleContainerCount; visible++)
+			{
+				size_t i = isFrustumCulled ? visibleContainers[visible] : visible;
+				shader.setMat4(uniforms.model, containerInstances.instances[i].model);
+				shader.setMat3(uniforms.normalMatrix, containerInstances.instances[i].normalMatrix);
+				shader.setUvec2(uniforms.lightList, containerLightLists.lists[i]);
+				glState().drawElements(GL_TRIANGLES, cubeIndices.count(), cubeIndices.type, 0);
+			}
+		}
+		statsSubmitMs += submitTimer.elapsedMs();
+	};
 
+	// setup above bound VAOs and textures directly, start the loop from a known state
+	glState().invalidate();
 
 	// render loop
 	// -----------
@@ -393,11 +795,107 @@ int main()
 		float currentFrame = static_cast<float>(glfwGetTime());
 		deltaTime = currentFrame - lastFrame;
 		lastFrame = currentFrame;
+		Timer frameTimer;
+
+		// benchmark step: three modes per light count, clustered, brute force and deferred
+		if (isLightBenchmark)
+		{
+			size_t lightCount = benchLightCounts[lightSweep.step() / 3];
+			if (pointLights.size() != lightCount)
+				pointLights = makeBenchmarkLights(lights, lightCount);
+			size_t mode = lightSweep.step() % 3;
+			isDeferred = mode == 2;
+			isClustered = !isDeferred;
+			if (mode == 0)
+				clusters.setDims(16, 9, 24);
+			else
+				clusters.setDims(1, 1, 1);
+		}
+
+		// state change and uniform upload counters of the previous frame, printed once a second (I key)
+		glState().beginFrame();
+		frameLodTrianglesSaved = lodTrianglesSaved;
+		lodTrianglesSaved = 0;
+		Shader::UploadStats uniformStats = Shader::uploadStats();
+		Shader::uploadStats() = Shader::UploadStats();
+		if (firstFrame)
+		{
+			lastStatsTime = currentFrame;
+			statsSubmitMs = 0.0;
+		}
+		else if (isStatsPrinted && currentFrame - lastStatsTime >= 1.0f)
+		{
+			std::cout << "frame: " << (currentFrame - lastStatsTime) * 1000.0f / statsFrames << " ms, containers submitted in "
+				<< statsSubmitMs / statsFrames << " ms (" << containerInstances.count() << " containers, ";
+			if (isBatched)
+				std::cout << "batched: " << containerBatch.meshCount() << " static in one draw of " << containerBatch.vertexCount()
+					<< " vertices (" << containerBatch.vertexBytes() << " bytes), " << containerBatch.indexCount() << " indices, the moving one alone)" << std::endl;
+			else
+				std::cout << (isInstanced ? "instanced" : "one draw each") << ")" << std::endl;
+			statsFrames = 0;
+			statsSubmitMs = 0.0;
+			glState().printFrameCounters();
+			if (isFrustumCulled)
+			{
+				std::cout << "frustum: " << visibleContainerCount << " of " << containerBounds.size() << " containers, " << visibleLampCount
+					<< " of " << lampCullSpheres.size() << " lamps";
+				if (isBatched)
+					std::cout << " (container batch " << (isContainerBatchVisible ? "in" : "out") << ", lamp batch " << (isLampBatchVisible ? "in" : "out") << ")";
+				std::cout << ", sphere " << (isSphereVisible ? "in" : "out") << ", tested in " << cullMs << " ms ("
+					<< cullingPathName(CULL_BEST) << ")" << std::endl;
+			}
+			if (isSphereDrawn)
+				std::cout << "lod: sphere level " << sphereLevel << " of " << sphereLods.levels.size() << ", " << sphereLods.triangleCount(sphereLevel)
+					<< " of " << sphereLods.triangleCount(0) << " triangles, error " << sphereLodPixels << " px; frame triangles "
+					<< glState().frameCounters().triangles << ", " << glState().frameCounters().triangles + frameLodTrianglesSaved << " at full detail" << std::endl;
+			std::cout << "uniforms: uploaded " << uniformStats.uploaded << ", skipped " << uniformStats.skipped << std::endl;
+			if (isClustered)
+			{
+				const ClusterGrid::Stats& clusterStats = clusters.lastStats();
+				std::cout << "clusters: built in " << clusterStats.buildMs << " ms, " << pointLights.size() << " point lights, "
+					<< clusterStats.indices << " light indices, " << clusterStats.occupied << " froxels lit, at most "
+					<< clusterStats.maxLights << " lights per froxel" << std::endl;
+			}
+			if (isDeferred)
+			{
+				std::cout << "deferred: G-buffer " << gbuffer.width << "x" << gbuffer.height << ", "
+					<< gbuffer.width * gbuffer.height * GBuffer::bytesPerPixel() / (1024 * 1024) << " MB written per frame, "
+					<< lightVolumes.count() << " light volumes" << std::endl;
+			}
+			if (isShadowed)
+			{
+				const CascadedShadowMap::Stats& shadowStats = shadowMap.lastStats();
+				std::cout << "shadows: " << SHADOW_CASCADES << " cascades of " << shadowMap.size() << "x" << shadowMap.size()
+					<< ", static " << shadowStats.staticLayers << " layers rebuilt in " << shadowStats.frames << " frames (last rebuild "
+					<< shadowStats.staticMs << " ms GPU), dynamic " << shadowStats.dynamicMs << " ms GPU per frame" << std::endl;
+				shadowMap.resetStats();
+				const SpotShadowAtlas::Stats& spotStats = spotShadows.lastStats();
+				std::cout << "spot shadows: " << spotStats.lights << " tiles (";
+				for (int i = 0; i < NR_SPOT_LIGHTS; i++)
+					std::cout << (i > 0 ? ", " : "") << spotShadows.tileSize(i);
+				std::cout << ") using " << spotStats.atlasTexels * 100.0 / (spotShadows.size() * spotShadows.size()) << "% of the "
+					<< spotShadows.size() << "x" << spotShadows.size() << " atlas, " << spotStats.updates << " redrawn and "
+					<< spotStats.deferred << " postponed in " << spotStats.frames << " frames (last update " << spotStats.ms << " ms GPU)" << std::endl;
+				spotShadows.resetStats();
+			}
+			if (isLightCulled && !isDeferred)
+			{
+				const LightCuller::Stats& cullStats = lightCuller.lastStats();
+				std::cout << "light lists: built in " << cullStats.ms << " ms, point lights " << cullStats.pointLights << "/"
+					<< cullStats.pointLightsTested << ", spot lights " << cullStats.spotLights << "/" << cullStats.spotLightsTested
+					<< " kept over " << cullStats.draws << " lists" << std::endl;
+			}
+			lastStatsTime = currentFrame;
+		}
+		statsFrames++;
 
 		// input
 		// -----
 		processInput(window);
 
+		// swap in shaders that were edited and finished compiling
+		shaderReloader.update();
+
 		// render
 		// ------
 		glClearColor(0.7f, 0.7f, 0.7f, 1.0f);
@@ -422,254 +920,365 @@ int main()
 		cameraMovingObj.Yaw = -glm::degrees(movingObjTime);
 		cameraMovingObj.updateCameraVectors();
 
+		// view/projection transformations, uploaded once for every shader
+		Camera& camera = getCurrentCamera();
+		updateFrameUniforms(frameUBO.data, camera, (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
+		frameUBO.upload();
+
+		// pick the shader variants of the current settings
+		if (containerBatch.empty())
+			isBatched = false;
+		unsigned int litFeatures = currentLitFeatures();
+		ShaderVariants<LitShaderUniforms>::Variant& lighting = lightingShaders.get(litFeatures);
+		const Shader& lightingShader = lighting.shader;
+		const LitShaderUniforms& lightingUniforms = lighting.uniforms;
+
 		// be sure to activate shader when setting uniforms/drawing objects
 		lightingShader.use();
-		lightingShader.setVec3("viewPos", getCurrentCamera().Position);
-		lightingShader.setVec3("material.diffuse", 1.0f, 0.5f, 0.31f);
-		lightingShader.setVec3("material.specular", 0.5f, 0.5f, 0.5f);
-		lightingShader.setFloat("material.shininess", 32.0f);
-		lightingShader.setInt("mode", isBlinn);
+		lightingShader.setVec3(lightingUniforms.material.diffuse, 1.0f, 0.5f, 0.31f);
+		lightingShader.setVec3(lightingUniforms.material.specular, 0.5f, 0.5f, 0.5f);
+		lightingShader.setFloat(lightingUniforms.material.shininess, 32.0f);
 
 #pragma region UnifromsLight
 
-		/*
-		   Here we set all the uniforms for the 5/6 types of lights we have. We have to set them manually and index
-		   the proper PointLight struct in the array to set each uniform variable. This can be done more code-friendly
-		   by defining light types as classes and set their values in there, or by using a more efficient uniform approach
-		   by using 'Uniform buffer objects', but that is something we'll discuss in the 'Advanced GLSL' tutorial.
-		*/
-		// directional light
-		lightingShader.setVec3("dirLight.direction", -0.2f, -1.0f, -0.3f);
-		lightingShader.setVec3("dirLight.ambient", ambientValue, ambientValue, ambientValue);
-		lightingShader.setVec3("dirLight.diffuse", 0.4f, 0.4f, 0.4f);
-		lightingShader.setVec3("dirLight.specular", 0.5f, 0.5f, 0.5f);
-		// point light 1
-		lightingShader.setVec3("pointLights[0].position", pointLightPositions[0]);
-		lightingShader.setVec3("pointLights[0].ambient", 0.05f, 0.05f, 0.05f);
-		lightingShader.setVec3("pointLights[0].diffuse", 0.8f, 0.8f, 0.8f);
-		lightingShader.setVec3("pointLights[0].specular", 1.0f, 1.0f, 1.0f);
-		lightingShader.setFloat("pointLights[0].constant", 1.0f);
-		lightingShader.setFloat("pointLights[0].linear", 0.09f);
-		lightingShader.setFloat("pointLights[0].quadratic", 0.032f);
-		// point light 2
-		lightingShader.setVec3("pointLights[1].position", pointLightPositions[1]);
-		lightingShader.setVec3("pointLights[1].ambient", 0.05f, 0.05f, 0.05f);
-		lightingShader.setVec3("pointLights[1].diffuse", 0.8f, 0.8f, 0.8f);
-		lightingShader.setVec3("pointLights[1].specular", 1.0f, 1.0f, 1.0f);
-		lightingShader.setFloat("pointLights[1].constant", 1.0f);
-		lightingShader.setFloat("pointLights[1].linear", 0.09f);
-		lightingShader.setFloat("pointLights[1].quadratic", 0.032f);
-		// point light 3
-		lightingShader.setVec3("pointLights[2].position", pointLightPositions[2]);
-		lightingShader.setVec3("pointLights[2].ambient", 0.05f, 0.05f, 0.05f);
-		lightingShader.setVec3("pointLights[2].diffuse", 0.8f, 0.8f, 0.8f);
-		lightingShader.setVec3("pointLights[2].specular", 1.0f, 1.0f, 1.0f);
-		lightingShader.setFloat("pointLights[2].constant", 1.0f);
-		lightingShader.setFloat("pointLights[2].linear", 0.09f);
-		lightingShader.setFloat("pointLights[2].quadratic", 0.032f);
-		// point light 4
-		lightingShader.setVec3("pointLights[3].position", pointLightPositions[3]);
-		lightingShader.setVec3("pointLights[3].ambient", 0.05f, 0.05f, 0.05f);
-		lightingShader.setVec3("pointLights[3].diffuse", 0.8f, 0.8f, 0.8f);
-		lightingShader.setVec3("pointLights[3].specular", 1.0f, 1.0f, 1.0f);
-		lightingShader.setFloat("pointLights[3].constant", 1.0f);
-		lightingShader.setFloat("pointLights[3].linear", 0.09f);
-		lightingShader.setFloat("pointLights[3].quadratic", 0.032f);
-		// spotLight
-		float x = isSpotlightCurrCamera && cameraId != 1 ? 1.0f : 0.0f;
-		lightingShader.setVec3("spotLight[0].position", getCurrentCamera().Position);
-		lightingShader.setVec3("spotLight[0].direction", getCurrentCamera().Front);
-		lightingShader.setVec3("spotLight[0].ambient", 0.0f, 0.0f, 0.0f);
-		lightingShader.setVec3("spotLight[0].diffuse", 1.0f * x, 1.0f * x, 1.0f * x);
-		lightingShader.setVec3("spotLight[0].specular", 1.0f * x, 1.0f * x, 1.0f * x);
-		lightingShader.setFloat("spotLight[0].constant", 1.0f * x);
-		lightingShader.setFloat("spotLight[0].linear", 0.09f * x);
-		lightingShader.setFloat("spotLight[0].quadratic", 0.032f * x);
-		lightingShader.setFloat("spotLight[0].cutOff", glm::cos(glm::radians(12.5f)));
-		lightingShader.setFloat("spotLight[0].outerCutOff", glm::cos(glm::radians(15.0f)));
-		
-		lightingShader.setVec3("spotLight[1].position", movingLightPos);
-		lightingShader.setVec3("spotLight[1].direction", CountLightFront());
-		lightingShader.setVec3("spotLight[1].ambient", 0.0f, 0.0f, 0.0f);
-		lightingShader.setVec3("spotLight[1].diffuse", 1.0f, 1.0f, 1.0f);
-		lightingShader.setVec3("spotLight[1].specular", 1.0f, 1.0f, 1.0f);
-		lightingShader.setFloat("spotLight[1].constant", 1.0f);
-		lightingShader.setFloat("spotLight[1].linear", 0.09f);
-		lightingShader.setFloat("spotLight[1].quadratic", 0.032f);
-		lightingShader.setFloat("spotLight[1].cutOff", glm::cos(glm::radians(12.5f)));
-		lightingShader.setFloat("spotLight[1].outerCutOff", glm::cos(glm::radians(15.0f)));
+		// update the dynamic light values, upload() skips everything that didn't change
+		lights.dirLight.ambient = glm::vec3(ambientValue, ambientValue, ambientValue);
+		const SHAmbient& skyAmbient = isDay ? dayAmbientSH : nightAmbientSH;
+		std::copy(skyAmbient.coefficients, skyAmbient.coefficients + SH_COEFFICIENTS, lights.ambientSH);
+		lights.spotLight[0].position = camera.Position;
+		lights.spotLight[0].direction = camera.Front;
+		lights.spotLight[1].position = movingLightPos;
+		lights.spotLight[1].direction = CountLightFront();
+		// the shaders light in view space, transform the lights once here instead of per fragment
+		toViewSpace(lights, frameUBO.data.view, lightsUBO.data);
+		lightsUBO.upload();
+
+		// froxel light lists of this frame's camera
+		if (isClustered && !isDeferred)
+		{
+			int framebufferWidth, framebufferHeight;
+			glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
+			clusters.build(pointLights, frameUBO.data.view, glm::radians(camera.Zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f,
+				(float)framebufferWidth, (float)framebufferHeight);
+			clusters.bind();
+		}
 
 #pragma endregion
 
-		// view/projection transformations
-		glm::mat4 projection = glm::perspective(glm::radians(getCurrentCamera().Zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
-		glm::mat4 view = getCurrentCamera().GetViewMatrix();
-		lightingShader.setMat4("projection", projection);
-		lightingShader.setMat4("view", view);
-
-		// world transformation
-		glm::mat4 model = glm::mat4(1.0f);
-		lightingShader.setMat4("model", model);
-
-		// render containers
-		glBindVertexArray(cubeVAO);
-		for (unsigned int i = 1; i < 9; i++)
-		{
-			// calculate the model matrix for each object and pass it to shader before drawing
-			glm::mat4 model = glm::mat4(1.0f);
-			model = glm::translate(model, cubePositions[i]);
-			float angle = 20.0f * i;
-			model = glm::rotate(model, glm::radians(angle), glm::vec3(1.0f, 0.3f, 0.5f));
-			lightingShader.setMat4("model", model);
-
-			glDrawArrays(GL_TRIANGLES, 0, 36);
-		}
-		// Draw moving cube
+		// moving cube, the last container instance
 		glm::mat4 modelMoving = glm::mat4(1.0f);
 		modelMoving = glm::translate(modelMoving, movingObjPos);
 		modelMoving = glm::rotate(modelMoving, movingObjTime, glm::vec3(0.0f, 1.0f, 0.0f));
-		lightingShader.setMat4("model", modelMoving);
-		glDrawArrays(GL_TRIANGLES, 0, 36);
+		containerInstances.instances[movingInstance] = makeInstance(modelMoving);
+		containerBounds[movingInstance] = transformBounds(modelMoving, containerRadius);
 
-		// also draw the lamp object(s)
-		lightCubeShader.use();
-		lightCubeShader.setMat4("projection", projection);
-		lightCubeShader.setMat4("view", view);
+		// sphere transformation, the same for both paths
+		glm::mat4 model = glm::mat4(1.0f);
+		model = glm::translate(model, glm::vec3(0.0f, 0.0f, 0.0f));
+		model = glm::scale(model, glm::vec3(2.0f));
+		glm::mat3 normalMatrix = glm::transpose(glm::inverse(glm::mat3(model)));
+		{
+			int framebufferWidth, framebufferHeight;
+			glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
+			float sphereScale = glm::length(glm::vec3(model[0]));
+			float distance = lodDistance(transformBounds(model, sphereRadius), camera.Position, 0.1f);
+			float pixelsPerUnit = projectionScale(glm::radians(camera.Zoom), (float)framebufferHeight);
+			sphereLevel = isLodSelected ? sphereLodSelector.select(sphereLods, sphereScale, distance, pixelsPerUnit, sphereLevel) : 0;
+			sphereLodPixels = LodSelector::projectedError(sphereLods, sphereLevel, sphereScale, distance, pixelsPerUnit);
+		}
 
-		// we now draw as many light bulbs as we have point lights.
-		glBindVertexArray(lightCubeVAO);
-		for (unsigned int i = 0; i < 4; i++)
+		// what the camera sees, the bounds against its frustum
 		{
-			model = glm::mat4(1.0f);
-			model = glm::translate(model, pointLightPositions[i]);
-			model = glm::scale(model, glm::vec3(0.2f)); // Make it a smaller cube
-			lightCubeShader.setMat4("model", model);
-			glDrawArrays(GL_TRIANGLES, 0, 36);
+			Timer cullTimer;
+			containerCullSpheres.set(movingInstance, containerBounds[movingInstance]);
+			if (isFrustumCulled)
+			{
+				Frustum frustum = Frustum::fromMatrix(frameUBO.data.viewProjection);
+				visibleContainerCount = cullSpheres(frustum, containerCullSpheres, visibleContainers);
+				visibleLampCount = cullSpheres(frustum, lampCullSpheres, visibleLamps);
+				isContainerBatchVisible = containerBatch.empty() || frustum.intersects(containerBatch.bounds());
+				isLampBatchVisible = lampBatch.empty() || frustum.intersects(lampBatch.bounds());
+				isMovingVisible = frustum.intersects(containerBounds[movingInstance]);
+				isSphereVisible = frustum.intersects(transformBounds(model, sphereRadius));
+			}
+			else
+			{
+				visibleContainerCount = containerBounds.size();
+				visibleLampCount = lampCullSpheres.size();
+				isContainerBatchVisible = isLampBatchVisible = isMovingVisible = isSphereVisible = true;
+			}
+			cullMs = cullTimer.elapsedMs();
 		}
 
-		// Draw sphere
-		//std::cout << "Start: " << glGetError() << std::endl;
-		sphereShader.use();
-		sphereShader.setVec3("viewPos", getCurrentCamera().Position);
-		sphereShader.setFloat("material.shininess", 32.0f);
-		sphereShader.setVec3("material.objectColor", 1.0f, 0.5f, 0.31f);
+		// lights reaching each object of the forward path
+		glm::uvec2 sphereLightList(0);
+		// shadow map of this frame's camera, rendered before either path needs it
+		if (isShadowed)
+		{
+			shadowMap.update(lights.dirLight.direction, frameUBO.data.inverseView, glm::radians(camera.Zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f);
+			if (!isShadowCached)
+				shadowMap.invalidate();
+			// the sphere is a static caster, showing or hiding it changes every cached shadow
+			if (isSphereDrawn != lastSphereDrawn || (isSphereDrawn && sphereLevel != lastSphereLevel))
+			{
+				shadowMap.invalidate();
+				spotShadows.invalidate();
+				lastSphereDrawn = isSphereDrawn;
+				lastSphereLevel = sphereLevel;
+			}
+			auto drawStaticCasters = [&](const glm::mat4& lightSpace)
+			{
+				// static casters: every container but the moving one (the last instance) and the sphere
+				if (isBatched)
+				{
+					shadowDepthShader.use();
+					shadowDepthShader.setMat4(shadowDepthLightSpace, lightSpace);
+					shadowDepthShader.setMat4(shadowDepthModel, glm::mat4(1.0f));
+					containerBatch.draw();
+				}
+				else
+				{
+					shadowDepthInstancedShader.use();
+					shadowDepthInstancedShader.setMat4(shadowDepthInstancedLightSpace, lightSpace);
+					glState().bindVertexArray(cubeVAO);
+					glState().drawElementsInstanced(GL_TRIANGLES, cubeIndices.count(), cubeIndices.type, 0, (GLsizei)movingInstance);
+				}
+				if (isSphereDrawn)
+				{
+					shadowDepthShader.use();
+					shadowDepthShader.setMat4(shadowDepthLightSpace, lightSpace);
+					shadowDepthShader.setMat4(shadowDepthModel, model);
+					drawSphere();
+				}
+			};
+			auto drawDynamicCasters = [&](const glm::mat4& lightSpace)
+			{
+				shadowDepthShader.use();
+				shadowDepthShader.setMat4(shadowDepthLightSpace, lightSpace);
+				shadowDepthShader.setMat4(shadowDepthModel, modelMoving);
+				glState().bindVertexArray(cubeVAO);
+				glState().drawElements(GL_TRIANGLES, cubeIndices.count(), cubeIndices.type, 0);
+			};
+			shadowMap.render(drawStaticCasters, drawDynamicCasters);
+			shadowMap.bind();
+
+			// spot light tiles: redrawn when the light moved or the moving cube entered/left its cone
+			spotShadows.update(lights.spotLight, (litFeatures & SHADER_FLASHLIGHT) ? 0 : 1, frameUBO.data.view, frameUBO.data.inverseView,
+				glm::radians(camera.Zoom), (float)SCR_WIDTH / (float)SCR_HEIGHT);
+			if (modelMoving != lastModelMoving)
+			{
+				spotShadows.castersChanged(transformBounds(lastModelMoving, containerRadius));
+				spotShadows.castersChanged(containerBounds[movingInstance]);
+				lastModelMoving = modelMoving;
+			}
+			if (!isShadowCached)
+				spotShadows.invalidate();
+			spotShadows.render([&](const glm::mat4& lightSpace)
+			{
+				drawStaticCasters(lightSpace);
+				drawDynamicCasters(lightSpace);
+			});
+			spotShadows.bind();
+		}
 
-#pragma region UnifromsLight
+		if (isLightCulled && !isDeferred)
+		{
+			lightCuller.resetStats();
+			lightCuller.prepare(lights, (litFeatures & SHADER_FLASHLIGHT) ? 0 : 1);
+			lightCuller.cull(containerBounds, containerLightLists.lists);
+			if (isBatched)
+				containerBatchLightList = lightCuller.cull(containerBatch.bounds());
+			else if (isInstanced)
+				containerLightLists.upload();
+			sphereLightList = lightCuller.cull(transformBounds(model, sphereRadius));
+		}
 
-		/*
-		   Here we set all the uniforms for the 5/6 types of lights we have. We have to set them manually and index
-		   the proper PointLight struct in the array to set each uniform variable. This can be done more code-friendly
-		   by defining light types as classes and set their values in there, or by using a more efficient uniform approach
-		   by using 'Uniform buffer objects', but that is something we'll discuss in the 'Advanced GLSL' tutorial.
-		*/
-		// directional light
-		sphereShader.setVec3("dirLight.direction", -0.2f, -1.0f, -0.3f);
-		sphereShader.setVec3("dirLight.ambient", ambientValue, ambientValue, ambientValue);
-		sphereShader.setVec3("dirLight.diffuse", 0.4f, 0.4f, 0.4f);
-		sphereShader.setVec3("dirLight.specular", 0.5f, 0.5f, 0.5f);
-		// point light 1
-		sphereShader.setVec3("pointLights[0].position", pointLightPositions[0]);
-		sphereShader.setVec3("pointLights[0].ambient", 0.05f, 0.05f, 0.05f);
-		sphereShader.setVec3("pointLights[0].diffuse", 0.8f, 0.8f, 0.8f);
-		sphereShader.setVec3("pointLights[0].specular", 1.0f, 1.0f, 1.0f);
-		sphereShader.setFloat("pointLights[0].constant", 1.0f);
-		sphereShader.setFloat("pointLights[0].linear", 0.09f);
-		sphereShader.setFloat("pointLights[0].quadratic", 0.032f);
-		// point light 2
-		sphereShader.setVec3("pointLights[1].position", pointLightPositions[1]);
-		sphereShader.setVec3("pointLights[1].ambient", 0.05f, 0.05f, 0.05f);
-		sphereShader.setVec3("pointLights[1].diffuse", 0.8f, 0.8f, 0.8f);
-		sphereShader.setVec3("pointLights[1].specular", 1.0f, 1.0f, 1.0f);
-		sphereShader.setFloat("pointLights[1].constant", 1.0f);
-		sphereShader.setFloat("pointLights[1].linear", 0.09f);
-		sphereShader.setFloat("pointLights[1].quadratic", 0.032f);
-		// point light 3
-		sphereShader.setVec3("pointLights[2].position", pointLightPositions[2]);
-		sphereShader.setVec3("pointLights[2].ambient", 0.05f, 0.05f, 0.05f);
-		sphereShader.setVec3("pointLights[2].diffuse", 0.8f, 0.8f, 0.8f);
-		sphereShader.setVec3("pointLights[2].specular", 1.0f, 1.0f, 1.0f);
-		sphereShader.setFloat("pointLights[2].constant", 1.0f);
-		sphereShader.setFloat("pointLights[2].linear", 0.09f);
-		sphereShader.setFloat("pointLights[2].quadratic", 0.032f);
-		// point light 4
-		sphereShader.setVec3("pointLights[3].position", pointLightPositions[3]);
-		sphereShader.setVec3("pointLights[3].ambient", 0.05f, 0.05f, 0.05f);
-		sphereShader.setVec3("pointLights[3].diffuse", 0.8f, 0.8f, 0.8f);
-		sphereShader.setVec3("pointLights[3].specular", 1.0f, 1.0f, 1.0f);
-		sphereShader.setFloat("pointLights[3].constant", 1.0f);
-		sphereShader.setFloat("pointLights[3].linear", 0.09f);
-		sphereShader.setFloat("pointLights[3].quadratic", 0.032f);
-		// spotLight
-		sphereShader.setVec3("spotLight[0].position", getCurrentCamera().Position);
-		sphereShader.setVec3("spotLight[0].direction", getCurrentCamera().Front);
-		sphereShader.setVec3("spotLight[0].ambient", 0.0f, 0.0f, 0.0f);
-		sphereShader.setVec3("spotLight[0].diffuse", 1.0f, 1.0f, 1.0f);
-		sphereShader.setVec3("spotLight[0].specular", 1.0f, 1.0f, 1.0f);
-		sphereShader.setFloat("spotLight[0].constant", 1.0f);
-		sphereShader.setFloat("spotLight[0].linear", 0.09f);
-		sphereShader.setFloat("spotLight[0].quadratic", 0.032f);
-		sphereShader.setFloat("spotLight[0].cutOff", glm::cos(glm::radians(12.5f)));
-		sphereShader.setFloat("spotLight[0].outerCutOff", glm::cos(glm::radians(15.0f)));
-
-		sphereShader.setVec3("spotLight[1].position", movingLightPos);
-		sphereShader.setVec3("spotLight[1].direction", cameraMovingObj.Front);
-		sphereShader.setVec3("spotLight[1].ambient", 0.0f, 0.0f, 0.0f);
-		sphereShader.setVec3("spotLight[1].diffuse", 1.0f, 1.0f, 1.0f);
-		sphereShader.setVec3("spotLight[1].specular", 1.0f, 1.0f, 1.0f);
-		sphereShader.setFloat("spotLight[1].constant", 1.0f);
-		sphereShader.setFloat("spotLight[1].linear", 0.09f);
-		sphereShader.setFloat("spotLight[1].quadratic", 0.032f);
-		sphereShader.setFloat("spotLight[1].cutOff", glm::cos(glm::radians(12.5f)));
-		sphereShader.setFloat("spotLight[1].outerCutOff", glm::cos(glm::radians(15.0f)));
+		if (isDeferred)
+		{
+			// geometry pass: containers and sphere write their surfaces into the G-buffer
+			int framebufferWidth, framebufferHeight;
+			glfwGetFramebufferSize(window, &framebufferWidth, &framebufferHeight);
+			gbuffer.resize(framebufferWidth, framebufferHeight);
+			gbuffer.bindForGeometry();
+
+			ShaderVariants<LitShaderUniforms>::Variant& geometry = gbufferShaders.get(litFeatures);
+			geometry.shader.use();
+			geometry.shader.setVec3(geometry.uniforms.material.diffuse, 1.0f, 0.5f, 0.31f);
+			geometry.shader.setVec3(geometry.uniforms.material.specular, 0.5f, 0.5f, 0.5f);
+			geometry.shader.setFloat(geometry.uniforms.material.shininess, 32.0f);
+			drawContainers(geometry.shader, geometry.uniforms);
+
+			if (isSphereDrawn && isSphereVisible)
+			{
+				sphereGBufferShader.use();
+				sphereGBufferShader.setVec3(sphereGBufferUniforms.material.diffuse, 1.0f, 0.5f, 0.31f);
+				sphereGBufferShader.setVec3(sphereGBufferUniforms.material.specular, 1.0f, 0.5f, 0.31f);
+				sphereGBufferShader.setFloat(sphereGBufferUniforms.material.shininess, 32.0f);
+				sphereGBufferShader.setMat4(sphereGBufferUniforms.model, model);
+				sphereGBufferShader.setMat3(sphereGBufferUniforms.normalMatrix, normalMatrix);
+				drawSphere();
+			}
 
-#pragma endregion
+			// lighting passes into the default framebuffer: directional/spot lights and fog over
+			// the whole screen (also copies the scene depth), then the point light volumes
+			glBindFramebuffer(GL_FRAMEBUFFER, 0);
+			gbuffer.bindTextures();
+			deferredLightShaders.get(litFeatures).shader.use();
+			glState().depthFunc(GL_ALWAYS);
+			glState().bindVertexArray(fullscreenVAO);
+			glState().drawArrays(GL_TRIANGLES, 0, 3);
+			glState().depthFunc(GL_LESS);
+
+			lightVolumes.update(pointLights, frameUBO.data.view);
+			lightVolumeShader.use();
+			lightVolumes.draw();
+		}
+		else
+		{
+			// the shadow pass changed the program since the material was set
+			lightingShader.use();
+			drawContainers(lightingShader, lightingUniforms);
+		}
 
-		// view/projection transformations
-		sphereShader.setMat4("projection", projection);
-		sphereShader.setMat4("view", view);
+		// also draw the lamp object(s)
+		if (isBatched)
+		{
+			lightCubeShader.use();
+			lightCubeShader.setMat4(lightCubeModel, glm::mat4(1.0f));
+			if (isLampBatchVisible)
+				lampBatch.draw();
+		}
+		else if (isInstanced && visibleLampCount > 0)
+		{
+			// too few lamps to be worth a buffer of visible ones, all of them unless none is visible
+			lightCubeInstancedShader.use();
+			glState().bindVertexArray(lampVAO);
+			glState().drawElementsInstanced(GL_TRIANGLES, cubeIndices.count(), cubeIndices.type, 0, lampInstances.count());
+		}
+		else
+		{
+			lightCubeShader.use();
+			// we now draw as many light bulbs as we have point lights.
+			for (size_t visible = 0; visible < visibleLampCount; visible++)
+			{
+				const InstanceData& lamp = lampInstances.instances[isFrustumCulled ? visibleLamps[visible] : visible];
+				lightCubeShader.setMat4(lightCubeModel, lamp.model);
+				glState().drawElements(GL_TRIANGLES, cubeIndices.count(), cubeIndices.type, 0);
+			}
+		}
 
-		// world transformation
-		glBindVertexArray(sphereVAO);
-		model = glm::mat4(1.0f);
-		model = glm::translate(model, glm::vec3(0.0f, 0.0f, 0.0f));
-		model = glm::scale(model, glm::vec3(2.0f));
-		sphereShader.setMat4("model", model);
-		glDrawElements(GL_TRIANGLES, (unsigned int)indices.size(), GL_UNSIGNED_INT, 0);
-		glDrawElements(GL_TRIANGLES, (unsigned int)indices.size(), GL_UNSIGNED_INT, indices.data());
+		// Draw sphere
+		//std::cout << "Start: " << glGetError() << std::endl;
+		if (!isDeferred && isSphereDrawn && isSphereVisible)
+		{
+			ShaderVariants<LitShaderUniforms>::Variant& sphere = sphereShaders.get(litFeatures);
+			const Shader& sphereShader = sphere.shader;
+			const LitShaderUniforms& sphereUniforms = sphere.uniforms;
+			sphereShader.use();
+			sphereShader.setFloat(sphereUniforms.material.shininess, 32.0f);
+			sphereShader.setVec3(sphereUniforms.material.objectColor, 1.0f, 0.5f, 0.31f);
+
+			// world transformation
+			sphereShader.setMat4(sphereUniforms.model, model);
+			sphereShader.setMat3(sphereUniforms.normalMatrix, normalMatrix);
+			sphereShader.setUvec2(sphereUniforms.lightList, sphereLightList);
+			drawSphere();
+		}
 
 		//std::cout << "HERE: " << glGetError() << std::endl;
 
 		// draw skybox as last
-		glDepthFunc(GL_LEQUAL);  // change depth function so depth test passes when values are equal to depth buffer's content
+		glState().depthFunc(GL_LEQUAL);  // change depth function so depth test passes when values are equal to depth buffer's content
 		skyboxShader.use();
-		view = glm::mat4(glm::mat3(getCurrentCamera().GetViewMatrix())); // remove translation from the view matrix
-		skyboxShader.setMat4("view", view);
-		skyboxShader.setMat4("projection", projection);
-		// skybox cube
-		glBindVertexArray(skyboxVAO);
-		glActiveTexture(GL_TEXTURE0);
-		if (isDay)
-			glBindTexture(GL_TEXTURE_CUBE_MAP, cubemapTexture);
+		glState().bindVertexArray(fullscreenVAO);
+		const EnvironmentMap& environment = isDay ? dayEnvironment : nightEnvironment;
+		if (skyboxView == 0)
+			glState().bindTexture(0, GL_TEXTURE_CUBE_MAP, isDay ? cubemapTexture : cubemapTextureNight);
+		else if (skyboxView <= PREFILTER_LEVELS)
+			glState().bindTexture(0, GL_TEXTURE_CUBE_MAP, environment.prefilteredMap());
 		else
-			glBindTexture(GL_TEXTURE_CUBE_MAP, cubemapTextureNight);
-		glDrawArrays(GL_TRIANGLES, 0, 36);
-		glBindVertexArray(0);
-		glDepthFunc(GL_LESS); // set depth function back to default
+			glState().bindTexture(0, GL_TEXTURE_CUBE_MAP, environment.irradianceMap());
+		skyboxShader.setFloat(skyboxLod, skyboxView >= 1 && skyboxView <= PREFILTER_LEVELS ? (float)(skyboxView - 1) : -1.0f);
+		glState().drawArrays(GL_TRIANGLES, 0, 3);
+		glState().depthFunc(GL_LESS); // set depth function back to default
+
+		if (isLightBenchmark)
+		{
+			glFinish();
+			double frameMs = frameTimer.elapsedMs();
+			size_t step = lightSweep.step();
+			bool isBruteForce = step % 3 == 1;
+			bool isStepDone = lightSweep.endFrame(frameMs);
+			if (isBruteForce && frameMs > benchBruteForceLimitMs && !isStepDone)
+			{
+				std::cout << "  " << benchLightCounts[step / 3] << " lights, brute force: " << frameMs << " ms/frame, stopped" << std::endl;
+				isBruteForceSkipped = true;
+				lightSweep.skip();
+			}
+			else if (isStepDone && isDeferred)
+			{
+				std::cout << "  " << benchLightCounts[step / 3] << " lights, deferred: " << lightSweep.averageMs() << " ms/frame ("
+					<< lightVolumes.count() << " light volumes)" << std::endl;
+			}
+			else if (isStepDone)
+			{
+				const ClusterGrid::Stats& clusterStats = clusters.lastStats();
+				glm::uvec3 dims = clusters.dims();
+				std::cout << "  " << benchLightCounts[step / 3] << " lights, " << (isBruteForce ? "brute force" : "clustered")
+					<< " " << dims.x << "x" << dims.y << "x" << dims.z << ": " << lightSweep.averageMs() << " ms/frame (lists built in "
+					<< clusterStats.buildMs << " ms, " << clusterStats.indices << " light indices, at most "
+					<< clusterStats.maxLights << " lights per froxel)" << std::endl;
+				if (isBruteForce && lightSweep.averageMs() > benchBruteForceLimitMs)
+					isBruteForceSkipped = true;
+			}
+			// brute force only gets slower with more lights
+			if (isBruteForceSkipped && !lightSweep.done() && lightSweep.step() % 3 == 1)
+				lightSweep.skip();
+			if (lightSweep.done())
+				glfwSetWindowShouldClose(window, true);
+		}
 
 		// glfw: swap buffers and poll IO events (keys pressed/released, mouse moved etc.)
 		// -------------------------------------------------------------------------------
 		glfwSwapBuffers(window);
 		glfwPollEvents();
+
+		if (firstFrame)
+		{
+			assets.printBreakdown();
+			std::cout << "time to first frame: " << startupTimer.elapsedMs() << " ms"
+				<< (ShaderCache::isSupported() ? "" : " (shader cache off)") << std::endl;
+			firstFrame = false;
+		}
 	}
 
 	// optional: de-allocate all resources once they've outlived their purpose:
 	// ------------------------------------------------------------------------
 	glDeleteVertexArrays(1, &cubeVAO);
-	glDeleteVertexArrays(1, &lightCubeVAO);
+	glDeleteVertexArrays(1, &lampVAO);
+	glDeleteVertexArrays(1, &visibleCubeVAO);
+	containerBatch.destroy();
+	lampBatch.destroy();
+	glDeleteBuffers(1, &containerInstances.ID);
+	glDeleteBuffers(1, &lampInstances.ID);
+	glDeleteBuffers(1, &containerLightLists.ID);
+	glDeleteBuffers(1, &visibleInstances.ID);
+	glDeleteBuffers(1, &visibleLightLists.ID);
 	glDeleteBuffers(1, &cubeVBO);
+	glDeleteBuffers(1, &cubeEBO);
 	glDeleteBuffers(1, &sphereEBO);
 	glDeleteVertexArrays(1, &sphereVAO);
 	glDeleteBuffers(1, &sphereVBO);
+	glDeleteBuffers(1, &lightsUBO.ID);
+	glDeleteBuffers(1, &frameUBO.ID);
+	clusters.destroy();
+	gbuffer.destroy();
+	lightVolumes.destroy();
+	glDeleteVertexArrays(1, &fullscreenVAO);
+	shadowMap.destroy();
+	spotShadows.destroy();
+	dayEnvironment.destroy();
+	nightEnvironment.destroy();
 
 	// glfw: terminate, clearing all previously allocated GLFW resources.
 	// ------------------------------------------------------------------
@@ -718,10 +1327,34 @@ void key_callback(GLFWwindow* window, int key, int scancode, int action, int mod
 		isDay = !isDay;
 	if (key == GLFW_KEY_B && action == GLFW_PRESS)
 		isBlinn = !isBlinn;
+	if (key == GLFW_KEY_M && action == GLFW_PRESS)
+		skyboxView = (skyboxView + 1) % (PREFILTER_LEVELS + 2);
+	if (key == GLFW_KEY_F && action == GLFW_PRESS)
+		isFog = !isFog;
 	if (key == GLFW_KEY_P && action == GLFW_PRESS)
 		isMovingObj = !isMovingObj;
+	if (key == GLFW_KEY_U && action == GLFW_PRESS)
+		isSphereDrawn = !isSphereDrawn;
+	if (key == GLFW_KEY_E && action == GLFW_PRESS)
+		isLodSelected = !isLodSelected;
+	if (key == GLFW_KEY_X && action == GLFW_PRESS)
+		isFrustumCulled = !isFrustumCulled;
 	if (key == GLFW_KEY_T && action == GLFW_PRESS)
 		isSpotlightCurrCamera = !isSpotlightCurrCamera;
+	if (key == GLFW_KEY_I && action == GLFW_PRESS)
+		isStatsPrinted = !isStatsPrinted;
+	if (key == GLFW_KEY_N && action == GLFW_PRESS)
+		isInstanced = !isInstanced;
+	if (key == GLFW_KEY_O && action == GLFW_PRESS)
+		isBatched = !isBatched;
+	if (key == GLFW_KEY_C && action == GLFW_PRESS)
+		isClustered = !isClustered;
+	if (key == GLFW_KEY_G && action == GLFW_PRESS)
+		isDeferred = !isDeferred;
+	if (key == GLFW_KEY_K && action == GLFW_PRESS)
+		isLightCulled = !isLightCulled;
+	if (key == GLFW_KEY_H && action == GLFW_PRESS)
+		isShadowed = !isShadowed;
 }
 
 // glfw: whenever the window size changed (by OS or user resize) this callback function executes
@@ -768,67 +1401,46 @@ void scroll_callback(GLFWwindow* window, double xoffset, double yoffset)
 
 // utility function for loading a 2D texture from file
 // ---------------------------------------------------
-unsigned int loadTexture(char const* path)
+unsigned int uploadTexture(const AssetLoader::Image& image)
 {
 	unsigned int textureID;
 	glGenTextures(1, &textureID);
 
-	int width, height, nrComponents;
-	unsigned char* data = stbi_load(path, &width, &height, &nrComponents, 0);
-	if (data)
+	if (image.data)
 	{
 		GLenum format;
-		if (nrComponents == 1)
+		if (image.nrComponents == 1)
 			format = GL_RED;
-		else if (nrComponents == 3)
+		else if (image.nrComponents == 3)
 			format = GL_RGB;
-		else if (nrComponents == 4)
+		else if (image.nrComponents == 4)
 			format = GL_RGBA;
 
 		glBindTexture(GL_TEXTURE_2D, textureID);
-		glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format, GL_UNSIGNED_BYTE, data);
+		glTexImage2D(GL_TEXTURE_2D, 0, format, image.width, image.height, 0, format, GL_UNSIGNED_BYTE, image.data);
 		glGenerateMipmap(GL_TEXTURE_2D);
 
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
 		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-		stbi_image_free(data);
 	}
 	else
 	{
-		std::cout << "Texture failed to load at path: " << path << std::endl;
-		stbi_image_free(data);
+		std::cout << "Texture failed to load at path: " << image.path << std::endl;
 	}
 
 	return textureID;
 }
 
-unsigned int loadCubemapTexture(std::vector<std::string> faces)
+unsigned int createCubemapTexture()
 {
 	unsigned int textureID;
 	glGenTextures(1, &textureID);
 	glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
 
-	int width, height, nrChannels;
-	for (unsigned int i = 0; i < faces.size(); i++)
-	{
-		unsigned char* data = stbi_load(faces[i].c_str(), &width, &height, &nrChannels, 0);
-		if (data)
-		{
-			glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i,
-				0, GL_RGB, width, height, 0, GL_RGB, GL_UNSIGNED_BYTE, data
-			);
-			stbi_image_free(data);
-		}
-		else
-		{
-			std::cout << "Cubemap tex failed to load at path: " << faces[i] << std::endl;
-			stbi_image_free(data);
-		}
-	}
-	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	// the faces are minified in small windows and at wide fields of view, sample their mips
+	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
 	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
 	glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
@@ -837,12 +1449,34 @@ unsigned int loadCubemapTexture(std::vector<std::string> faces)
 	return textureID;
 }
 
+// faces may arrive in any order (whichever the loader threads finish first)
+void uploadCubemapFace(unsigned int textureID, unsigned int face, const AssetLoader::Image& image)
+{
+	if (image.data)
+	{
+		glBindTexture(GL_TEXTURE_CUBE_MAP, textureID);
+		// rows of the small RGB mips aren't 4 byte aligned
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		for (int level = 0; level < image.levels(); level++)
+		{
+			glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + face,
+				level, GL_RGB, std::max(image.width >> level, 1), std::max(image.height >> level, 1), 0, GL_RGB, GL_UNSIGNED_BYTE, image.level(level)
+			);
+		}
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	}
+	else
+	{
+		std::cout << "Cubemap tex failed to load at path: " << image.path << std::endl;
+	}
+}
+
 void changeCameraId(int id)
 {
 	cameraId = id;
 }
 
-Camera getCurrentCamera()
+Camera& getCurrentCamera()
 {
 	switch (cameraId)
 	{
@@ -888,3 +1522,475 @@ glm::vec3 CountLightFront()
 	front.z = sin(glm::radians(cameraMovingObj.Yaw + lightYaw)) * cos(glm::radians(cameraMovingObj.Pitch + lightPitch));
 	return glm::normalize(front);
 }
+
+
+LitShaderUniforms::LitShaderUniforms(const Shader& shader)
+{
+	model = shader.uniform("model");
+	normalMatrix = shader.uniform("normalMatrix");
+	lightList = shader.uniform("lightList");
+
+	material.diffuse = shader.uniform("material.diffuse");
+	material.specular = shader.uniform("material.specular");
+	material.shininess = shader.uniform("material.shininess");
+	material.objectColor = shader.uniform("material.objectColor");
+}
+
+// binds the shared uniform blocks of a newly compiled lit shader variant
+void setupLitShader(const Shader& shader)
+{
+	shader.bindUniformBlock("Lights", LIGHTS_BINDING);
+	shader.bindUniformBlock("Frame", FRAME_BINDING);
+	// CLUSTERED and SHADOWS variants only
+	shader.bindUniformBlock("Clusters", CLUSTERS_BINDING);
+	shader.bindUniformBlock("Shadows", SHADOWS_BINDING);
+	shader.bindUniformBlock("SpotShadows", SPOT_SHADOWS_BINDING);
+	shader.use();
+	shader.setInt("clusterLights", CLUSTER_LIGHTS_UNIT);
+	shader.setInt("clusterGrid", CLUSTER_GRID_UNIT);
+	shader.setInt("clusterIndices", CLUSTER_INDICES_UNIT);
+	shader.setInt("shadowMap", SHADOW_MAP_UNIT);
+	shader.setInt("spotShadowAtlas", SPOT_SHADOW_ATLAS_UNIT);
+}
+
+// feature mask of the lit shaders for the current settings
+unsigned int currentLitFeatures()
+{
+	unsigned int features = 0;
+	if (isBlinn)
+		features |= SHADER_BLINN;
+	if (isFog)
+		features |= SHADER_FOG;
+	if (isSpotlightCurrCamera && cameraId != 1)
+		features |= SHADER_FLASHLIGHT;
+	if (isInstanced && !isBatched)
+		features |= SHADER_INSTANCED;
+	if (isClustered)
+		features |= SHADER_CLUSTERED;
+	if (isLightCulled)
+		features |= SHADER_CULLED;
+	if (isShadowed)
+		features |= SHADER_SHADOWS;
+	return features;
+}
+
+// the scene's point lights plus random ones above the floor (fixed seed, every run
+// and every count uses the same lights)
+std::vector<PointLight> makeBenchmarkLights(const LightBlock& lights, size_t count)
+{
+	std::vector<PointLight> result(lights.pointLights, lights.pointLights + std::min<size_t>(count, NR_POINT_LIGHTS));
+	std::mt19937 random(42);
+	std::uniform_real_distribution<float> x(-30.0f, 30.0f), y(-5.0f, 1.0f), z(-40.0f, 10.0f), color(0.2f, 1.0f);
+	while (result.size() < count)
+	{
+		PointLight light = {};
+		light.position = glm::vec3(x(random), y(random), z(random));
+		light.diffuse = glm::vec3(color(random), color(random), color(random));
+		light.ambient = light.diffuse * 0.05f;
+		light.specular = light.diffuse;
+		light.constant = 1.0f;
+		light.linear = 0.7f;
+		light.quadratic = 1.8f;
+		result.push_back(light);
+	}
+	return result;
+}
+
+// model matrix of the i-th container
+glm::mat4 containerModel(const glm::vec3& position, unsigned int i)
+{
+	glm::mat4 model = glm::mat4(1.0f);
+	model = glm::translate(model, position);
+	float angle = 20.0f * i;
+	model = glm::rotate(model, glm::radians(angle), glm::vec3(1.0f, 0.3f, 0.5f));
+	return model;
+}
+
+// --bench-skybox: draws only the skybox into an offscreen target of several sizes, as the old
+// 36 vertex cube and as the fullscreen triangle, sampling mip 0 only (GL_LINEAR) or the mip chain.
+// ms/frame after glFinish; the cubemap bytes read are estimated by cubemapFootprintBytes()
+void benchmarkSkybox(const Shader& skyboxShader, unsigned int cubemap, unsigned int vao, UniformBuffer<FrameUniforms>& frameUBO)
+{
+	const int resolutions[][2] = { { 320, 180 }, { 640, 360 }, { 1280, 720 }, { 1920, 1080 }, { 2560, 1440 } };
+	const int warmup = 2;
+	const int frames = 10;
+
+	Shader cubeShader("skybox.vs", "skybox.fs", "#define SKYBOX_CUBE\n");
+	const Shader* shaders[2] = { &cubeShader, &skyboxShader };
+	for (const Shader* shader : shaders)
+	{
+		shader->use();
+		shader->setInt("skybox", 0);
+		shader->setFloat("skyboxLod", -1.0f);
+		shader->bindUniformBlock("Frame", FRAME_BINDING);
+	}
+	// a sampler object overrides the mipmapped filter of the texture
+	unsigned int mip0Sampler;
+	glGenSamplers(1, &mip0Sampler);
+	glSamplerParameteri(mip0Sampler, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glSamplerParameteri(mip0Sampler, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glSamplerParameteri(mip0Sampler, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glSamplerParameteri(mip0Sampler, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glSamplerParameteri(mip0Sampler, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+
+	glState().bindTexture(0, GL_TEXTURE_CUBE_MAP, cubemap);
+	GLint faceSize = 0;
+	glGetTexLevelParameteriv(GL_TEXTURE_CUBE_MAP_POSITIVE_X, 0, GL_TEXTURE_WIDTH, &faceSize);
+
+	unsigned int FBO, colorBuffer, depthBuffer;
+	glGenFramebuffers(1, &FBO);
+	glGenRenderbuffers(1, &colorBuffer);
+	glGenRenderbuffers(1, &depthBuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+	glState().depthFunc(GL_LEQUAL);
+
+	Camera& camera = getCurrentCamera();
+	std::cout << "--bench-skybox: " << faceSize << "x" << faceSize << " faces, ms/frame and estimated MB of cubemap read" << std::endl;
+	std::cout << "  resolution  texels/pixel  cube mip0  cube mips  triangle mip0  triangle mips  MB mip0  MB mips" << std::endl;
+	for (const auto& resolution : resolutions)
+	{
+		int width = resolution[0], height = resolution[1];
+		glBindRenderbuffer(GL_RENDERBUFFER, colorBuffer);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+		glBindRenderbuffer(GL_RENDERBUFFER, depthBuffer);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, colorBuffer);
+		glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthBuffer);
+		glViewport(0, 0, width, height);
+		updateFrameUniforms(frameUBO.data, camera, (float)width / (float)height, 0.1f, 100.0f);
+		frameUBO.upload();
+
+		// [shape][mipmapped]: cube, triangle x mip 0, mip chain
+		double ms[2][2];
+		for (int shape = 0; shape < 2; shape++)
+		{
+			shaders[shape]->use();
+			for (int mipmapped = 0; mipmapped < 2; mipmapped++)
+			{
+				glBindSampler(0, mipmapped ? 0 : mip0Sampler);
+				glState().bindVertexArray(vao);
+				Timer timer;
+				for (int frame = 0; frame < warmup + frames; frame++)
+				{
+					if (frame == warmup)
+					{
+						glFinish();
+						timer.reset();
+					}
+					glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+					glState().drawArrays(GL_TRIANGLES, 0, shape == 0 ? 36 : 3);
+				}
+				glFinish();
+				ms[shape][mipmapped] = timer.elapsedMs() / frames;
+			}
+		}
+
+		float texelsPerPixel = faceSize * std::tan(glm::radians(camera.Zoom) * 0.5f) / height;
+		double mip0MB = cubemapFootprintBytes(faceSize, width, height, frameUBO.data.inverseViewProjection, camera.Position, false) / (1024.0 * 1024.0);
+		double mipsMB = cubemapFootprintBytes(faceSize, width, height, frameUBO.data.inverseViewProjection, camera.Position, true) / (1024.0 * 1024.0);
+		std::cout << "  " << width << "x" << height << "  " << texelsPerPixel << "  " << ms[0][0] << "  " << ms[0][1]
+			<< "  " << ms[1][0] << "  " << ms[1][1] << "  " << mip0MB << "  " << mipsMB << std::endl;
+	}
+
+	glBindSampler(0, 0);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glViewport(0, 0, SCR_WIDTH, SCR_HEIGHT);
+	glState().depthFunc(GL_LESS);
+	glDeleteSamplers(1, &mip0Sampler);
+	glDeleteRenderbuffers(1, &colorBuffer);
+	glDeleteRenderbuffers(1, &depthBuffer);
+	glDeleteFramebuffers(1, &FBO);
+}
+
+// --bench-vertex-formats: the cube as the --stress grid and the sphere as a smaller grid, drawn
+// instanced with the lit shader into a small offscreen target so the vertex work dominates, once
+// per vertex format. The vertex bytes fetched per frame are estimated as the vertex shader
+// invocations of the FIFO cache model (analyzeVertexCache) times the stride; ms/frame after glFinish
+void benchmarkVertexFormats(const Shader& litShader, const IndexedMesh& cube, const IndexedMesh& sphere, UniformBuffer<FrameUniforms>& frameUBO)
+{
+	const int width = 320, height = 180;
+	const int warmup = 1;
+	const int frames = 5;
+	struct Grid
+	{
+		const char* name;
+		const IndexedMesh* mesh;
+		int instances;
+		float spacing;
+	};
+	const Grid grids[] = { { "cube", &cube, STRESS_INSTANCES, 2.0f }, { "sphere", &sphere, 1000, 12.0f } };
+	const VertexEncoding encodings[] = { VERTEX_FLOAT, VERTEX_PACKED, VERTEX_OCTAHEDRAL };
+
+	unsigned int FBO, colorBuffer, depthBuffer;
+	glGenFramebuffers(1, &FBO);
+	glGenRenderbuffers(1, &colorBuffer);
+	glGenRenderbuffers(1, &depthBuffer);
+	glBindFramebuffer(GL_FRAMEBUFFER, FBO);
+	glBindRenderbuffer(GL_RENDERBUFFER, colorBuffer);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, width, height);
+	glBindRenderbuffer(GL_RENDERBUFFER, depthBuffer);
+	glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, colorBuffer);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthBuffer);
+	glViewport(0, 0, width, height);
+	updateFrameUniforms(frameUBO.data, getCurrentCamera(), (float)width / (float)height, 0.1f, 100.0f);
+	frameUBO.upload();
+	litShader.use();
+
+	std::cout << "--bench-vertex-formats: " << width << "x" << height << ", ms/frame and estimated MB of vertices fetched per frame" << std::endl;
+	std::cout << "  mesh  instances  format  bytes/vertex  buffer bytes  MB/frame  ms/frame  GB/s" << std::endl;
+	for (const Grid& grid : grids)
+	{
+		const IndexedMesh& mesh = *grid.mesh;
+		PackedIndices indices = packIndices(mesh.indices, mesh.vertexCount());
+		size_t transformed = analyzeVertexCache(mesh.indices, mesh.vertexCount()).transformed;
+		InstanceBuffer instances;
+		for (int i = 0; i < grid.instances; i++)
+		{
+			glm::vec3 position((i % 100 - 50) * grid.spacing, -4.0f - (i / 10000) * grid.spacing, -((i / 100) % 100) * grid.spacing);
+			instances.instances.push_back(makeInstance(containerModel(position, i)));
+		}
+		instances.upload();
+
+		for (VertexEncoding encoding : encodings)
+		{
+			unsigned int VAO, VBO, EBO;
+			glGenVertexArrays(1, &VAO);
+			glGenBuffers(1, &VBO);
+			glGenBuffers(1, &EBO);
+			glState().bindVertexArray(VAO);
+			glBindBuffer(GL_ARRAY_BUFFER, VBO);
+			EncodedVertices vertices = encodeVertices(mesh, encoding);
+			vertices.upload();
+			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+			glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.bytes(), indices.data(), GL_STATIC_DRAW);
+			instances.setupAttributes();
+
+			Timer timer;
+			for (int frame = 0; frame < warmup + frames; frame++)
+			{
+				if (frame == warmup)
+				{
+					glFinish();
+					timer.reset();
+				}
+				glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+				glState().drawElementsInstanced(GL_TRIANGLES, indices.count(), indices.type, 0, instances.count());
+			}
+			glFinish();
+			double ms = timer.elapsedMs() / frames;
+			double MB = (double)transformed * grid.instances * vertices.format.stride / (1024.0 * 1024.0);
+			std::cout << "  " << grid.name << "  " << grid.instances << "  " << VertexFormat::name(encoding) << "  " << vertices.format.stride
+				<< "  " << vertices.vertexBytes() << "  " << MB << "  " << ms << "  " << MB / 1024.0 / (ms / 1000.0) << std::endl;
+
+			glState().bindVertexArray(0);
+			glDeleteVertexArrays(1, &VAO);
+			glDeleteBuffers(1, &VBO);
+			glDeleteBuffers(1, &EBO);
+		}
+		glDeleteBuffers(1, &instances.ID);
+	}
+
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glViewport(0, 0, SCR_WIDTH, SCR_HEIGHT);
+	glDeleteRenderbuffers(1, &colorBuffer);
+	glDeleteRenderbuffers(1, &depthBuffer);
+	glDeleteFramebuffers(1, &FBO);
+}
+
+// --bench-surfaces: vertices per second of tessellating every surface at a few sizes (vertices,
+// normals, texture coordinates and the indices), on this thread and split over a ThreadPool;
+// the best of several runs
+void benchmarkSurfaces()
+{
+	const int runs = 3;
+	ThreadPool pool;
+	SphereSurface sphere(1.0f);
+	TorusSurface torus(1.0f, 0.3f);
+	glm::vec3 control[16];
+	for (int j = 0; j < 4; j++)
+		for (int i = 0; i < 4; i++)
+			control[j * 4 + i] = glm::vec3(i - 1.5f, ((i + j) % 2 == 0 ? 0.5f : -0.5f), j - 1.5f);
+	BezierPatchSurface patch(control);
+	struct Surface
+	{
+		const char* name;
+		const ParametricSurface* surface; // NULL: icosphere, 'segments' is its frequency
+	};
+	const Surface surfaces[] = { { "sphere", &sphere }, { "torus", &torus }, { "bezier", &patch }, { "icosphere", NULL } };
+	const int segments[] = { 32, 128, 512, 1024 };
+
+	std::cout << "--bench-surfaces: " << pool.size() << " threads, best of " << runs << " runs, million vertices/s" << std::endl;
+	std::cout << "  surface  segments  vertices  triangles  serial ms  serial Mv/s  pool ms  pool Mv/s" << std::endl;
+	for (const Surface& surface : surfaces)
+	{
+		for (int count : segments)
+		{
+			// the icosphere has 20 * count^2 triangles, its frequencies are kept at a similar size
+			int frequency = std::max(1, count / 4);
+			double ms[2];
+			size_t vertices = 0, triangles = 0;
+			for (int parallel = 0; parallel < 2; parallel++)
+			{
+				ms[parallel] = 0.0;
+				for (int run = 0; run < runs; run++)
+				{
+					Timer timer;
+					IndexedMesh mesh = surface.surface ? tessellateSurface(*surface.surface, count, count, parallel ? &pool : NULL)
+						: tessellateIcosphere(1.0f, frequency, parallel ? &pool : NULL);
+					double elapsed = timer.elapsedMs();
+					ms[parallel] = run == 0 ? elapsed : std::min(ms[parallel], elapsed);
+					vertices = mesh.vertexCount();
+					triangles = mesh.triangleCount();
+				}
+			}
+			std::cout << "  " << surface.name << "  " << (surface.surface ? count : frequency) << "  " << vertices << "  " << triangles
+				<< "  " << ms[0] << "  " << vertices / (ms[0] * 1000.0) << "  " << ms[1] << "  " << vertices / (ms[1] * 1000.0) << std::endl;
+		}
+	}
+}
+
+// --bench-lod: the camera moves away from the surface of an object with the given levels from
+// 1 to ~1000 units and back, the level picked at every distance and its triangles against the
+// finest level (SCR_HEIGHT pixels, 45 degrees). Then it jitters by +-5% around every distance
+// where a coarser level reaches the threshold, switches with and without hysteresis count the popping
+void benchmarkLod(const LodMesh& lods, float scale, float radius)
+{
+	const int steps = 32;
+	const int jitterFrames = 100;
+	float pixelsPerUnit = projectionScale(glm::radians(45.0f), (float)SCR_HEIGHT);
+	LodSelector selector;
+	LodSelector noHysteresis(selector.thresholdPixels, 0.0f);
+	BoundingSphere bounds;
+	bounds.center = glm::vec3(0.0f);
+	bounds.radius = radius * scale;
+	auto eyeAt = [&](float distance) { return glm::vec3(0.0f, 0.0f, bounds.radius + distance); };
+
+	std::cout << "--bench-lod: " << lods.levels.size() << " levels, threshold " << selector.thresholdPixels << " px, hysteresis "
+		<< selector.hysteresis * 100.0f << "%" << std::endl;
+	std::cout << "  distance  level out  level back  triangles  error px" << std::endl;
+	std::vector<size_t> outward(steps);
+	size_t level = 0;
+	size_t selectedTriangles = 0, fullTriangles = 0;
+	for (int pass = 0; pass < 2; pass++)
+	{
+		for (int i = 0; i < steps; i++)
+		{
+			int step = pass == 0 ? i : steps - 1 - i;
+			float distance = std::pow(1.25f, (float)step);
+			level = selector.select(lods, scale, lodDistance(bounds, eyeAt(distance), 0.1f), pixelsPerUnit, level);
+			selectedTriangles += lods.triangleCount(level);
+			fullTriangles += lods.triangleCount(0);
+			if (pass == 0)
+				outward[step] = level;
+			else
+				std::cout << "  " << distance << "  " << outward[step] << "  " << level << "  " << lods.triangleCount(level) << "  "
+					<< LodSelector::projectedError(lods, level, scale, distance, pixelsPerUnit) << std::endl;
+		}
+	}
+	std::cout << "  triangles over the path: " << selectedTriangles << " selected, " << fullTriangles << " at the finest level ("
+		<< 100.0 * selectedTriangles / fullTriangles << "%)" << std::endl;
+
+	for (size_t coarser = 1; coarser < lods.levels.size(); coarser++)
+	{
+		float boundary = lods.levels[coarser].error * scale * pixelsPerUnit / selector.thresholdPixels;
+		size_t levels[2] = { 0, 0 };
+		int changes[2] = { 0, 0 };
+		for (int frame = 0; frame < jitterFrames; frame++)
+		{
+			float distance = boundary * (1.0f + 0.05f * std::sin(frame * 0.7f));
+			for (int hysteresis = 0; hysteresis < 2; hysteresis++)
+			{
+				size_t next = (hysteresis ? selector : noHysteresis).select(lods, scale, lodDistance(bounds, eyeAt(distance), 0.1f), pixelsPerUnit, levels[hysteresis]);
+				if (frame > 0 && next != levels[hysteresis])
+					changes[hysteresis]++;
+				levels[hysteresis] = next;
+			}
+		}
+		std::cout << "  +-5% around " << boundary << ": " << changes[0] << " level changes in " << jitterFrames << " frames without hysteresis, "
+			<< changes[1] << " with" << std::endl;
+	}
+}
+
+// --bench-culling: a million spheres and a million boxes spread over a 400 unit cube around a
+// camera (45 degrees, SCR_WIDTH x SCR_HEIGHT, 0.1 to 100 units) tested against its frustum:
+// one object at a time with Frustum::intersects from an array of BoundingSphere, then the
+// structure of arrays with every path compiled in. Best of several runs in ns per object; the
+// SIMD paths must find exactly the objects of the scalar one
+void benchmarkCulling()
+{
+	const size_t objects = 1000000;
+	const int runs = 10;
+	std::mt19937 random(25);
+	std::uniform_real_distribution<float> coordinate(-200.0f, 200.0f);
+	std::uniform_real_distribution<float> size(0.25f, 4.0f);
+	std::vector<BoundingSphere> sphereList(objects);
+	SphereSet spheres;
+	BoxSet boxes;
+	for (size_t i = 0; i < objects; i++)
+	{
+		glm::vec3 center(coordinate(random), coordinate(random), coordinate(random));
+		glm::vec3 extent(size(random), size(random), size(random));
+		sphereList[i].center = center;
+		sphereList[i].radius = glm::length(extent);
+		spheres.add(sphereList[i]);
+		boxes.add(center, extent);
+	}
+	glm::mat4 view = glm::lookAt(glm::vec3(0.0f, 2.0f, 0.0f), glm::vec3(1.0f, 2.0f, -1.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+	glm::mat4 projection = glm::perspective(glm::radians(45.0f), (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
+	Frustum frustum = Frustum::fromMatrix(projection * view);
+
+	std::cout << "--bench-culling: " << objects << " objects, best of " << runs << " runs" << std::endl;
+	std::cout << "  volumes  path  visible  ms  ns/object  same as scalar" << std::endl;
+	auto report = [&](const char* volumes, const char* path, size_t visible, double ms, const char* same)
+	{
+		std::cout << "  " << volumes << "  " << path << "  " << visible << "  " << ms << "  " << ms * 1.0e6 / objects << "  " << same << std::endl;
+	};
+
+	// the reference: a branch per object and plane
+	std::vector<uint32_t> visible(objects);
+	double best = 0.0;
+	size_t count = 0;
+	for (int run = 0; run < runs; run++)
+	{
+		Timer timer;
+		count = 0;
+		for (size_t i = 0; i < objects; i++)
+			if (frustum.intersects(sphereList[i]))
+				visible[count++] = (uint32_t)i;
+		double elapsed = timer.elapsedMs();
+		best = run == 0 ? elapsed : std::min(best, elapsed);
+	}
+	report("spheres", "per object", count, best, "-");
+
+	const CullingPath paths[] = { CULL_SCALAR, CULL_SSE, CULL_AVX };
+	for (int boxed = 0; boxed < 2; boxed++)
+	{
+		std::vector<uint32_t> reference;
+		size_t referenceCount = 0;
+		for (CullingPath path : paths)
+		{
+			if (!cullingPathAvailable(path))
+			{
+				std::cout << "  " << (boxed ? "boxes" : "spheres") << "  " << cullingPathName(path) << "  not compiled in" << std::endl;
+				continue;
+			}
+			for (int run = 0; run < runs; run++)
+			{
+				Timer timer;
+				count = boxed ? cullBoxes(frustum, boxes, visible, path) : cullSpheres(frustum, spheres, visible, path);
+				double elapsed = timer.elapsedMs();
+				best = run == 0 ? elapsed : std::min(best, elapsed);
+			}
+			bool same = true;
+			if (path == CULL_SCALAR)
+			{
+				reference.assign(visible.begin(), visible.begin() + count);
+				referenceCount = count;
+			}
+			else
+				same = count == referenceCount && std::equal(reference.begin(), reference.end(), visible.begin());
+			report(boxed ? "boxes" : "spheres", cullingPathName(path), count, best, path == CULL_SCALAR ? "-" : same ? "yes" : "NO");
+		}
+	}
+}
\ No newline at end of file
@@ -0,0 +1,43 @@
+// Per-froxel point light lists of clustered forward shading (CLUSTERED variants).
+// Built on the CPU by ClusterGrid in Includes/clusters.h; the "Clusters" block is std140,
+// mirrored by ClusterUniforms - keep both in sync. Include after lights.glsl.
+
+layout (std140) uniform Clusters
+{
+    uvec4 clusterDims;   // froxels in x, y, z; number of lights
+    vec4 clusterScreen;  // framebuffer width, height; zNear, zFar
+    vec4 clusterDepth;   // slice = log(viewDepth) * clusterDepth.x + clusterDepth.y
+};
+
+uniform samplerBuffer clusterLights;   // 4 texels per PointLight
+uniform usamplerBuffer clusterGrid;    // first index, light count per froxel
+uniform usamplerBuffer clusterIndices; // light indices
+
+// (first index, light count) of the froxel containing this fragment
+uvec2 clusterLightList(float viewDepth)
+{
+    uvec3 cluster;
+    cluster.xy = uvec2(clamp(gl_FragCoord.xy / clusterScreen.xy, 0.0, 0.9999) * vec2(clusterDims.xy));
+    cluster.z = uint(clamp(log(viewDepth) * clusterDepth.x + clusterDepth.y, 0.0, float(clusterDims.z - 1u)));
+    int froxel = int(cluster.x + clusterDims.x * (cluster.y + clusterDims.y * cluster.z));
+    return texelFetch(clusterGrid, froxel).xy;
+}
+
+// the point light referenced by entry i of the index list
+PointLight clusterLight(uint i)
+{
+    int base = int(texelFetch(clusterIndices, int(i)).x) * 4;
+    vec4 t0 = texelFetch(clusterLights, base);
+    vec4 t1 = texelFetch(clusterLights, base + 1);
+    vec4 t2 = texelFetch(clusterLights, base + 2);
+    vec4 t3 = texelFetch(clusterLights, base + 3);
+    PointLight light;
+    light.position = t0.xyz;
+    light.constant = t0.w;
+    light.ambient = t1.xyz;
+    light.linear = t1.w;
+    light.diffuse = t2.xyz;
+    light.quadratic = t2.w;
+    light.specular = t3.xyz;
+    return light;
+}
@@ -0,0 +1,112 @@
+// G-buffer access and lighting functions of the deferred path (deferred_light.fs,
+// light_volume.fs). Same light math as multiple_lights.fs, in view space, with the
+// material read per pixel. Include after frame.glsl and lights.glsl.
+
+uniform sampler2D gNormal;
+uniform sampler2D gDiffuse;
+uniform sampler2D gSpecular;
+uniform sampler2D gDepth;
+
+const float fogIntensity = 0.5;
+const vec3 fogColor = vec3(0.7, 0.7, 0.7);
+
+struct Surface {
+    vec3 position;  // view space
+    vec3 normal;
+    vec3 diffuse;
+    vec3 specular;
+    float shininess;
+    bool fog;
+    bool blinn;
+};
+
+// depth of a pixel, 1.0 where nothing was drawn
+float readDepth(ivec2 pixel)
+{
+    return texelFetch(gDepth, pixel, 0).r;
+}
+
+Surface readSurface(ivec2 pixel, float depth)
+{
+    vec4 normal = texelFetch(gNormal, pixel, 0);
+    vec4 diffuse = texelFetch(gDiffuse, pixel, 0);
+    vec4 specular = texelFetch(gSpecular, pixel, 0);
+    vec2 uv = (vec2(pixel) + 0.5) / vec2(textureSize(gDepth, 0));
+    vec4 position = inverseProjection * vec4(vec3(uv, depth) * 2.0 - 1.0, 1.0);
+    Surface surface;
+    surface.position = position.xyz / position.w;
+    surface.normal = normalize(normal.xyz);
+    surface.shininess = normal.w;
+    surface.diffuse = diffuse.rgb;
+    surface.fog = diffuse.a > 0.5;
+    surface.specular = specular.rgb;
+    surface.blinn = specular.a > 0.5;
+    return surface;
+}
+
+// specular shading of the model stored for the surface
+float CalcSpecular(Surface surface, vec3 lightDir, vec3 viewDir, float diff)
+{
+    if (surface.blinn && diff != 0)
+    {
+        vec3 H = normalize(lightDir + viewDir);
+        return pow(max(dot(surface.normal, H), 0.0), surface.shininess);
+    }
+    vec3 reflectDir = reflect(-lightDir, surface.normal);
+    return pow(max(dot(viewDir, reflectDir), 0.0), surface.shininess);
+}
+
+// calculates the color when using a directional light, shadow scales its direct part,
+// the ambient part is the sky ambient.
+vec3 CalcDirLight(DirLight light, Surface surface, vec3 viewDir, float shadow)
+{
+    vec3 lightDir = normalize(-light.direction);
+    float diff = max(dot(surface.normal, lightDir), 0.0);
+    float spec = CalcSpecular(surface, lightDir, viewDir, diff);
+    vec3 ambient = light.ambient * CalcAmbient(mat3(inverseView) * surface.normal) * surface.diffuse;
+    vec3 diffuse = light.diffuse * diff * surface.diffuse;
+    vec3 specular = light.specular * spec * surface.specular;
+    return (ambient + shadow * (diffuse + specular));
+}
+
+// calculates the color when using a point light.
+vec3 CalcPointLight(PointLight light, Surface surface, vec3 viewDir)
+{
+    vec3 lightDir = normalize(light.position - surface.position);
+    float diff = max(dot(surface.normal, lightDir), 0.0);
+    float spec = CalcSpecular(surface, lightDir, viewDir, diff);
+    float distance = length(light.position - surface.position);
+    float attenuation = 1.0 / (light.constant + light.linear * distance + light.quadratic * (distance * distance));    
+    vec3 ambient = light.ambient * surface.diffuse;
+    vec3 diffuse = light.diffuse * diff * surface.diffuse;
+    vec3 specular = light.specular * spec * surface.specular;
+    return (ambient + diffuse + specular) * attenuation;
+}
+
+// calculates the color when using a spot light, shadow scales its direct part.
+vec3 CalcSpotLight(SpotLight light, Surface surface, vec3 viewDir, float shadow)
+{
+    vec3 lightDir = normalize(light.position - surface.position);
+    float diff = max(dot(surface.normal, lightDir), 0.0);
+    float spec = CalcSpecular(surface, lightDir, viewDir, diff);
+    float distance = length(light.position - surface.position);
+    float attenuation = 1.0 / (light.constant + light.linear * distance + light.quadratic * (distance * distance));    
+    float theta = dot(lightDir, normalize(-light.direction)); 
+    float epsilon = light.cutOff - light.outerCutOff;
+    float intensity = clamp((theta - light.outerCutOff) / epsilon, 0.0, 1.0);
+    vec3 ambient = light.ambient * surface.diffuse;
+    vec3 diffuse = light.diffuse * diff * surface.diffuse;
+    vec3 specular = light.specular * spec * surface.specular;
+    return (ambient + shadow * (diffuse + specular)) * attenuation * intensity;
+}
+
+// share of the lit color that survives the fog; 1 for surfaces without fog
+float CalcFogFactor(Surface surface)
+{
+    if (!surface.fog)
+        return 1.0;
+    float gradient = (fogIntensity * fogIntensity - 50 * fogIntensity + 60);
+    float distance = length(surface.position);
+    float fog = exp(-pow((distance / gradient), 4));
+    return clamp(fog, 0.0, 1.0);
+}
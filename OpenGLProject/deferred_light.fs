@@ -0,0 +1,31 @@
+#version 330 core
+out vec4 FragColor;
+
+#include "frame.glsl"
+#include "lights.glsl"
+#include "deferred.glsl"
+#include "shadows.glsl"
+
+// fullscreen pass of the deferred path: directional light, spot lights and fog.
+// point lights are added afterwards by the light volumes; the scene depth is copied
+// into the default framebuffer so they (and the forward passes after) can test against it
+void main()
+{
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    float depth = readDepth(pixel);
+    if (depth == 1.0)
+        discard;
+    Surface surface = readSurface(pixel, depth);
+    vec3 viewDir = normalize(-surface.position);
+
+    vec3 result = CalcDirLight(dirLight, surface, viewDir, CalcShadow(surface.position, surface.normal));
+    for(int i = FIRST_SPOT_LIGHT; i < NR_SPOT_LIGHTS; i++)
+        result += CalcSpotLight(spotLight[i], surface, viewDir, CalcSpotShadow(i, surface.position, surface.normal));
+
+    // mix(fogColor, lit, fog) is linear in the lit color, the light volumes scale their part by fog
+    float fog = CalcFogFactor(surface);
+    result = mix(fogColor, result, fog);
+
+    FragColor = vec4(result, 1.0);
+    gl_FragDepth = depth;
+}
@@ -0,0 +1,13 @@
+// Per-frame camera constants shared by all shaders, filled once per frame from a UBO.
+// std140 layout, mirrored by FrameUniforms in Includes/frame_uniforms.h - keep both in sync.
+
+layout (std140) uniform Frame
+{
+    mat4 view;
+    mat4 projection;
+    mat4 viewProjection;
+    mat4 inverseView;
+    mat4 inverseProjection;
+    mat4 inverseViewProjection;
+    vec4 viewPos;
+};
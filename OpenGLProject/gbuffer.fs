@@ -0,0 +1,34 @@
+#version 330 core
+// geometry pass of the deferred path: surface attributes instead of lighting,
+// layout described in Includes/deferred.h
+layout (location = 0) out vec4 gNormal;
+layout (location = 1) out vec4 gDiffuse;
+layout (location = 2) out vec4 gSpecular;
+
+struct Material {
+    vec3 diffuse;
+    vec3 specular;
+    float shininess;
+}; 
+
+#include "frame.glsl"
+
+// compile time features (see Includes/shader_variants.h): BLINN and FOG are stored per pixel
+in vec3 Normal; // view space
+
+uniform Material material;
+
+void main()
+{
+    gNormal = vec4(normalize(Normal), material.shininess);
+#ifdef FOG
+    gDiffuse = vec4(material.diffuse, 1.0);
+#else
+    gDiffuse = vec4(material.diffuse, 0.0);
+#endif
+#ifdef BLINN
+    gSpecular = vec4(material.specular, 1.0);
+#else
+    gSpecular = vec4(material.specular, 0.0);
+#endif
+}
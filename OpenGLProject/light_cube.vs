@@ -1,11 +1,19 @@
 #version 330 core
-layout (location = 0) in vec3 aPos;
+#include "vertex_format.glsl"
 
+#include "frame.glsl"
+
+#ifdef INSTANCED
+// per-instance model matrix, see instancing.h
+layout (location = 3) in mat4 instanceModel;
+#else
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+#endif
 
 void main()
 {
-    gl_Position = projection * view * model * vec4(aPos, 1.0);
+#ifdef INSTANCED
+    mat4 model = instanceModel;
+#endif
+    gl_Position = viewProjection * model * vec4(decodePosition(), 1.0);
 }
\ No newline at end of file
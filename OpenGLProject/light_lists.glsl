@@ -0,0 +1,15 @@
+// Per-draw light lists of the CULLED variants, built on the CPU by LightCuller (Includes/light_culling.h).
+// LightList.x indexes pointLights[], LightList.y indexes spotLight[]; each is packed as
+// the light count in bits 0..3 followed by 4 bits per index.
+
+flat in uvec2 LightList;
+
+uint lightListCount(uint list)
+{
+    return list & 15u;
+}
+
+uint lightListIndex(uint list, uint i)
+{
+    return (list >> (4u + 4u * i)) & 15u;
+}
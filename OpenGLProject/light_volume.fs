@@ -0,0 +1,30 @@
+#version 330 core
+out vec4 FragColor;
+
+#include "frame.glsl"
+#include "lights.glsl"
+#include "deferred.glsl"
+
+flat in vec4 Light0;
+flat in vec4 Light1;
+flat in vec4 Light2;
+flat in vec4 Light3;
+
+// one point light of the deferred path, added to every pixel its volume covers
+void main()
+{
+    ivec2 pixel = ivec2(gl_FragCoord.xy);
+    Surface surface = readSurface(pixel, readDepth(pixel));
+
+    PointLight light;
+    light.position = Light0.xyz;
+    light.constant = Light0.w;
+    light.ambient = Light1.xyz;
+    light.linear = Light1.w;
+    light.diffuse = Light2.xyz;
+    light.quadratic = Light2.w;
+    light.specular = Light3.xyz;
+
+    vec3 result = CalcPointLight(light, surface, normalize(-surface.position));
+    FragColor = vec4(result * CalcFogFactor(surface), 1.0);
+}
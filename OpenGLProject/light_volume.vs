@@ -0,0 +1,25 @@
+#version 330 core
+layout (location = 0) in vec3 aPos;
+
+// per-instance attributes, see LightVolume in Includes/deferred.h
+layout (location = 1) in vec4 volumeSphere; // center (view space), radius
+layout (location = 2) in vec4 light0;       // position (view space), constant
+layout (location = 3) in vec4 light1;       // ambient, linear
+layout (location = 4) in vec4 light2;       // diffuse, quadratic
+layout (location = 5) in vec4 light3;       // specular
+
+flat out vec4 Light0;
+flat out vec4 Light1;
+flat out vec4 Light2;
+flat out vec4 Light3;
+
+#include "frame.glsl"
+
+void main()
+{
+    Light0 = light0;
+    Light1 = light1;
+    Light2 = light2;
+    Light3 = light3;
+    gl_Position = projection * vec4(volumeSphere.xyz + aPos * volumeSphere.w, 1.0);
+}
@@ -0,0 +1,66 @@
+// Lights shared by all lit shaders, filled once per frame from a UBO.
+// Positions and directions are in view space, transformed on the CPU.
+// std140 layout, mirrored by LightBlock in Includes/lights.h - keep both in sync.
+
+struct DirLight {
+    vec3 direction;
+	
+    vec3 ambient;
+    vec3 diffuse;
+    vec3 specular;
+};
+
+struct PointLight {
+    vec3 position;
+    float constant;
+	
+    vec3 ambient;
+    float linear;
+    vec3 diffuse;
+    float quadratic;
+    vec3 specular;
+};
+
+struct SpotLight {
+    vec3 position;
+    float cutOff;
+    vec3 direction;
+    float outerCutOff;
+  
+    vec3 ambient;
+    float constant;
+    vec3 diffuse;
+    float linear;
+    vec3 specular;       
+    float quadratic;
+};
+
+// array sizes of the block; the Shader variant system injects them from Includes/lights.h
+#ifndef NR_POINT_LIGHTS
+#define NR_POINT_LIGHTS 4
+#endif
+#ifndef NR_SPOT_LIGHTS
+#define NR_SPOT_LIGHTS 2
+#endif
+// spotLight[0] is the camera flashlight; variants without it start the spot loop at 1
+#ifndef FIRST_SPOT_LIGHT
+#define FIRST_SPOT_LIGHT 0
+#endif
+
+layout (std140) uniform Lights
+{
+    DirLight dirLight;
+    PointLight pointLights[NR_POINT_LIGHTS];
+    SpotLight spotLight[NR_SPOT_LIGHTS];
+    vec4 ambientSH[9];  // sky ambient, order 3 spherical harmonics in world space
+};
+
+// diffuse sky ambient for a world space normal, scale it by dirLight.ambient;
+// the coefficients already hold the basis constants and the cosine convolution
+vec3 CalcAmbient(vec3 n)
+{
+    vec4 result = ambientSH[0] + ambientSH[1] * n.y + ambientSH[2] * n.z + ambientSH[3] * n.x
+        + ambientSH[4] * (n.x * n.y) + ambientSH[5] * (n.y * n.z) + ambientSH[6] * (3.0 * n.z * n.z - 1.0)
+        + ambientSH[7] * (n.x * n.z) + ambientSH[8] * (n.x * n.x - n.y * n.y);
+    return max(result.rgb, vec3(0.0));
+}
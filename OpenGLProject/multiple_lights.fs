@@ -7,62 +7,35 @@ struct Material {
     float shininess;
 }; 
 
-struct DirLight {
-    vec3 direction;
-    vec3 ambient;
-    vec3 diffuse;
-    vec3 specular;
-};
-
-struct PointLight {
-    vec3 position;
-    
-    float constant;
-    float linear;
-    float quadratic;
-	
-    vec3 ambient;
-    vec3 diffuse;
-    vec3 specular;
-};
-
-struct SpotLight {
-    vec3 position;
-    vec3 direction;
-    float cutOff;
-    float outerCutOff;
-  
-    float constant;
-    float linear;
-    float quadratic;
-  
-    vec3 ambient;
-    vec3 diffuse;
-    vec3 specular;       
-};
-
-#define NR_POINT_LIGHTS 4
-#define NR_SPOT_LIGHTS 2
-
-float fogIntensity = 0.5;
-vec3 fogColor = vec3(0.7, 0.7, 0.7);
+#include "frame.glsl"
+#include "lights.glsl"
+#ifdef CLUSTERED
+#include "clusters.glsl"
+#endif
+#ifdef CULLED
+#include "light_lists.glsl"
+#endif
+#include "shadows.glsl"
+
+// compile time features (see Includes/shader_variants.h):
+// BLINN - Blinn-Phong instead of Phong specular, FOG - distance fog,
+// CLUSTERED - point lights come from the froxel light lists instead of the Lights block,
+// CULLED - point (unless CLUSTERED) and spot lights come from the per-draw light list,
+// SHADOWS - the directional light is shadowed by the cascaded shadow map, spot lights by the atlas
+const float fogIntensity = 0.5;
+const vec3 fogColor = vec3(0.7, 0.7, 0.7);
 
 in vec3 FragPos;
 in vec3 Normal;
 in vec2 TexCoords;
 
-uniform vec3 viewPos;
-uniform DirLight dirLight;
-uniform PointLight pointLights[NR_POINT_LIGHTS];
-uniform SpotLight spotLight[NR_SPOT_LIGHTS];
 uniform Material material;
-uniform mat4 view;
-uniform int mode;
 
 // function prototypes
-vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir);
+vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir, float shadow);
 vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir);
-vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir);
+vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir, float shadow);
+float CalcSpecular(vec3 normal, vec3 lightDir, vec3 viewDir, float diff);
 float CalcFogFactor(vec3 worldPos);
 
 void main()
@@ -78,69 +51,64 @@ void main()
     // this fragment's final color. Also we add Fog.
     // == =====================================================
     // phase 1: directional lighting
-    vec3 result = CalcDirLight(dirLight, norm, viewDir);
+    vec3 result = CalcDirLight(dirLight, norm, viewDir, CalcShadow(FragPos, norm));
     // phase 2: point lights
+#ifdef CLUSTERED
+    uvec2 lightList = clusterLightList(-FragPos.z);
+    for(uint i = 0u; i < lightList.y; i++)
+        result += CalcPointLight(clusterLight(lightList.x + i), norm, FragPos, viewDir);
+#elif defined(CULLED)
+    for(uint i = 0u; i < lightListCount(LightList.x); i++)
+        result += CalcPointLight(pointLights[lightListIndex(LightList.x, i)], norm, FragPos, viewDir);
+#else
     for(int i = 0; i < NR_POINT_LIGHTS; i++)
         result += CalcPointLight(pointLights[i], norm, FragPos, viewDir);    
+#endif
     // phase 3: spot light
-    for(int i = 0; i < NR_SPOT_LIGHTS; i++)
+#ifdef CULLED
+    for(uint i = 0u; i < lightListCount(LightList.y); i++)
     {
-        if (spotLight[i].diffuse == vec3(0.0, 0.0, 0.0)) continue;
-
-        result += CalcSpotLight(spotLight[i], norm, FragPos, viewDir);    
+        int light = int(lightListIndex(LightList.y, i));
+        result += CalcSpotLight(spotLight[light], norm, FragPos, viewDir, CalcSpotShadow(light, FragPos, norm));
     }
+#else
+    for(int i = FIRST_SPOT_LIGHT; i < NR_SPOT_LIGHTS; i++)
+        result += CalcSpotLight(spotLight[i], norm, FragPos, viewDir, CalcSpotShadow(i, FragPos, norm));
+#endif
     
+#ifdef FOG
     float fog_factor = CalcFogFactor(FragPos);
     result = mix(fogColor, result, fog_factor);
+#endif
 
 
     FragColor = vec4(result, 1.0);
 }
 
-// calculates the color when using a directional light.
-vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir)
+// calculates the color when using a directional light, shadow scales its direct part,
+// the ambient part is the sky ambient.
+vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir, float shadow)
 {
     vec3 lightDir = normalize(-light.direction);
     // diffuse shading
     float diff = max(dot(normal, lightDir), 0.0);
     // specular shading
-    float spec = 0.0;
-    if (mode == 1 && diff != 0)
-    {
-        vec3 H = normalize(lightDir + viewDir);
-        spec = pow(max(dot(normal, H), 0.0), material.shininess);
-    }
-    else
-    {
-        vec3 reflectDir = reflect(-lightDir, normal);
-        spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
-    }
+    float spec = CalcSpecular(normal, lightDir, viewDir, diff);
     // combine results
-    vec3 ambient = light.ambient * material.diffuse;
+    vec3 ambient = light.ambient * CalcAmbient(mat3(inverseView) * normal) * material.diffuse;
     vec3 diffuse = light.diffuse * diff * material.diffuse;
     vec3 specular = light.specular * spec * material.specular;
-    return (ambient + diffuse + specular);
+    return (ambient + shadow * (diffuse + specular));
 }
 
 // calculates the color when using a point light.
 vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
 {
-    light.position = vec3(view * vec4(light.position, 1.0));
     vec3 lightDir = normalize(light.position - fragPos);
     // diffuse shading
     float diff = max(dot(normal, lightDir), 0.0);
     // specular shading
-    float spec = 0.0;
-    if (mode == 1 && diff != 0)
-    {
-        vec3 H = normalize(lightDir + viewDir);
-        spec = pow(max(dot(normal, H), 0.0), material.shininess);
-    }
-    else
-    {
-        vec3 reflectDir = reflect(-lightDir, normal);
-        spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
-    }
+    float spec = CalcSpecular(normal, lightDir, viewDir, diff);
     // attenuation
     float distance = length(light.position - fragPos);
     float attenuation = 1.0 / (light.constant + light.linear * distance + light.quadratic * (distance * distance));    
@@ -154,30 +122,18 @@ vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
     return (ambient + diffuse + specular);
 }
 
-// calculates the color when using a spot light.
-vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
+// calculates the color when using a spot light, shadow scales its direct part.
+vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir, float shadow)
 {
-    light.position = vec3(view * vec4(light.position, 1.0));
     vec3 lightDir = normalize(light.position - fragPos);
     // diffuse shading
     float diff = max(dot(normal, lightDir), 0.0);
     // specular shading
-    float spec = 0.0;
-    if (mode == 1 && diff != 0)
-    {
-        vec3 H = normalize(lightDir + viewDir);
-        spec = pow(max(dot(normal, H), 0.0), material.shininess);
-    }
-    else
-    {
-        vec3 reflectDir = reflect(-lightDir, normal);
-        spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
-    }
+    float spec = CalcSpecular(normal, lightDir, viewDir, diff);
     // attenuation
     float distance = length(light.position - fragPos);
     float attenuation = 1.0 / (light.constant + light.linear * distance + light.quadratic * (distance * distance));    
     // spotlight intensity
-    light.direction = vec3(view * vec4(light.direction, 0.0));
     float theta = dot(lightDir, normalize(-light.direction)); 
     float epsilon = light.cutOff - light.outerCutOff;
     float intensity = clamp((theta - light.outerCutOff) / epsilon, 0.0, 1.0);
@@ -188,12 +144,25 @@ vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
     ambient *= attenuation * intensity;
     diffuse *= attenuation * intensity;
     specular *= attenuation * intensity;
-    return (ambient + diffuse + specular);
+    return (ambient + shadow * (diffuse + specular));
+}
+
+// specular shading of the selected model
+float CalcSpecular(vec3 normal, vec3 lightDir, vec3 viewDir, float diff)
+{
+#ifdef BLINN
+    if (diff != 0)
+    {
+        vec3 H = normalize(lightDir + viewDir);
+        return pow(max(dot(normal, H), 0.0), material.shininess);
+    }
+#endif
+    vec3 reflectDir = reflect(-lightDir, normal);
+    return pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
 }
 
 float CalcFogFactor(vec3 worldPos)
 {
-    if (fogIntensity == 0) return 1;
     float gradient = (fogIntensity * fogIntensity - 50 * fogIntensity + 60);
     float distance = length(-worldPos);
     float fog = exp(-pow((distance / gradient), 4));
@@ -1,21 +1,50 @@
 #version 330 core
-layout (location = 0) in vec3 aPos;
-layout (location = 1) in vec3 aNormal;
-layout (location = 2) in vec2 aTexCoords;
+#include "vertex_format.glsl"
 
 out vec3 FragPos;
 out vec3 Normal;
 out vec2 TexCoords;
 out vec3 WorldPos;
+#ifdef CULLED
+flat out uvec2 LightList;
+#endif
 
+#include "frame.glsl"
+
+#ifdef INSTANCED
+// per-instance attributes, see instancing.h
+layout (location = 3) in mat4 instanceModel;
+layout (location = 7) in mat3 instanceNormalMatrix;
+#ifdef CULLED
+layout (location = 10) in uvec2 instanceLightList;
+#endif
+#else
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+uniform mat3 normalMatrix; // world space, computed on the CPU once per object
+#ifdef CULLED
+uniform uvec2 lightList;
+#endif
+#endif
 
 void main()
 {
-    FragPos = vec3(view * model * vec4(aPos, 1.0));
-    Normal = mat3(transpose(inverse(view * model))) * aNormal;  
+    vec3 position = decodePosition();
+    vec3 normal = decodeNormal();
+#ifdef INSTANCED
+    mat4 model = instanceModel;
+    FragPos = vec3(view * model * vec4(position, 1.0));
+    // the view matrix is rigid, so it can be applied after the world space normal matrix
+    Normal = mat3(view) * instanceNormalMatrix * normal;
+#ifdef CULLED
+    LightList = instanceLightList;
+#endif
+#else
+    FragPos = vec3(view * model * vec4(position, 1.0));
+    Normal = mat3(view) * normalMatrix * normal;
+#ifdef CULLED
+    LightList = lightList;
+#endif
+#endif
     TexCoords = aTexCoords;
     
     gl_Position = projection * vec4(FragPos, 1.0);
@@ -0,0 +1,6 @@
+#version 330 core
+
+// only depth is written
+void main()
+{
+}
@@ -0,0 +1,21 @@
+#version 330 core
+#include "vertex_format.glsl"
+
+// depth only pass of the shadow map casters, lightSpace maps world to light clip space
+uniform mat4 lightSpace;
+
+#ifdef INSTANCED
+// per-instance attributes, see instancing.h
+layout (location = 3) in mat4 instanceModel;
+#else
+uniform mat4 model;
+#endif
+
+void main()
+{
+#ifdef INSTANCED
+    gl_Position = lightSpace * instanceModel * vec4(decodePosition(), 1.0);
+#else
+    gl_Position = lightSpace * model * vec4(decodePosition(), 1.0);
+#endif
+}
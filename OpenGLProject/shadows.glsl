@@ -0,0 +1,77 @@
+// Cascaded shadow map of the directional light and spot light shadow atlas (SHADOWS variants).
+// Rendered by CascadedShadowMap in Includes/shadows.h; the "Shadows" block is std140,
+// mirrored by ShadowUniforms - keep both in sync.
+
+// Included by every lit shader; variants without SHADOWS get the stubs below and no blocks.
+
+#ifndef SHADOWS
+// every light reaches every fragment
+float CalcShadow(vec3 fragPos, vec3 normal)
+{
+    return 1.0;
+}
+
+float CalcSpotShadow(int light, vec3 fragPos, vec3 normal)
+{
+    return 1.0;
+}
+#else
+// must match SHADOW_CASCADES in Includes/shadows.h
+#define NR_SHADOW_CASCADES 3
+
+layout (std140) uniform Shadows
+{
+    mat4 shadowMatrices[NR_SHADOW_CASCADES]; // view space -> shadow map coordinates and depth
+    vec4 shadowSplits;                       // far view depth of each cascade
+    vec4 shadowTexelSizes;                   // world size of a texel per cascade
+};
+
+uniform sampler2DArrayShadow shadowMap;
+
+// share of the directional light reaching a view space position (1 - lit, 0 - shadowed)
+float CalcShadow(vec3 fragPos, vec3 normal)
+{
+    float depth = -fragPos.z;
+    if (depth > shadowSplits[NR_SHADOW_CASCADES - 1])
+        return 1.0;
+    int cascade = 0;
+    while (cascade < NR_SHADOW_CASCADES - 1 && depth > shadowSplits[cascade])
+        cascade++;
+    // offset along the normal by about a texel against acne on surfaces facing away from the light
+    vec3 position = fragPos + normal * shadowTexelSizes[cascade] * 1.5;
+    vec4 coords = shadowMatrices[cascade] * vec4(position, 1.0);
+    return texture(shadowMap, vec4(coords.xy, float(cascade), coords.z));
+}
+
+
+// Spot light shadows, one tile per light in a shared atlas (SpotShadowAtlas in Includes/shadows.h);
+// "SpotShadows" is std140, mirrored by SpotShadowUniforms. A tile is sampled with the matrix it
+// was last drawn with, so a light whose update was postponed still gets a consistent shadow.
+layout (std140) uniform SpotShadows
+{
+    mat4 spotShadowMatrices[NR_SPOT_LIGHTS]; // view space -> light clip space, xy biased to [0, 1]
+    vec4 spotShadowTiles[NR_SPOT_LIGHTS];    // atlas offset xy and size z (0 - no shadow), w: texel size at distance 1
+};
+
+uniform sampler2DShadow spotShadowAtlas;
+
+// share of a spot light reaching a view space position (1 - lit, 0 - shadowed)
+float CalcSpotShadow(int light, vec3 fragPos, vec3 normal)
+{
+    vec4 tile = spotShadowTiles[light];
+    if (tile.z == 0.0)
+        return 1.0;
+    // normal offset of about a texel at the fragment's distance from the light
+    float distance = (spotShadowMatrices[light] * vec4(fragPos, 1.0)).w;
+    vec4 coords = spotShadowMatrices[light] * vec4(fragPos + normal * tile.w * distance * 1.5, 1.0);
+    if (coords.w <= 0.0)
+        return 1.0;
+    coords.xyz /= coords.w;
+    if (any(lessThan(coords.xy, vec2(0.0))) || any(greaterThan(coords.xy, vec2(1.0))))
+        return 1.0;
+    // the bilinear taps must not reach the neighbouring tiles
+    vec2 halfTexel = 0.5 / vec2(textureSize(spotShadowAtlas, 0));
+    vec2 uv = clamp(tile.xy + coords.xy * tile.z, tile.xy + halfTexel, tile.xy + tile.z - halfTexel);
+    return texture(spotShadowAtlas, vec3(uv, coords.z));
+}
+#endif
\ No newline at end of file
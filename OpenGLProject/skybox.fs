@@ -4,8 +4,14 @@ out vec4 FragColor;
 in vec3 TexCoords;
 
 uniform samplerCube skybox;
+// mip of the prefiltered environment map shown instead of the sky (M key), negative to
+// let the hardware pick the mip of the sky from the screen space derivatives
+uniform float skyboxLod;
 
 void main()
 {    
-    FragColor = texture(skybox, TexCoords);
+    if (skyboxLod < 0.0)
+        FragColor = texture(skybox, TexCoords);
+    else
+        FragColor = textureLod(skybox, TexCoords, skyboxLod);
 }
\ No newline at end of file
@@ -1,14 +1,30 @@
 #version 330 core
-layout (location = 0) in vec3 aPos;
-
 out vec3 TexCoords;
 
-uniform mat4 projection;
-uniform mat4 view;
+#include "frame.glsl"
 
 void main()
 {
+#ifdef SKYBOX_CUBE
+    // 36 vertex cube around the camera (--bench-skybox baseline only)
+    const vec3 corners[8] = vec3[8](
+        vec3(-1.0, -1.0, -1.0), vec3(1.0, -1.0, -1.0), vec3(-1.0, 1.0, -1.0), vec3(1.0, 1.0, -1.0),
+        vec3(-1.0, -1.0, 1.0), vec3(1.0, -1.0, 1.0), vec3(-1.0, 1.0, 1.0), vec3(1.0, 1.0, 1.0));
+    const int indices[36] = int[36](
+        2, 0, 1, 1, 3, 2,  4, 0, 2, 2, 6, 4,  1, 5, 7, 7, 3, 1,
+        4, 6, 7, 7, 5, 4,  2, 3, 7, 7, 6, 2,  0, 4, 1, 1, 4, 5);
+    vec3 aPos = corners[indices[gl_VertexID]];
     TexCoords = aPos;
-    vec4 pos = projection * view * vec4(aPos, 1.0);
+    // remove translation from the view matrix
+    vec4 pos = projection * mat4(mat3(view)) * vec4(aPos, 1.0);
     gl_Position = pos.xyww;
-}  
\ No newline at end of file
+#else
+    // fullscreen triangle on the far plane, drawn with 3 vertices and no attributes; the
+    // view direction is the far plane point under the pixel seen from the camera
+    vec2 corner = vec2((gl_VertexID << 1) & 2, gl_VertexID & 2);
+    vec4 clip = vec4(corner * 2.0 - 1.0, 1.0, 1.0);
+    vec4 farPoint = inverseViewProjection * clip;
+    TexCoords = farPoint.xyz / farPoint.w - viewPos.xyz;
+    gl_Position = clip;
+#endif
+}
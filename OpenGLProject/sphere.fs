@@ -6,63 +6,31 @@ struct Material {
     vec3 objectColor;
 }; 
 
-struct DirLight {
-    vec3 direction;
-	
-    vec3 ambient;
-    vec3 diffuse;
-    vec3 specular;
-};
-
-struct PointLight {
-    vec3 position;
-    
-    float constant;
-    float linear;
-    float quadratic;
-	
-    vec3 ambient;
-    vec3 diffuse;
-    vec3 specular;
-};
-
-struct SpotLight {
-    vec3 position;
-    vec3 direction;
-    float cutOff;
-    float outerCutOff;
-  
-    float constant;
-    float linear;
-    float quadratic;
-  
-    vec3 ambient;
-    vec3 diffuse;
-    vec3 specular;       
-};
-
-#define NR_POINT_LIGHTS 4
-#define NR_SPOT_LIGHTS 2
+#include "frame.glsl"
+#include "lights.glsl"
+#ifdef CLUSTERED
+#include "clusters.glsl"
+#endif
+#ifdef CULLED
+#include "light_lists.glsl"
+#endif
+#include "shadows.glsl"
 
 in vec3 FragPos;
 in vec3 Normal;
 
-uniform vec3 viewPos;
-uniform DirLight dirLight;
-uniform PointLight pointLights[NR_POINT_LIGHTS];
-uniform SpotLight spotLight[NR_SPOT_LIGHTS];
 uniform Material material;
 
 // function prototypes
-vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir);
+vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir, float shadow);
 vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir);
-vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir);
+vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir, float shadow);
 
 void main()
 {    
     // properties
     vec3 norm = normalize(Normal);
-    vec3 viewDir = normalize(viewPos - FragPos);
+    vec3 viewDir = normalize(-FragPos);
     
     // == =====================================================
     // Our lighting is set up in 3 phases: directional, point lights and an optional flashlight
@@ -71,19 +39,37 @@ void main()
     // this fragment's final color.
     // == =====================================================
     // phase 1: directional lighting
-    vec3 result = CalcDirLight(dirLight, norm, viewDir);
+    vec3 result = CalcDirLight(dirLight, norm, viewDir, CalcShadow(FragPos, norm));
     // phase 2: point lights
+#ifdef CLUSTERED
+    uvec2 lightList = clusterLightList(-FragPos.z);
+    for(uint i = 0u; i < lightList.y; i++)
+        result += CalcPointLight(clusterLight(lightList.x + i), norm, FragPos, viewDir);
+#elif defined(CULLED)
+    for(uint i = 0u; i < lightListCount(LightList.x); i++)
+        result += CalcPointLight(pointLights[lightListIndex(LightList.x, i)], norm, FragPos, viewDir);
+#else
     for(int i = 0; i < NR_POINT_LIGHTS; i++)
         result += CalcPointLight(pointLights[i], norm, FragPos, viewDir);    
+#endif
     // phase 3: spot light
-    for(int i = 0; i < NR_SPOT_LIGHTS; i++)
-        result += CalcSpotLight(spotLight[i], norm, FragPos, viewDir);  
+#ifdef CULLED
+    for(uint i = 0u; i < lightListCount(LightList.y); i++)
+    {
+        int light = int(lightListIndex(LightList.y, i));
+        result += CalcSpotLight(spotLight[light], norm, FragPos, viewDir, CalcSpotShadow(light, FragPos, norm));
+    }
+#else
+    for(int i = FIRST_SPOT_LIGHT; i < NR_SPOT_LIGHTS; i++)
+        result += CalcSpotLight(spotLight[i], norm, FragPos, viewDir, CalcSpotShadow(i, FragPos, norm));
+#endif
     
     FragColor = vec4(result, 1.0);
 }
 
-// calculates the color when using a directional light.
-vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir)
+// calculates the color when using a directional light, shadow scales its direct part,
+// the ambient part is the sky ambient.
+vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir, float shadow)
 {
     vec3 lightDir = normalize(-light.direction);
     // diffuse shading
@@ -92,10 +78,10 @@ vec3 CalcDirLight(DirLight light, vec3 normal, vec3 viewDir)
     vec3 reflectDir = reflect(-lightDir, normal);
     float spec = pow(max(dot(viewDir, reflectDir), 0.0), material.shininess);
     // combine results
-    vec3 ambient = light.ambient * material.objectColor;
+    vec3 ambient = light.ambient * CalcAmbient(mat3(inverseView) * normal) * material.objectColor;
     vec3 diffuse = light.diffuse * diff * material.objectColor;
     vec3 specular = light.specular * spec * material.objectColor;
-    return (ambient + diffuse + specular);
+    return (ambient + shadow * (diffuse + specular));
 }
 
 // calculates the color when using a point light.
@@ -120,8 +106,8 @@ vec3 CalcPointLight(PointLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
     return (ambient + diffuse + specular);
 }
 
-// calculates the color when using a spot light.
-vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
+// calculates the color when using a spot light, shadow scales its direct part.
+vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir, float shadow)
 {
     vec3 lightDir = normalize(light.position - fragPos);
     // diffuse shading
@@ -143,5 +129,5 @@ vec3 CalcSpotLight(SpotLight light, vec3 normal, vec3 fragPos, vec3 viewDir)
     ambient *= attenuation * intensity;
     diffuse *= attenuation * intensity;
     specular *= attenuation * intensity;
-    return (ambient + diffuse + specular);
+    return (ambient + shadow * (diffuse + specular));
 }
\ No newline at end of file
@@ -1,18 +1,29 @@
 #version 330 core
-layout (location = 0) in vec3 aPos;
-layout (location = 1) in vec3 aNormal;
+#include "vertex_format.glsl"
 
 out vec3 FragPos;
 out vec3 Normal;
+#ifdef CULLED
+flat out uvec2 LightList;
+#endif
 
+#include "frame.glsl"
+
+// lighting is done in view space like in multiple_lights.vs
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+uniform mat3 normalMatrix; // world space, computed on the CPU once per object
+#ifdef CULLED
+uniform uvec2 lightList;
+#endif
 
 void main()
 {
-    FragPos = vec3(model * vec4(aPos, 1.0));
-    Normal = mat3(transpose(inverse(model))) * aNormal;  
+    FragPos = vec3(view * model * vec4(decodePosition(), 1.0));
+    // the view matrix is rigid, so it can be applied after the world space normal matrix
+    Normal = mat3(view) * normalMatrix * decodeNormal();
+#ifdef CULLED
+    LightList = lightList;
+#endif
 
-    gl_Position = projection * view * model * vec4(aPos, 1.0);
+    gl_Position = projection * vec4(FragPos, 1.0);
 }
\ No newline at end of file
@@ -0,0 +1,24 @@
+// Vertex attributes of the meshes and their decoding, see Includes/vertex_format.h.
+// Positions may be quantized against the mesh bounds and normals octahedral encoded; the
+// constants come with the VAO as attributes every instance reads the same value from.
+
+layout (location = 0) in vec3 aPos;
+layout (location = 1) in vec3 aNormal;    // xy only when octahedral
+layout (location = 2) in vec2 aTexCoords;
+layout (location = 11) in vec4 aPositionScale;  // w: 1 if the normals are octahedral
+layout (location = 12) in vec4 aPositionOffset;
+
+vec3 decodePosition()
+{
+    return aPos * aPositionScale.xyz + aPositionOffset.xyz;
+}
+
+vec3 decodeNormal()
+{
+    if (aPositionScale.w == 0.0)
+        return aNormal;
+    vec3 n = vec3(aNormal.xy, 1.0 - abs(aNormal.x) - abs(aNormal.y));
+    float t = max(-n.z, 0.0);
+    n.xy += mix(vec2(t), vec2(-t), greaterThanEqual(n.xy, vec2(0.0)));
+    return normalize(n);
+}